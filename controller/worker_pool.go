@@ -6,6 +6,8 @@ import (
 	"math/rand"
 	"sync"
 	"time"
+
+	"code.google.com/p/gogoprotobuf/proto"
 )
 
 import pentatope "./pentatope"
@@ -53,9 +55,14 @@ func renderShard(
 		log.Println("Rendering", shard.frameIndex, "in", server.GetId())
 		req := &pentatope.RenderRequest{
 			Task: &pentatope.RenderTask{
-				SamplePerPixel: wholeTask.SamplePerPixel,
-				Scene:          wholeTask.Scene,
-				Camera:         shard.frameConfig,
+				SamplePerPixel:   wholeTask.SamplePerPixel,
+				MaxPathDepth:     wholeTask.MaxPathDepth,
+				SampleSequence:   wholeTask.SampleSequence,
+				Seed:             proto.Uint64(wholeTask.GetSeed() + uint64(shard.frameIndex)),
+				AdaptiveSampling: wholeTask.AdaptiveSampling,
+				PacketTracing:    wholeTask.PacketTracing,
+				Scene:            wholeTask.Scene,
+				Camera:           shard.frameConfig,
 			},
 			SceneId: &cacheCtrl.sceneId,
 		}
@@ -51,49 +51,25 @@ def add_land(scene):
     img_x, img_y, img_z = land_size * (np.mgrid[0:n, 0:n, 0:n] / n - 0.5)
     img_pos = np.transpose([img_x, img_y, img_z, img_w], [1, 2, 3, 0])
 
-    # tetrahedron = base triangle + the top vertex
-    # tri0, tri1, tri2 (CCW), top (anti-normal side of the tri)
-    tetrahedrons = [
-        # base tris on Z=0 plane
-        [(0, 0, 0), (1, 0, 0), (1, 1, 0), (1, 0, 1)],
-        [(0, 0, 0), (1, 1, 0), (0, 1, 0), (0, 1, 1)],
-        # base tris on Z=1 plane
-        [(1, 0, 1), (0, 1, 1), (0, 0, 1), (0, 0, 0)],
-        [(1, 0, 1), (1, 1, 1), (0, 1, 1), (1, 1, 0)],
-        # middle
-        [(1, 0, 1), (0, 0, 0), (1, 1, 0), (0, 1, 1)]
-    ]
-
-    # Create 4D membrane by tetrahedrons.
-    for ix in xrange(n - 1):
-        for iy in xrange(n - 1):
-            for iz in xrange(n - 1):
-                parity = (ix + iy + iz) % 2
-                for tetra in tetrahedrons:
-                    # Flip x-axis in odd-parity cubes to close the gap.
-                    # See https://github.com/xanxys/pentatope/issues/30
-                    vs = [img_pos[ix + (dx ^ parity), iy + dy, iz + dz]
-                          for (dx, dy, dz) in tetra]
-
-                    # Create an object as a new element in the scene.
-                    obj = scene.objects.add()
-                    geom = obj.geometry
-                    # Populate a geometry.
-                    geom.type = proto.ObjectGeometry.TETRAHEDRON
-                    th = geom.Extensions[proto.TetrahedronGeometry.geom]
-                    for (ref_vertex, val_vertex) in zip([th.vertex0, th.vertex1, th.vertex2, th.vertex3], vs):
-                        ref_vertex.x = val_vertex[0]
-                        ref_vertex.y = val_vertex[1]
-                        ref_vertex.z = val_vertex[2]
-                        ref_vertex.w = val_vertex[3]
-                    # Populate Material.
-                    material = obj.material
-                    material.type = proto.ObjectMaterial.UNIFORM_LAMBERT
-                    lambert = material.Extensions[
-                        proto.UniformLambertMaterialProto.material]
-                    lambert.reflectance.r = 0.3
-                    lambert.reflectance.g = 0.25
-                    lambert.reflectance.b = 0.2
+    # Create 4D membrane by a height field.
+    # Sample i is at land_size * (i / n - 0.5) along x, y and z.
+    obj = scene.objects.add()
+    geom = obj.geometry
+    geom.type = proto.ObjectGeometry.HEIGHT_FIELD
+    field = geom.Extensions[proto.HeightFieldGeometry.geom]
+    field.resolution.extend([n, n, n])
+    field.heights.extend(img_w.reshape(-1).tolist())
+    field.xyz_min.extend([-land_size * 0.5] * 3)
+    field.xyz_max.extend([land_size * ((n - 1) / n - 0.5)] * 3)
+
+    # Populate Material.
+    material = obj.material
+    material.type = proto.ObjectMaterial.UNIFORM_LAMBERT
+    lambert = material.Extensions[
+        proto.UniformLambertMaterialProto.material]
+    lambert.reflectance.r = 0.3
+    lambert.reflectance.g = 0.25
+    lambert.reflectance.b = 0.2
 
     # Plant trees.
     for i in xrange(5000):
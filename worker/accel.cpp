@@ -1,186 +1,1310 @@
 #include "scene.h"
 
 #include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
 
 #include <boost/range/irange.hpp>
 #include <glog/logging.h>
 
+#include <slab_ray.h>
+
+#ifdef PENTATOPE_TRAVERSAL_STATS
+#define COUNT_TRAVERSAL(counter) (traversalStats().counter++)
+#define COUNT_TRAVERSAL_N(counter, n) (traversalStats().counter += (n))
+#else
+#define COUNT_TRAVERSAL(counter)
+#define COUNT_TRAVERSAL_N(counter, n)
+#endif
+
 namespace pentatope {
 
+TraversalStats::TraversalStats() :
+        nodes_visited(0), primitives_tested(0) {
+}
+
+TraversalStats& traversalStats() {
+    thread_local TraversalStats stats;
+    return stats;
+}
+
+namespace {
+
+// Evaluate surface and BSDF of the nearest hit, whose index
+// refers to object_refs. Returns an empty BSDF when nothing was hit.
+std::pair<std::unique_ptr<BSDF>, MicroGeometry> shadeHit(
+        const std::vector<std::reference_wrapper<const Object>>& object_refs,
+        const Ray& ray, const RayHit& hit) {
+    std::pair<std::unique_ptr<BSDF>, MicroGeometry> isect;
+    if(hit.index < 0) {
+        return isect;
+    }
+    const Object& object = object_refs[hit.index];
+    isect.second = object.first->microGeometry(ray, hit);
+    isect.first = object.second->getBSDF(isect.second);
+    return isect;
+}
+
+std::vector<const Geometry*> geometriesOf(
+        const std::vector<std::reference_wrapper<const Object>>& object_refs) {
+    std::vector<const Geometry*> geometries;
+    geometries.reserve(object_refs.size());
+    for(const Object& object : object_refs) {
+        geometries.push_back(object.first.get());
+    }
+    return geometries;
+}
+
+// Batch size of BVHBuilder for objects. When most of them are
+// packable, leaves are tested by blocks, so they're as large as a block.
+int leafBatchSize(const std::vector<Object>& objects) {
+    int n_packable = 0;
+    for(const auto& object : objects) {
+        if(PrimitiveStore::packable(object.first.get())) {
+            n_packable++;
+        }
+    }
+    return (n_packable * 2 >= static_cast<int>(objects.size())) ?
+        primitive_block_width : 1;
+}
+
+void collectLeafBegins(const BVHBuildNode& node, std::vector<int>& begins) {
+    if(node.isLeaf()) {
+        begins.push_back(node.first);
+    } else {
+        collectLeafBegins(*node.left, begins);
+        collectLeafBegins(*node.right, begins);
+    }
+}
+
+// Indices of objects in the order referred by leaves of root, which was
+// built by builder. Objects in each leaf are sorted by
+// PrimitiveStore::blockKind, so that each leaf is tested by as few
+// blocks as possible. First indices of leaves are stored to leaf_begins.
+std::vector<int> orderByLeaves(
+        const std::vector<Object>& objects, const BVHBuilder& builder,
+        const BVHBuildNode& root, std::vector<int>& leaf_begins) {
+    std::vector<int> kinds;
+    kinds.reserve(objects.size());
+    for(const auto& object : objects) {
+        kinds.push_back(PrimitiveStore::blockKind(object.first.get()));
+    }
+    std::vector<int> indices = builder.getOrderedIndices();
+    leaf_begins.clear();
+    collectLeafBegins(root, leaf_begins);
+    std::sort(leaf_begins.begin(), leaf_begins.end());
+    for(const int i : boost::irange(0, static_cast<int>(leaf_begins.size()))) {
+        const int end = (i + 1 < static_cast<int>(leaf_begins.size())) ?
+            leaf_begins[i + 1] : indices.size();
+        std::stable_sort(
+            indices.begin() + leaf_begins[i], indices.begin() + end,
+            [&kinds](int a, int b) {
+                return kinds[a] < kinds[b];
+            });
+    }
+    return indices;
+}
+
+// Bounds of a packet of rays sharing origin, to cull AABBs that
+// no ray in the packet can enter. Since direction signs are same for
+// all rays, near & far planes of each slab are also same, and entering
+// & exiting distances are bounded by interval arithmetic on
+// inverse directions.
+class PacketFrustum {
+public:
+    // Returns none when rays don't share origin or direction signs.
+    static boost::optional<PacketFrustum> fromRays(
+            const std::vector<SlabRay>& rays) {
+        assert(!rays.empty());
+        PacketFrustum frustum;
+        frustum.origin = rays[0].getOrigin();
+        frustum.inv_min = rays[0].getInvDirection().array();
+        frustum.inv_max = frustum.inv_min;
+        for(const auto& ray : rays) {
+            if(ray.getOrigin() != frustum.origin) {
+                return boost::none;
+            }
+            const Eigen::Array4f inv_dir = ray.getInvDirection().array();
+            for(const int axis : boost::irange(0, 4)) {
+                if(std::signbit(inv_dir(axis)) !=
+                        std::signbit(frustum.inv_min(axis))) {
+                    return boost::none;
+                }
+            }
+            frustum.inv_min = frustum.inv_min.min(inv_dir);
+            frustum.inv_max = frustum.inv_max.max(inv_dir);
+        }
+        for(const int axis : boost::irange(0, 4)) {
+            frustum.positive(axis) = !std::signbit(frustum.inv_min(axis));
+        }
+        return frustum;
+    }
+
+    // Returns false when no ray can enter [vmin, vmax].
+    bool mayIntersect(
+            const Eigen::Vector4f& vmin, const Eigen::Vector4f& vmax) const {
+        const Eigen::Array4f d_near =
+            positive.select(vmin, vmax).array() - origin.array();
+        const Eigen::Array4f d_far =
+            positive.select(vmax, vmin).array() - origin.array();
+        // x * [lo, hi] spans [min(x lo, x hi), max(x lo, x hi)].
+        const float t_near_lower = std::max(0.0f,
+            (d_near * inv_min).min(d_near * inv_max).maxCoeff());
+        const float t_far_upper =
+            (d_far * inv_min).max(d_far * inv_max).minCoeff();
+        return t_near_lower <= t_far_upper;
+    }
+private:
+    Eigen::Vector4f origin;
+    Eigen::Array4f inv_min;
+    Eigen::Array4f inv_max;
+    // Whether inverse directions along each axis are positive.
+    Eigen::Matrix<bool, 4, 1> positive;
+};
+
+}  // namespace
+
+
+std::vector<std::pair<std::unique_ptr<BSDF>, MicroGeometry>>
+        Accel::intersectPacket(const std::vector<Ray>& rays) const {
+    std::vector<std::pair<std::unique_ptr<BSDF>, MicroGeometry>> isects;
+    isects.reserve(rays.size());
+    for(const auto& ray : rays) {
+        isects.push_back(intersect(ray));
+    }
+    return isects;
+}
+
+
 void BruteForceAccel::build(
         const std::vector<Object>& objects) {
     for(const auto& object : objects) {
         object_refs.push_back(object);
     }
+    // All objects are tested at once, so pack them into as few blocks
+    // as possible.
+    primitives = PrimitiveStore(
+        geometriesOf(object_refs), std::vector<int>());
 }
 
 std::pair<std::unique_ptr<BSDF>, MicroGeometry>
         BruteForceAccel::intersect(const Ray& ray) const {
-    float t_min = std::numeric_limits<float>::max();
-    std::pair<std::unique_ptr<BSDF>, MicroGeometry> isect_nearest;
-
-    for(const auto object : object_refs) {
-        auto isect = object.get().first->intersect(ray);
-        if(!isect) {
-            continue;
-        }
-        const float t = ray.at(isect->pos());
-        if(t < t_min) {
-            isect_nearest.first.reset(
-                object.get().second->getBSDF(*isect).release());
-            isect_nearest.second = *isect;
-            t_min = t;
-        }
+    RayHit hit_nearest;
+    COUNT_TRAVERSAL_N(primitives_tested, primitives.size());
+    const auto hit = primitives.intersectRange(0, primitives.size(), ray);
+    if(hit) {
+        hit_nearest = *hit;
     }
-    return isect_nearest;
+    return shadeHit(object_refs, ray, hit_nearest);
+}
+
+bool BruteForceAccel::occluded(const Ray& ray) const {
+    COUNT_TRAVERSAL_N(primitives_tested, primitives.size());
+    return static_cast<bool>(
+        primitives.intersectRange(0, primitives.size(), ray));
+}
+
+size_t BruteForceAccel::memoryUsage() const {
+    return object_refs.capacity() * sizeof(object_refs[0]) +
+        primitives.memoryUsage();
 }
 
 
+BVHAccel::BVHAccel(BVHBuilder::Method method, int n_threads) :
+        method(method), n_threads(n_threads), sah_cost(0),
+        node_array(nullptr), n_nodes(0) {
+}
+
 void BVHAccel::build(const std::vector<Object>& objects) {
+    nodes.clear();
+    mapping.reset();
+    node_array = nullptr;
+    n_nodes = 0;
+    object_indices.clear();
+    object_refs.clear();
+    primitives = PrimitiveStore();
+    sah_cost = 0;
     if(objects.empty()) {
-        root.release();
+        return;
+    }
+    // Calculate all AABBs only once, since some (e.g. OBB) are
+    // not cheap.
+    std::vector<AABB> aabbs;
+    aabbs.reserve(objects.size());
+    for(const auto& object : objects) {
+        aabbs.push_back(object.first->bounds());
+    }
+    BVHBuilder builder(method, n_threads, leafBatchSize(objects));
+    const auto root = builder.build(aabbs);
+    std::vector<int> leaf_begins;
+    for(const int index : orderByLeaves(objects, builder, *root, leaf_begins)) {
+        object_indices.push_back(index);
+        object_refs.push_back(objects[index]);
+    }
+    primitives = PrimitiveStore(geometriesOf(object_refs), leaf_begins);
+    sah_cost = BVHBuilder::sahCost(*root);
+    flatten(*root);
+    node_array = nodes.data();
+    n_nodes = nodes.size();
+    LOG(INFO) << "BVH built: #objects=" << objects.size() <<
+        " #nodes=" << nodes.size() << " SAH cost=" << sah_cost;
+}
+
+float BVHAccel::sahCost() const {
+    return sah_cost;
+}
+
+void BVHAccel::save(AccelCache& cache) const {
+    static_assert(sizeof(CacheHeader) % 16 == 0,
+        "nodes after CacheHeader must be aligned");
+    CacheHeader header;
+    header.node_size = sizeof(LinearNode);
+    header.n_nodes = n_nodes;
+    header.n_objects = object_indices.size();
+    header.sah_cost = sah_cost;
+
+    std::string section;
+    section.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    section.append(reinterpret_cast<const char*>(node_array),
+        sizeof(LinearNode) * n_nodes);
+    section.append(reinterpret_cast<const char*>(object_indices.data()),
+        sizeof(uint32_t) * object_indices.size());
+    cache.addSection(std::move(section));
+}
+
+bool BVHAccel::load(
+        AccelCache& cache, const std::vector<Object>& objects) {
+    build({});
+    const auto section = cache.nextSection();
+    if(!section) {
+        return false;
+    }
+    CacheHeader header;
+    if(section->size < sizeof(header)) {
+        LOG(WARNING) << "Ignoring incompatible BVH cache";
+        return false;
+    }
+    std::memcpy(&header, section->data, sizeof(header));
+    if(header.node_size != sizeof(LinearNode) ||
+            header.n_objects != objects.size() ||
+            section->size != sizeof(CacheHeader) +
+                sizeof(LinearNode) * static_cast<size_t>(header.n_nodes) +
+                sizeof(uint32_t) * static_cast<size_t>(header.n_objects)) {
+        LOG(WARNING) << "Ignoring incompatible BVH cache";
+        return false;
+    }
+    const LinearNode* section_nodes = reinterpret_cast<const LinearNode*>(
+        section->data + sizeof(CacheHeader));
+    const char* section_indices = section->data + sizeof(CacheHeader) +
+        sizeof(LinearNode) * header.n_nodes;
+
+    // Validate all references, so that a corrupted file can't make
+    // traversal read out of bounds.
+    std::vector<uint32_t> indices(header.n_objects);
+    std::memcpy(indices.data(), section_indices,
+        sizeof(uint32_t) * header.n_objects);
+    for(const uint32_t index : indices) {
+        if(index >= objects.size()) {
+            return false;
+        }
+    }
+    const bool valid = isValidTree(section_nodes, header.n_nodes,
+        [&header](const LinearNode& leaf) {
+            return leaf.offset <= header.n_objects &&
+                leaf.count <= header.n_objects - leaf.offset;
+        });
+    if(!valid) {
+        LOG(WARNING) << "Ignoring corrupted BVH cache";
+        return false;
+    }
+
+    mapping = cache.getMapping();
+    node_array = section_nodes;
+    n_nodes = header.n_nodes;
+    sah_cost = header.sah_cost;
+    object_indices = std::move(indices);
+    for(const uint32_t index : object_indices) {
+        object_refs.push_back(objects[index]);
+    }
+    std::vector<int> leaf_begins;
+    for(const uint32_t i : boost::irange(0u, n_nodes)) {
+        if(node_array[i].count > 0) {
+            leaf_begins.push_back(node_array[i].offset);
+        }
+    }
+    primitives = PrimitiveStore(geometriesOf(object_refs), leaf_begins);
+    LOG(INFO) << "BVH loaded: #objects=" <<
+        objects.size() << " #nodes=" << n_nodes;
+    return true;
+}
+
+uint32_t BVHAccel::flatten(const BVHBuildNode& node) {
+    const uint32_t index = nodes.size();
+    nodes.emplace_back();
+    nodes[index].vmin = node.aabb.min();
+    nodes[index].vmax = node.aabb.max();
+    if(node.isLeaf()) {
+        nodes[index].offset = node.first;
+        nodes[index].count = node.count;
     } else {
-        std::vector<std::reference_wrapper<const Object>>
-            object_refs;
-        for(const auto& object : objects) {
-            object_refs.push_back(object);
+        flatten(*node.left);
+        // Don't hold reference to nodes[index] across recursion,
+        // since nodes can be reallocated.
+        const uint32_t index_right = flatten(*node.right);
+        nodes[index].offset = index_right;
+        nodes[index].count = 0;
+    }
+    return index;
+}
+
+std::pair<std::unique_ptr<BSDF>, MicroGeometry>
+        BVHAccel::intersect(const Ray& ray) const {
+    RayHit hit_nearest;
+    if(n_nodes == 0) {
+        return shadeHit(object_refs, ray, hit_nearest);
+    }
+    const SlabRay slab_ray(ray);
+    hit_nearest.t = ray.t_max;
+    float t_entry;
+    if(!slab_ray.intersect(node_array[0].vmin, node_array[0].vmax, hit_nearest.t, t_entry)) {
+        return shadeHit(object_refs, ray, hit_nearest);
+    }
+    Ray query(ray);
+    intersectSubtree(0, slab_ray, query, hit_nearest);
+    return shadeHit(object_refs, ray, hit_nearest);
+}
+
+void BVHAccel::intersectSubtree(
+        uint32_t root, const SlabRay& slab_ray,
+        Ray& query, RayHit& hit_nearest) const {
+    const float& t_nearest = hit_nearest.t;
+    // Subtrees to visit later, and their entry distances.
+    std::array<std::pair<uint32_t, float>, BVHBuilder::max_depth> stack;
+    int stack_size = 0;
+    uint32_t current = root;
+    while(true) {
+        const LinearNode& node = node_array[current];
+        COUNT_TRAVERSAL(nodes_visited);
+        if(node.count > 0) {
+            // leaf
+            COUNT_TRAVERSAL_N(primitives_tested, node.count);
+            const auto hit =
+                primitives.intersectRange(node.offset, node.count, query);
+            if(hit) {
+                hit_nearest = *hit;
+                query.t_max = hit->t;
+            }
+        } else {
+            // branch: visit nearer child first, and remember the other.
+            const uint32_t child0 = current + 1;
+            const uint32_t child1 = node.offset;
+            float t_entry0;
+            float t_entry1;
+            const bool hit0 = slab_ray.intersect(
+                node_array[child0].vmin, node_array[child0].vmax, t_nearest, t_entry0);
+            const bool hit1 = slab_ray.intersect(
+                node_array[child1].vmin, node_array[child1].vmax, t_nearest, t_entry1);
+            if(hit0 && hit1) {
+                assert(stack_size < static_cast<int>(stack.size()));
+                if(t_entry0 <= t_entry1) {
+                    stack[stack_size++] = std::make_pair(child1, t_entry1);
+                    current = child0;
+                } else {
+                    stack[stack_size++] = std::make_pair(child0, t_entry0);
+                    current = child1;
+                }
+                continue;
+            } else if(hit0) {
+                current = child0;
+                continue;
+            } else if(hit1) {
+                current = child1;
+                continue;
+            }
+        }
+        // Pop next subtree, skipping ones that are farther than
+        // what we've already found.
+        bool found_next = false;
+        while(stack_size > 0) {
+            stack_size--;
+            if(stack[stack_size].second <= t_nearest) {
+                current = stack[stack_size].first;
+                found_next = true;
+                break;
+            }
+        }
+        if(!found_next) {
+            break;
+        }
+    }
+}
+
+
+std::vector<std::pair<std::unique_ptr<BSDF>, MicroGeometry>>
+        BVHAccel::intersectPacket(const std::vector<Ray>& rays) const {
+    const int n_rays = rays.size();
+    std::vector<RayHit> hits(n_rays);
+    for(const int i : boost::irange(0, n_rays)) {
+        hits[i].t = rays[i].t_max;
+    }
+    if(n_nodes != 0 && n_rays > 0) {
+        std::vector<SlabRay> slab_rays(rays.begin(), rays.end());
+        std::vector<Ray> queries(rays);
+        const auto frustum = PacketFrustum::fromRays(slab_rays);
+        // Index of the first ray from first that enters node (n_rays if
+        // none), and its entry distance.
+        auto firstActive = [&](uint32_t index, int first, float& t_entry) {
+            const LinearNode& node = node_array[index];
+            while(first < n_rays &&
+                    !slab_rays[first].intersect(
+                        node.vmin, node.vmax, hits[first].t, t_entry)) {
+                first++;
+            }
+            return first;
+        };
+
+        // Subtrees to visit later, with the first ray that enters them
+        // and its entry distance. Rays before it are known to miss the
+        // subtree.
+        struct Entry {
+            uint32_t index;
+            int first_active;
+            float t_entry;
+        };
+        std::array<Entry, BVHBuilder::max_depth + 1> stack;
+        int stack_size = 0;
+        {
+            Entry root;
+            root.index = 0;
+            root.first_active = firstActive(0, 0, root.t_entry);
+            if(root.first_active < n_rays &&
+                    (!frustum || frustum->mayIntersect(
+                        node_array[0].vmin, node_array[0].vmax))) {
+                stack[stack_size++] = root;
+            }
+        }
+        while(stack_size > 0) {
+            Entry entry = stack[--stack_size];
+            // The first ray may have found a nearer hit since pushed.
+            if(entry.t_entry > hits[entry.first_active].t) {
+                entry.first_active = firstActive(
+                    entry.index, entry.first_active + 1, entry.t_entry);
+                if(entry.first_active == n_rays) {
+                    continue;
+                }
+            }
+            const int first_active = entry.first_active;
+            const LinearNode& node = node_array[entry.index];
+            COUNT_TRAVERSAL(nodes_visited);
+
+            if(node.count > 0) {
+                // leaf
+                for(const int i : boost::irange(first_active, n_rays)) {
+                    float t_entry;
+                    if(i > first_active && !slab_rays[i].intersect(
+                            node.vmin, node.vmax, hits[i].t, t_entry)) {
+                        continue;
+                    }
+                    COUNT_TRAVERSAL_N(primitives_tested, node.count);
+                    const auto hit = primitives.intersectRange(
+                        node.offset, node.count, queries[i]);
+                    if(hit) {
+                        hits[i] = *hit;
+                        queries[i].t_max = hit->t;
+                    }
+                }
+            } else if((n_rays - first_active) * 2 < n_rays) {
+                // Rays before first_active miss this subtree, so fewer
+                // than half of the packet can enter it. Testing nodes
+                // against the packet then wastes more than it shares,
+                // so trace the remaining rays one by one.
+                for(const int i : boost::irange(first_active, n_rays)) {
+                    float t_entry;
+                    if(i == first_active || slab_rays[i].intersect(
+                            node.vmin, node.vmax, hits[i].t, t_entry)) {
+                        intersectSubtree(
+                            entry.index, slab_rays[i], queries[i], hits[i]);
+                    }
+                }
+            } else {
+                // branch: skip children that no ray enters, and visit
+                // the child entered by an earlier ray (or nearer, for
+                // the same ray) first.
+                Entry children[2];
+                int n_children = 0;
+                for(const uint32_t child : {entry.index + 1, node.offset}) {
+                    const LinearNode& child_node = node_array[child];
+                    if(frustum && !frustum->mayIntersect(
+                            child_node.vmin, child_node.vmax)) {
+                        continue;
+                    }
+                    Entry& child_entry = children[n_children];
+                    child_entry.index = child;
+                    child_entry.first_active = firstActive(
+                        child, first_active, child_entry.t_entry);
+                    if(child_entry.first_active < n_rays) {
+                        n_children++;
+                    }
+                }
+                if(n_children == 2 && (
+                        children[1].first_active < children[0].first_active ||
+                        (children[1].first_active == children[0].first_active &&
+                            children[1].t_entry < children[0].t_entry))) {
+                    std::swap(children[0], children[1]);
+                }
+                assert(stack_size + n_children <= static_cast<int>(stack.size()));
+                for(int i = n_children - 1; i >= 0; i--) {
+                    stack[stack_size++] = children[i];
+                }
+            }
+        }
+    }
+
+    std::vector<std::pair<std::unique_ptr<BSDF>, MicroGeometry>> isects;
+    isects.reserve(n_rays);
+    for(const int i : boost::irange(0, n_rays)) {
+        isects.push_back(shadeHit(object_refs, rays[i], hits[i]));
+    }
+    return isects;
+}
+
+bool BVHAccel::occluded(const Ray& ray) const {
+    if(n_nodes == 0) {
+        return false;
+    }
+    // Any hit is enough, so visit nodes in whatever order.
+    const SlabRay slab_ray(ray);
+    std::array<uint32_t, BVHBuilder::max_depth + 1> stack;
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while(stack_size > 0) {
+        const uint32_t current = stack[--stack_size];
+        const LinearNode& node = node_array[current];
+        float t_entry;
+        if(!slab_ray.intersect(node.vmin, node.vmax, ray.t_max, t_entry)) {
+            continue;
+        }
+        COUNT_TRAVERSAL(nodes_visited);
+        if(node.count > 0) {
+            COUNT_TRAVERSAL_N(primitives_tested, node.count);
+            if(primitives.intersectRange(node.offset, node.count, ray)) {
+                return true;
+            }
+        } else {
+            assert(stack_size + 2 <= static_cast<int>(stack.size()));
+            stack[stack_size++] = node.offset;
+            stack[stack_size++] = current + 1;
         }
-        root = buildTree(object_refs);
     }
+    return false;
+}
+
+size_t BVHAccel::memoryUsage() const {
+    // Mapped nodes are counted too, since they occupy page cache.
+    return n_nodes * sizeof(LinearNode) +
+        object_indices.capacity() * sizeof(uint32_t) +
+        object_refs.capacity() * sizeof(object_refs[0]) +
+        primitives.memoryUsage();
+}
+
+
+const int WideBVHAccel::width;
+
+WideBVHAccel::WideBVHAccel(BVHBuilder::Method method, int n_threads) :
+        method(method), n_threads(n_threads) {
 }
 
-std::unique_ptr<BVHAccel::BVHNode> BVHAccel::buildTree(
-        const std::vector<
-            std::reference_wrapper<const Object>>& objects) const {
-    const int minimum_objects_per_node = 3;
-    assert(!objects.empty());
-    // Calculate all AABBs and their union.
+void WideBVHAccel::build(const std::vector<Object>& objects) {
+    nodes.clear();
+    object_refs.clear();
+    primitives = PrimitiveStore();
+    if(objects.empty()) {
+        return;
+    }
     std::vector<AABB> aabbs;
+    aabbs.reserve(objects.size());
     for(const auto& object : objects) {
-        aabbs.push_back(object.get().first->bounds());
+        aabbs.push_back(object.first->bounds());
+    }
+    BVHBuilder builder(method, n_threads, leafBatchSize(objects));
+    const auto root = builder.build(aabbs);
+    std::vector<int> leaf_begins;
+    for(const int index : orderByLeaves(objects, builder, *root, leaf_begins)) {
+        object_refs.push_back(objects[index]);
+    }
+    primitives = PrimitiveStore(geometriesOf(object_refs), leaf_begins);
+    collapse(*root);
+    LOG(INFO) << "Wide BVH built: #objects=" << objects.size() <<
+        " #nodes=" << nodes.size();
+}
+
+uint32_t WideBVHAccel::collapse(const BVHBuildNode& node) {
+    // Open the largest branch until we have enough children.
+    std::vector<const BVHBuildNode*> children;
+    if(node.isLeaf()) {
+        children.push_back(&node);
+    } else {
+        children.push_back(node.left.get());
+        children.push_back(node.right.get());
+    }
+    while(static_cast<int>(children.size()) < width) {
+        int i_largest = -1;
+        for(const int i : boost::irange(0, static_cast<int>(children.size()))) {
+            if(children[i]->isLeaf()) {
+                continue;
+            }
+            if(i_largest < 0 || children[i]->aabb.surface() >
+                    children[i_largest]->aabb.surface()) {
+                i_largest = i;
+            }
+        }
+        if(i_largest < 0) {
+            break;
+        }
+        const BVHBuildNode* branch = children[i_largest];
+        children[i_largest] = branch->left.get();
+        children.push_back(branch->right.get());
     }
-    const auto aabb_whole = AABB::fromAABBs(aabbs);
-    auto node = std::make_unique<BVHNode>();
-    node->aabb = aabb_whole;
-    // Create a leaf when object is few.
-    if(objects.size() <= minimum_objects_per_node) {
-        for(const auto obj_ref : objects) {
-            node->objects.push_back(obj_ref);
+
+    const uint32_t index = nodes.size();
+    nodes.emplace_back();
+    nodes[index].n_children = children.size();
+    for(const int i : boost::irange(0, width)) {
+        // Fill unused slots with something harmless;
+        // they're masked out during traversal anyway.
+        const AABB& aabb = children[std::min<int>(i, children.size() - 1)]->aabb;
+        for(const int axis : boost::irange(0, 4)) {
+            nodes[index].vmin[axis][i] = aabb.min()(axis);
+            nodes[index].vmax[axis][i] = aabb.max()(axis);
         }
-        return node;
+        nodes[index].child[i] = 0;
+        nodes[index].count[i] = 0;
     }
-    // Otherwise, create a branch.
-    float longest_size = 0;
-    int longest_axis = -1;
-    for(const int axis : boost::irange(0, 4)) {
-        const float size = aabb_whole.size()(axis);
-        if(size > longest_size) {
-            longest_size = size;
-            longest_axis = axis;
-        }
-    }
-    assert(longest_axis >= 0);
-    const float midpoint = aabb_whole.center()(longest_axis);
-    // Partition objects by comparing centroids of objects
-    // with midpoint of the chosen axis.
-    std::vector<
-        std::reference_wrapper<const Object>> children0;
-    std::vector<
-        std::reference_wrapper<const Object>> children1;
-    for(const auto obj_ref : objects) {
-        if(obj_ref.get().first->bounds().center()(longest_axis)
-                < midpoint) {
-            children0.push_back(obj_ref);
+    for(const int i : boost::irange(0, static_cast<int>(children.size()))) {
+        if(children[i]->isLeaf()) {
+            nodes[index].child[i] = children[i]->first;
+            nodes[index].count[i] = children[i]->count;
         } else {
-            children1.push_back(obj_ref);
+            // Don't hold reference to nodes[index] across recursion,
+            // since nodes can be reallocated.
+            const uint32_t index_child = collapse(*children[i]);
+            nodes[index].child[i] = index_child;
         }
     }
-    assert(children0.size() + children1.size() == objects.size());
-    if(!children0.empty() && !children1.empty()) {
-        node->left = buildTree(children0);
-        node->right = buildTree(children1);
-        return node;
-    }
-    // Fallback to median splitting.
-    std::vector<std::reference_wrapper<const Object>> children_sorted = objects;
-    std::sort(children_sorted.begin(), children_sorted.end(),
-        [&longest_axis](auto obj0, auto obj1) {
-            return obj0.get().first->bounds().center()(longest_axis) <
-                obj1.get().first->bounds().center()(longest_axis);
-        });
-    const std::size_t n0 = children_sorted.size() / 2;
-    assert(n0 < children_sorted.size());
-    children0.clear();
-    children1.clear();
-    children0.insert(children0.begin(),
-            children_sorted.begin(), children_sorted.begin() + n0);
-    children1.insert(children1.begin(),
-            children_sorted.begin() + n0, children_sorted.end());
-    assert(children0.size() + children1.size() == objects.size());
-    assert(!children0.empty());
-    assert(!children1.empty());
-    node->left = buildTree(children0);
-    node->right = buildTree(children1);
-    return node;
+    return index;
 }
 
 std::pair<std::unique_ptr<BSDF>, MicroGeometry>
-        BVHAccel::intersect(const Ray& ray) const {
-    if(!root) {
-        return std::make_pair(nullptr, MicroGeometry());
+        WideBVHAccel::intersect(const Ray& ray) const {
+    RayHit hit_nearest;
+    if(nodes.empty()) {
+        return shadeHit(object_refs, ray, hit_nearest);
+    }
+    const SlabRay4 slab_ray(ray);
+
+    // Children to visit later. Same as WideNode, count > 0 means a leaf.
+    struct StackEntry {
+        uint32_t child;
+        uint32_t count;
+        float t_entry;
+    };
+    std::array<StackEntry, BVHBuilder::max_depth * (width - 1) + 1> stack;
+    int stack_size = 0;
+    stack[stack_size++] = StackEntry{0, 0, 0};
+
+    float& t_nearest = hit_nearest.t;
+    t_nearest = ray.t_max;
+    Ray query(ray);
+    while(stack_size > 0) {
+        const StackEntry entry = stack[--stack_size];
+        if(entry.t_entry > t_nearest) {
+            continue;
+        }
+        COUNT_TRAVERSAL(nodes_visited);
+        if(entry.count > 0) {
+            // leaf
+            COUNT_TRAVERSAL_N(primitives_tested, entry.count);
+            const auto hit =
+                primitives.intersectRange(entry.child, entry.count, query);
+            if(hit) {
+                hit_nearest = *hit;
+                query.t_max = hit->t;
+            }
+            continue;
+        }
+
+        const WideNode& node = nodes[entry.child];
+        alignas(16) float t_entries[width];
+        const int hit_mask = slab_ray.intersect(
+            node.vmin, node.vmax, t_nearest, t_entries) &
+            ((1 << node.n_children) - 1);
+        if(hit_mask == 0) {
+            continue;
+        }
+
+        // Push hit children so that the nearest one is popped first.
+        const int stack_base = stack_size;
+        for(const int i : boost::irange(0, width)) {
+            if(!(hit_mask & (1 << i))) {
+                continue;
+            }
+            const StackEntry child_entry{
+                node.child[i], node.count[i], t_entries[i]};
+            int pos = stack_size++;
+            assert(stack_size <= static_cast<int>(stack.size()));
+            while(pos > stack_base &&
+                    stack[pos - 1].t_entry < child_entry.t_entry) {
+                stack[pos] = stack[pos - 1];
+                pos--;
+            }
+            stack[pos] = child_entry;
+        }
     }
-    return intersectTree(*root, ray);
+    return shadeHit(object_refs, ray, hit_nearest);
 }
 
-std::pair<std::unique_ptr<BSDF>, MicroGeometry>
-        BVHAccel::intersectTree(const BVHNode& node, const Ray& ray) const {
-    if(!node.aabb.intersect(ray)) {
-        return std::make_pair(nullptr, MicroGeometry());
-    }
-    if(!node.objects.empty()) {
-        // leaf
-        assert(!node.left && !node.right);
-        float t_min = std::numeric_limits<float>::max();
-        std::pair<std::unique_ptr<BSDF>, MicroGeometry> isect_nearest;
-        for(const auto object : node.objects) {
-            auto isect = object.get().first->intersect(ray);
-            if(!isect) {
+bool WideBVHAccel::occluded(const Ray& ray) const {
+    if(nodes.empty()) {
+        return false;
+    }
+    const SlabRay4 slab_ray(ray);
+
+    // Any hit is enough, so visit nodes in whatever order.
+    std::array<uint32_t, BVHBuilder::max_depth * (width - 1) + 1> stack;
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while(stack_size > 0) {
+        const WideNode& node = nodes[stack[--stack_size]];
+        COUNT_TRAVERSAL(nodes_visited);
+        alignas(16) float t_entries[width];
+        const int hit_mask = slab_ray.intersect(
+            node.vmin, node.vmax, ray.t_max, t_entries) &
+            ((1 << node.n_children) - 1);
+        for(const int i : boost::irange(0, width)) {
+            if(!(hit_mask & (1 << i))) {
                 continue;
             }
-            const float t = ray.at(isect->pos());
-            if(t < t_min) {
-                isect_nearest.first.reset(
-                    object.get().second->getBSDF(*isect).release());
-                isect_nearest.second = *isect;
-                t_min = t;
+            if(node.count[i] == 0) {
+                assert(stack_size < static_cast<int>(stack.size()));
+                stack[stack_size++] = node.child[i];
+                continue;
+            }
+            COUNT_TRAVERSAL(nodes_visited);
+            COUNT_TRAVERSAL_N(primitives_tested, node.count[i]);
+            if(primitives.intersectRange(
+                    node.child[i], node.count[i], ray)) {
+                return true;
             }
         }
-        return isect_nearest;
+    }
+    return false;
+}
+
+size_t WideBVHAccel::memoryUsage() const {
+    return nodes.capacity() * sizeof(WideNode) +
+        object_refs.capacity() * sizeof(object_refs[0]) +
+        primitives.memoryUsage();
+}
+
+
+const int QuantizedBVHAccel::n_levels;
+
+QuantizedBVHAccel::QuantizedBVHAccel(
+        BVHBuilder::Method method, int n_threads) :
+        method(method), n_threads(n_threads) {
+}
+
+void QuantizedBVHAccel::build(const std::vector<Object>& objects) {
+    nodes.clear();
+    object_refs.clear();
+    primitives = PrimitiveStore();
+    if(objects.empty()) {
+        return;
+    }
+    std::vector<AABB> aabbs;
+    aabbs.reserve(objects.size());
+    for(const auto& object : objects) {
+        aabbs.push_back(object.first->bounds());
+    }
+    BVHBuilder builder(method, n_threads, leafBatchSize(objects));
+    const auto root_node = builder.build(aabbs);
+    std::vector<int> leaf_begins;
+    for(const int index :
+            orderByLeaves(objects, builder, *root_node, leaf_begins)) {
+        object_refs.push_back(objects[index]);
+    }
+    primitives = PrimitiveStore(geometriesOf(object_refs), leaf_begins);
+    // The root is the only node whose bounds are stored exactly.
+    root.vmin = root_node->aabb.min();
+    root.vmax = root_node->aabb.max();
+    if(root_node->isLeaf()) {
+        root.child = root_node->first;
+        root.count = root_node->count;
     } else {
-        // branch
-        assert(node.left && node.right);
-        auto isect_left = intersectTree(*node.left, ray);
-        auto isect_right = intersectTree(*node.right, ray);
-        if(isect_left.first && isect_right.first) {
-            const float t_left = ray.at(isect_left.second.pos());
-            const float t_right = ray.at(isect_right.second.pos());
-            if(t_left < t_right) {
-                return isect_left;
-            } else {
-                return isect_right;
+        root.child = quantize(*root_node, root.vmin, root.vmax);
+        root.count = 0;
+    }
+    LOG(INFO) << "Quantized BVH built: #objects=" << objects.size() <<
+        " #nodes=" << nodes.size() <<
+        " node bytes=" << nodes.size() * sizeof(QuantizedNode);
+}
+
+void QuantizedBVHAccel::dequantize(
+        const QuantizedNode& node,
+        const Eigen::Vector4f& vmin, const Eigen::Vector4f& vmax,
+        int i, Eigen::Vector4f& child_vmin, Eigen::Vector4f& child_vmax) {
+    const Eigen::Array4f step = (vmax - vmin).array() * (1.0f / n_levels);
+    Eigen::Array4f qmin;
+    Eigen::Array4f qmax_complement;
+    for(const int axis : boost::irange(0, 4)) {
+        qmin(axis) = node.qmin[i][axis];
+        qmax_complement(axis) = n_levels - node.qmax[i][axis];
+    }
+    // Measure from the nearer end, so that 0 and n_levels decode to
+    // vmin and vmax exactly.
+    child_vmin = (vmin.array() + qmin * step).matrix();
+    child_vmax = (vmax.array() - qmax_complement * step).matrix();
+}
+
+uint32_t QuantizedBVHAccel::quantize(
+        const BVHBuildNode& node,
+        const Eigen::Vector4f& vmin, const Eigen::Vector4f& vmax) {
+    assert(!node.isLeaf());
+    const uint32_t index = nodes.size();
+    nodes.emplace_back();
+    QuantizedNode qnode;
+    const std::array<const BVHBuildNode*, 2> children = {
+        node.left.get(), node.right.get()};
+    const Eigen::Vector4f extent = vmax - vmin;
+    for(const int i : boost::irange(0, 2)) {
+        const AABB& aabb = children[i]->aabb;
+        for(const int axis : boost::irange(0, 4)) {
+            float qmin = 0;
+            float qmax = n_levels;
+            if(extent(axis) > 0) {
+                qmin = std::floor(
+                    (aabb.min()(axis) - vmin(axis)) / extent(axis) * n_levels);
+                qmax = std::ceil(
+                    (aabb.max()(axis) - vmin(axis)) / extent(axis) * n_levels);
+            }
+            qnode.qmin[i][axis] = static_cast<uint8_t>(
+                std::min<float>(n_levels, std::max<float>(0, qmin)));
+            qnode.qmax[i][axis] = static_cast<uint8_t>(
+                std::min<float>(n_levels, std::max<float>(0, qmax)));
+        }
+        // Widen until decoded bounds contain the child despite
+        // rounding errors. This terminates because 0 and n_levels
+        // decode to bounds of the node, which contain the child.
+        while(true) {
+            Eigen::Vector4f child_vmin;
+            Eigen::Vector4f child_vmax;
+            dequantize(qnode, vmin, vmax, i, child_vmin, child_vmax);
+            bool conservative = true;
+            for(const int axis : boost::irange(0, 4)) {
+                if(child_vmin(axis) > aabb.min()(axis)) {
+                    assert(qnode.qmin[i][axis] > 0);
+                    qnode.qmin[i][axis]--;
+                    conservative = false;
+                }
+                if(child_vmax(axis) < aabb.max()(axis)) {
+                    assert(qnode.qmax[i][axis] < n_levels);
+                    qnode.qmax[i][axis]++;
+                    conservative = false;
+                }
+            }
+            if(conservative) {
+                break;
+            }
+        }
+    }
+    for(const int i : boost::irange(0, 2)) {
+        if(children[i]->isLeaf()) {
+            assert(children[i]->count <= std::numeric_limits<uint8_t>::max());
+            qnode.child[i] = children[i]->first;
+            qnode.count[i] = children[i]->count;
+        } else {
+            // Children are quantized relative to decoded bounds,
+            // which are what traversal sees.
+            Eigen::Vector4f child_vmin;
+            Eigen::Vector4f child_vmax;
+            dequantize(qnode, vmin, vmax, i, child_vmin, child_vmax);
+            qnode.child[i] = quantize(*children[i], child_vmin, child_vmax);
+            qnode.count[i] = 0;
+        }
+    }
+    // Don't hold reference to nodes[index] across recursion,
+    // since nodes can be reallocated.
+    nodes[index] = qnode;
+    return index;
+}
+
+std::pair<std::unique_ptr<BSDF>, MicroGeometry>
+        QuantizedBVHAccel::intersect(const Ray& ray) const {
+    RayHit hit_nearest;
+    if(object_refs.empty()) {
+        return shadeHit(object_refs, ray, hit_nearest);
+    }
+    const SlabRay slab_ray(ray);
+    float& t_nearest = hit_nearest.t;
+    t_nearest = ray.t_max;
+    float t_entry;
+    if(!slab_ray.intersect(root.vmin, root.vmax, t_nearest, t_entry)) {
+        return shadeHit(object_refs, ray, hit_nearest);
+    }
+
+    Ray query(ray);
+    // Subtrees to visit later, and their entry distances.
+    std::array<std::pair<Subtree, float>, BVHBuilder::max_depth + 1> stack;
+    int stack_size = 0;
+    stack[stack_size++] = std::make_pair(root, t_entry);
+    while(stack_size > 0) {
+        stack_size--;
+        if(stack[stack_size].second > t_nearest) {
+            continue;
+        }
+        COUNT_TRAVERSAL(nodes_visited);
+        const Subtree subtree = stack[stack_size].first;
+        if(subtree.count > 0) {
+            // leaf
+            COUNT_TRAVERSAL_N(primitives_tested, subtree.count);
+            const auto hit =
+                primitives.intersectRange(subtree.child, subtree.count, query);
+            if(hit) {
+                hit_nearest = *hit;
+                query.t_max = hit->t;
+            }
+            continue;
+        }
+        // branch: push the farther child first, so that the nearer
+        // one is visited next.
+        const QuantizedNode& node = nodes[subtree.child];
+        std::array<Subtree, 2> children;
+        std::array<float, 2> t_entries;
+        std::array<bool, 2> hits;
+        for(const int i : boost::irange(0, 2)) {
+            dequantize(node, subtree.vmin, subtree.vmax, i,
+                children[i].vmin, children[i].vmax);
+            children[i].child = node.child[i];
+            children[i].count = node.count[i];
+            hits[i] = slab_ray.intersect(
+                children[i].vmin, children[i].vmax, t_nearest, t_entries[i]);
+        }
+        const int first = (hits[1] && (!hits[0] || t_entries[1] < t_entries[0])) ? 1 : 0;
+        for(const int i : {1 - first, first}) {
+            if(hits[i]) {
+                assert(stack_size < static_cast<int>(stack.size()));
+                stack[stack_size++] = std::make_pair(children[i], t_entries[i]);
+            }
+        }
+    }
+    return shadeHit(object_refs, ray, hit_nearest);
+}
+
+bool QuantizedBVHAccel::occluded(const Ray& ray) const {
+    if(object_refs.empty()) {
+        return false;
+    }
+    // Any hit is enough, so visit nodes in whatever order.
+    const SlabRay slab_ray(ray);
+    std::array<Subtree, BVHBuilder::max_depth + 1> stack;
+    int stack_size = 0;
+    stack[stack_size++] = root;
+    while(stack_size > 0) {
+        const Subtree subtree = stack[--stack_size];
+        float t_entry;
+        if(!slab_ray.intersect(subtree.vmin, subtree.vmax, ray.t_max, t_entry)) {
+            continue;
+        }
+        COUNT_TRAVERSAL(nodes_visited);
+        if(subtree.count > 0) {
+            COUNT_TRAVERSAL_N(primitives_tested, subtree.count);
+            if(primitives.intersectRange(subtree.child, subtree.count, ray)) {
+                return true;
+            }
+            continue;
+        }
+        const QuantizedNode& node = nodes[subtree.child];
+        for(const int i : boost::irange(0, 2)) {
+            Subtree& child = stack[stack_size++];
+            assert(stack_size <= static_cast<int>(stack.size()));
+            dequantize(node, subtree.vmin, subtree.vmax, i,
+                child.vmin, child.vmax);
+            child.child = node.child[i];
+            child.count = node.count[i];
+        }
+    }
+    return false;
+}
+
+size_t QuantizedBVHAccel::memoryUsage() const {
+    return nodes.capacity() * sizeof(QuantizedNode) +
+        object_refs.capacity() * sizeof(object_refs[0]) +
+        primitives.memoryUsage();
+}
+
+
+GridAccel::GridAccel(float density) : density(density) {
+    assert(density > 0);
+}
+
+void GridAccel::setupCells(const AABB& bounds, int n_objects) {
+    vmin = bounds.min();
+    vmax = bounds.max();
+    const Eigen::Vector4f extent = vmax - vmin;
+    // Find the largest cubic cell size that makes enough cells.
+    // Flat axes get a single cell, so that terrain-like scenes
+    // still have density * #objects cells.
+    const double n_target = std::max<double>(1, density * n_objects);
+    auto resolutionFor = [&extent](double size) {
+        Eigen::Vector4i res;
+        for(const int axis : boost::irange(0, 4)) {
+            res(axis) = std::max(1, static_cast<int>(
+                std::min(1e6, std::round(extent(axis) / size))));
+        }
+        return res;
+    };
+    auto countOf = [](const Eigen::Vector4i& res) {
+        return static_cast<double>(res(0)) * res(1) * res(2) * res(3);
+    };
+    double size_lo = extent.maxCoeff() / n_target;
+    double size_hi = extent.maxCoeff();
+    for(const int i : boost::irange(0, 32)) {
+        const double size = std::sqrt(size_lo * size_hi);
+        if(countOf(resolutionFor(size)) >= n_target) {
+            size_lo = size;
+        } else {
+            size_hi = size;
+        }
+    }
+    resolution = (size_lo > 0) ?
+        resolutionFor(size_lo) : Eigen::Vector4i::Ones().eval();
+    for(const int axis : boost::irange(0, 4)) {
+        cell_size(axis) = (extent(axis) > 0) ?
+            extent(axis) / resolution(axis) : 1;
+    }
+}
+
+void GridAccel::cellRange(
+        const AABB& aabb, Eigen::Vector4i& lo, Eigen::Vector4i& hi) const {
+    for(const int axis : boost::irange(0, 4)) {
+        const int last = resolution(axis) - 1;
+        lo(axis) = std::min(last, std::max(0, static_cast<int>(std::floor(
+            (aabb.min()(axis) - vmin(axis)) / cell_size(axis)))));
+        hi(axis) = std::min(last, std::max(0, static_cast<int>(std::floor(
+            (aabb.max()(axis) - vmin(axis)) / cell_size(axis)))));
+    }
+}
+
+uint32_t GridAccel::cellIndex(const Eigen::Vector4i& cell) const {
+    return ((cell(0) * resolution(1) + cell(1)) * resolution(2) +
+        cell(2)) * resolution(3) + cell(3);
+}
+
+template<typename Visitor>
+void GridAccel::forEachCell(const AABB& aabb, Visitor visit) const {
+    Eigen::Vector4i lo;
+    Eigen::Vector4i hi;
+    cellRange(aabb, lo, hi);
+    Eigen::Vector4i cell;
+    for(cell(0) = lo(0); cell(0) <= hi(0); cell(0)++) {
+        for(cell(1) = lo(1); cell(1) <= hi(1); cell(1)++) {
+            for(cell(2) = lo(2); cell(2) <= hi(2); cell(2)++) {
+                for(cell(3) = lo(3); cell(3) <= hi(3); cell(3)++) {
+                    visit(cellIndex(cell));
+                }
             }
-        } else if(isect_left.first) {
-            return isect_left;
-        } else if(isect_right.first) {
-            return isect_right;
+        }
+    }
+}
+
+void GridAccel::build(const std::vector<Object>& objects) {
+    cell_begins.clear();
+    cell_refs.clear();
+    object_refs.clear();
+    primitives = PrimitiveStore();
+    if(objects.empty()) {
+        return;
+    }
+    std::vector<AABB> aabbs;
+    aabbs.reserve(objects.size());
+    for(const auto& object : objects) {
+        aabbs.push_back(object.first->bounds());
+        object_refs.push_back(object);
+    }
+    primitives = PrimitiveStore(geometriesOf(object_refs));
+    setupCells(AABB::fromAABBs(aabbs), objects.size());
+    const uint32_t n_cells = resolution.prod();
+
+    // Count references per cell, and then fill them (counting sort).
+    cell_begins.assign(n_cells + 1, 0);
+    for(const auto& aabb : aabbs) {
+        forEachCell(aabb, [this](uint32_t i) {
+            cell_begins[i + 1]++;
+        });
+    }
+    for(const uint32_t i : boost::irange(0u, n_cells)) {
+        cell_begins[i + 1] += cell_begins[i];
+    }
+    cell_refs.resize(cell_begins[n_cells]);
+    std::vector<uint32_t> cell_fills(cell_begins.begin(), cell_begins.end() - 1);
+    for(const uint32_t index : boost::irange(0u, static_cast<uint32_t>(aabbs.size()))) {
+        forEachCell(aabbs[index], [this, &cell_fills, index](uint32_t i) {
+            cell_refs[cell_fills[i]++] = index;
+        });
+    }
+    LOG(INFO) << "Grid built: #objects=" << objects.size() <<
+        " resolution=" << resolution.transpose() <<
+        " #refs=" << cell_refs.size();
+}
+
+bool GridAccel::isSuitableFor(const std::vector<Object>& objects) {
+    // Small scenes are fast enough either way.
+    if(objects.size() < 1000) {
+        return false;
+    }
+    GridAccel grid;
+    std::vector<AABB> aabbs;
+    aabbs.reserve(objects.size());
+    for(const auto& object : objects) {
+        aabbs.push_back(object.first->bounds());
+    }
+    grid.setupCells(AABB::fromAABBs(aabbs), objects.size());
+    const uint32_t n_cells = grid.resolution.prod();
+
+    // Same as build, but only count without storing references.
+    const double max_refs_per_object = 8;
+    std::vector<bool> occupied(n_cells, false);
+    double n_refs = 0;
+    for(const auto& aabb : aabbs) {
+        Eigen::Vector4i lo;
+        Eigen::Vector4i hi;
+        grid.cellRange(aabb, lo, hi);
+        n_refs += (hi - lo + Eigen::Vector4i::Ones()).cast<double>().prod();
+        if(n_refs > max_refs_per_object * objects.size()) {
+            return false;
+        }
+        grid.forEachCell(aabb, [&occupied](uint32_t i) {
+            occupied[i] = true;
+        });
+    }
+    const double occupancy =
+        std::count(occupied.begin(), occupied.end(), true) /
+        static_cast<double>(n_cells);
+    return occupancy > 0.5;
+}
+
+template<typename Visitor>
+void GridAccel::traverse(const Ray& ray, float t_max, Visitor visit) const {
+    const SlabRay slab_ray(ray);
+    float t_entry;
+    if(!slab_ray.intersect(vmin, vmax, t_max, t_entry)) {
+        return;
+    }
+    // Set up DDA from the entering point.
+    const Eigen::Vector4f pos = ray.origin + t_entry * ray.direction;
+    Eigen::Vector4i cell;
+    Eigen::Vector4i step;
+    Eigen::Vector4i cell_out;
+    // Distance to the next cell boundary, and between boundaries.
+    Eigen::Vector4f t_next;
+    Eigen::Vector4f t_delta;
+    for(const int axis : boost::irange(0, 4)) {
+        cell(axis) = std::min(resolution(axis) - 1, std::max(0,
+            static_cast<int>(std::floor(
+                (pos(axis) - vmin(axis)) / cell_size(axis)))));
+        const float dir = ray.direction(axis);
+        if(dir > 0) {
+            step(axis) = 1;
+            cell_out(axis) = resolution(axis);
+            t_next(axis) = (vmin(axis) + (cell(axis) + 1) * cell_size(axis) -
+                ray.origin(axis)) / dir;
+            t_delta(axis) = cell_size(axis) / dir;
+        } else if(dir < 0) {
+            step(axis) = -1;
+            cell_out(axis) = -1;
+            t_next(axis) = (vmin(axis) + cell(axis) * cell_size(axis) -
+                ray.origin(axis)) / dir;
+            t_delta(axis) = -cell_size(axis) / dir;
         } else {
-            return std::make_pair(nullptr, MicroGeometry());
+            step(axis) = 0;
+            cell_out(axis) = -1;
+            t_next(axis) = std::numeric_limits<float>::infinity();
+            t_delta(axis) = 0;
+        }
+    }
+    while(true) {
+        int axis;
+        const float t_exit = t_next.minCoeff(&axis);
+        if(!visit(cellIndex(cell), t_exit) || t_exit > t_max) {
+            return;
+        }
+        cell(axis) += step(axis);
+        if(cell(axis) == cell_out(axis)) {
+            return;
+        }
+        t_next(axis) += t_delta(axis);
+    }
+}
+
+std::pair<std::unique_ptr<BSDF>, MicroGeometry>
+        GridAccel::intersect(const Ray& ray) const {
+    RayHit hit_nearest;
+    float& t_nearest = hit_nearest.t;
+    t_nearest = ray.t_max;
+    if(object_refs.empty()) {
+        return shadeHit(object_refs, ray, hit_nearest);
+    }
+    Ray query(ray);
+    traverse(ray, t_nearest, [&](uint32_t cell, float t_exit) {
+        COUNT_TRAVERSAL(nodes_visited);
+        for(const uint32_t i : boost::irange(
+                cell_begins[cell], cell_begins[cell + 1])) {
+            const uint32_t index = cell_refs[i];
+            COUNT_TRAVERSAL(primitives_tested);
+            const auto hit = primitives.intersectHit(index, query);
+            if(hit && hit->t < t_nearest) {
+                hit_nearest = *hit;
+                hit_nearest.index = index;
+                query.t_max = hit->t;
+            }
         }
+        // Hits in later cells are always farther than this cell.
+        // Objects spanning multiple cells can be hit beyond this cell,
+        // so they can't be accepted yet.
+        return t_nearest > t_exit;
+    });
+    return shadeHit(object_refs, ray, hit_nearest);
+}
+
+bool GridAccel::occluded(const Ray& ray) const {
+    if(object_refs.empty()) {
+        return false;
     }
+    bool found = false;
+    traverse(ray, ray.t_max, [&](uint32_t cell, float t_exit) {
+        COUNT_TRAVERSAL(nodes_visited);
+        for(const uint32_t i : boost::irange(
+                cell_begins[cell], cell_begins[cell + 1])) {
+            COUNT_TRAVERSAL(primitives_tested);
+            const auto hit =
+                primitives.intersectHit(cell_refs[i], ray);
+            if(hit) {
+                found = true;
+                return false;
+            }
+        }
+        return true;
+    });
+    return found;
 }
 
-BVHAccel::BVHNode::BVHNode() :
-    aabb(Eigen::Vector4f::Zero(), Eigen::Vector4f::Zero()) {
+size_t GridAccel::memoryUsage() const {
+    return (cell_begins.capacity() + cell_refs.capacity()) * sizeof(uint32_t) +
+        object_refs.capacity() * sizeof(object_refs[0]) +
+        primitives.memoryUsage();
 }
 
 }  // namespace
@@ -1,19 +1,42 @@
 #pragma once
 
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <boost/optional.hpp>
 #include <Eigen/Dense>
 #include <glog/logging.h>
 
+#include <accel_cache.h>
+#include <bvh_builder.h>
 #include <geometry.h>
+#include <mapped_file.h>
+#include <primitive_store.h>
+#include <slab_ray.h>
 #include <space.h>
 #include <object.h>
 
 namespace pentatope {
 
+// Work done by traversals in the calling thread, for benchmarking.
+// Only counted when accel.cpp is compiled with PENTATOPE_TRAVERSAL_STATS,
+// since counting slows down traversal.
+struct TraversalStats {
+    TraversalStats();
+
+    // Nodes (leaves and grid cells included) whose children or objects
+    // were examined, counted once per entry into the node.
+    uint64_t nodes_visited;
+    // Objects tested for intersection.
+    uint64_t primitives_tested;
+};
+
+TraversalStats& traversalStats();
+
+
 class Accel {
 public:
     virtual ~Accel() {}
@@ -23,6 +46,16 @@ public:
     virtual void build(const std::vector<Object>& objects) = 0;
     virtual std::pair<std::unique_ptr<BSDF>, MicroGeometry>
         intersect(const Ray& ray) const = 0;
+    // Same as intersect for each ray, but may be faster when
+    // rays are coherent (e.g. primary rays sharing origin).
+    virtual std::vector<std::pair<std::unique_ptr<BSDF>, MicroGeometry>>
+        intersectPacket(const std::vector<Ray>& rays) const;
+    // Returns true if the ray hits anything in (ray.t_min, ray.t_max).
+    // Much cheaper than intersect, because it stops at the first
+    // hit found, and doesn't calculate normal nor BSDF.
+    virtual bool occluded(const Ray& ray) const = 0;
+    // Bytes used by the built structure, excluding objects.
+    virtual size_t memoryUsage() const = 0;
 };
 
 
@@ -33,8 +66,12 @@ public:
     void build(const std::vector<Object>& objects) override;
     std::pair<std::unique_ptr<BSDF>, MicroGeometry>
         intersect(const Ray& ray) const override;
+    bool occluded(const Ray& ray) const override;
+    size_t memoryUsage() const override;
 private:
     std::vector<std::reference_wrapper<const Object>> object_refs;
+    // Geometries of object_refs, in the same order.
+    PrimitiveStore primitives;
 };
 
 
@@ -43,35 +80,258 @@ private:
 // See http://www.win.tue.nl/~hermanh/stack/bvh.pdf
 class BVHAccel : public Accel {
 public:
+    // n_threads is used only during build.
+    BVHAccel(
+        BVHBuilder::Method method = BVHBuilder::Method::SAH,
+        int n_threads = 1);
+
+    void build(const std::vector<Object>& objects) override;
+    std::pair<std::unique_ptr<BSDF>, MicroGeometry>
+            intersect(const Ray& ray) const override;
+    // Rays traverse the tree together. When they share origin,
+    // subtrees are culled by the frustum of the packet. Subtrees entered
+    // by fewer than half of the rays are traversed by each ray alone.
+    std::vector<std::pair<std::unique_ptr<BSDF>, MicroGeometry>>
+            intersectPacket(const std::vector<Ray>& rays) const override;
+    bool occluded(const Ray& ray) const override;
+    size_t memoryUsage() const override;
+
+    // Expected cost of tracing a ray, as estimated by SAH.
+    // Useful for comparing quality of trees. Returns 0 when empty.
+    float sahCost() const;
+
+    // Append the built tree to cache, so that it can be loaded later
+    // instead of building. The section only contains indices into
+    // objects, so it's valid for any process that has the same objects.
+    void save(AccelCache& cache) const;
+
+    // Use the tree in the next section of cache for objects, instead of
+    // building. Nodes are used directly from the memory-mapped file.
+    // Returns false (leaving this empty) when there's no section or
+    // it's incompatible with objects; call build in that case.
+    bool load(AccelCache& cache, const std::vector<Object>& objects);
+private:
+    // A node of the flattened tree. The first child of a branch
+    // immediately follows the branch itself.
+    struct LinearNode {
+        Eigen::Vector4f vmin;
+        Eigen::Vector4f vmax;
+
+        // branch: index of the second child in nodes.
+        // leaf: index of the first object in object_refs.
+        uint32_t offset;
+        // Number of objects in a leaf. 0 for a branch.
+        uint32_t count;
+    };
+
+    // Layout of a saved tree is
+    // [CacheHeader][LinearNode * n_nodes][uint32_t object index * n_objects]
+    // Nodes start at a 16-byte aligned offset, as required by Eigen.
+    struct CacheHeader {
+        uint32_t node_size;
+        uint32_t n_nodes;
+        uint32_t n_objects;
+        float sah_cost;
+    };
+
+    // Append node and its descendants to nodes in depth-first order,
+    // and return index of node.
+    uint32_t flatten(const BVHBuildNode& node);
+
+    // Find hits of a ray that enters the subtree at root, updating hit
+    // and query.t_max when nearer ones are found.
+    void intersectSubtree(
+        uint32_t root, const SlabRay& slab_ray,
+        Ray& query, RayHit& hit) const;
+
+    const BVHBuilder::Method method;
+    const int n_threads;
+    float sah_cost;
+
+    // Nodes used by traversal. Points to either nodes (after build) or
+    // inside mapping (after load).
+    const LinearNode* node_array;
+    uint32_t n_nodes;
+    std::vector<LinearNode> nodes;
+    std::shared_ptr<const MappedFile> mapping;
+    // object_refs[i] is objects[object_indices[i]].
+    std::vector<uint32_t> object_indices;
+    // borrowed. Sorted so that each leaf refers to a contiguous range.
+    std::vector<std::reference_wrapper<const Object>> object_refs;
+    // Geometries of object_refs, in the same order. Simple shapes are
+    // copied, so a leaf reads contiguous memory and nearby leaves are
+    // nearby in memory (Morton order for (H)LBVH). objects themselves
+    // stay in the original order.
+    PrimitiveStore primitives;
+};
+
+// BVH with 4 children per node. A node stores bounds of all
+// children in SoA layout, so that one SSE slab test covers all of them.
+// The tree is made by collapsing a binary BVH.
+// See http://www.sci.utah.edu/~wald/Publications/2008/WideBVH/widebvh.pdf
+class WideBVHAccel : public Accel {
+public:
+    WideBVHAccel(
+        BVHBuilder::Method method = BVHBuilder::Method::SAH,
+        int n_threads = 1);
+
+    void build(const std::vector<Object>& objects) override;
+    std::pair<std::unique_ptr<BSDF>, MicroGeometry>
+            intersect(const Ray& ray) const override;
+    bool occluded(const Ray& ray) const override;
+    size_t memoryUsage() const override;
+private:
+    static const int width = 4;
+
+    struct WideNode {
+        // Bounds of children. [axis][child]
+        alignas(16) float vmin[4][width];
+        alignas(16) float vmax[4][width];
+
+        // Children are packed in [0, n_children).
+        // count[i] == 0: child[i] is index of a WideNode.
+        // count[i] > 0: child i is a leaf, containing
+        // object_refs[child[i], child[i] + count[i]).
+        uint32_t child[width];
+        uint32_t count[width];
+        uint32_t n_children;
+    };
+
+    // Append a WideNode that covers children of node (or node itself when
+    // it's a leaf) and its descendants, and return index of it.
+    uint32_t collapse(const BVHBuildNode& node);
+
+    const BVHBuilder::Method method;
+    const int n_threads;
+
+    std::vector<WideNode> nodes;
+    // borrowed. Sorted so that each leaf refers to a contiguous range.
+    std::vector<std::reference_wrapper<const Object>> object_refs;
+    // Geometries of object_refs, in the same order.
+    PrimitiveStore primitives;
+};
+
+// Binary BVH with compressed nodes, for scenes too large to keep
+// BVHAccel nodes in cache. Each node stores bounds of its children
+// as 8 bit offsets relative to its own (decoded) bounds, and leaves
+// are referred by their parents instead of having their own nodes.
+// This cuts node memory to less than 1/3 of BVHAccel.
+// Quantization always rounds outwards, so no hit is missed.
+// See Mahovsky, "Ray Tracing with Reduced-Precision Bounding Volume
+// Hierarchies" (2005).
+class QuantizedBVHAccel : public Accel {
+public:
+    QuantizedBVHAccel(
+        BVHBuilder::Method method = BVHBuilder::Method::SAH,
+        int n_threads = 1);
+
     void build(const std::vector<Object>& objects) override;
     std::pair<std::unique_ptr<BSDF>, MicroGeometry>
             intersect(const Ray& ray) const override;
+    bool occluded(const Ray& ray) const override;
+    size_t memoryUsage() const override;
 private:
-    class BVHNode {
-    public:
-        // Create an invalid node.
-        BVHNode();
+    static const int n_levels = 255;
 
-        AABB aabb;
+    struct QuantizedNode {
+        // Bounds of children. [child][axis]
+        uint8_t qmin[2][4];
+        uint8_t qmax[2][4];
 
-        // Only populated when this node is a branch.
-        std::unique_ptr<BVHNode> left;
-        std::unique_ptr<BVHNode> right;
+        // count[i] == 0: child[i] is index of a QuantizedNode.
+        // count[i] > 0: child i is a leaf, containing
+        // object_refs[child[i], child[i] + count[i]).
+        uint32_t child[2];
+        uint8_t count[2];
+    };
 
-        // borrowed
-        // empty -> this node is a branch (left && right)
-        // non-empty -> this node is a leaf
-        std::vector<std::reference_wrapper<const Object>> objects;
+    // Reference to a subtree with its decoded bounds.
+    // Same as QuantizedNode, count > 0 means a leaf.
+    struct Subtree {
+        Eigen::Vector4f vmin;
+        Eigen::Vector4f vmax;
+        uint32_t child;
+        uint32_t count;
     };
 
-    std::unique_ptr<BVHNode> buildTree(
-        const std::vector<
-            std::reference_wrapper<const Object>>& objects) const;
+    // Decode bounds of children of node, whose bounds are [vmin, vmax].
+    // Quantization uses exactly this, so that decoding is always
+    // conservative.
+    static void dequantize(
+        const QuantizedNode& node,
+        const Eigen::Vector4f& vmin, const Eigen::Vector4f& vmax,
+        int i, Eigen::Vector4f& child_vmin, Eigen::Vector4f& child_vmax);
+
+    // Append a QuantizedNode for branch node (whose bounds are decoded as
+    // [vmin, vmax]) and its descendants, and return index of it.
+    uint32_t quantize(
+        const BVHBuildNode& node,
+        const Eigen::Vector4f& vmin, const Eigen::Vector4f& vmax);
+
+    const BVHBuilder::Method method;
+    const int n_threads;
 
+    // Only valid when object_refs is not empty.
+    Subtree root;
+    std::vector<QuantizedNode> nodes;
+    // borrowed. Sorted so that each leaf refers to a contiguous range.
+    std::vector<std::reference_wrapper<const Object>> object_refs;
+    // Geometries of object_refs, in the same order.
+    PrimitiveStore primitives;
+};
+
+// Uniform 4-d grid traversed by 3-D DDA extended to 4-d.
+// Builds in linear time, and traverses fast when objects are small and
+// spread evenly (e.g. terrain), but degrades badly when they're not.
+// Objects are referred by every cell they overlap.
+// See http://www.cse.yorku.ca/~amana/research/grid.pdf
+class GridAccel : public Accel {
+public:
+    // Roughly density * #objects cells are used.
+    GridAccel(float density = 2);
+
+    void build(const std::vector<Object>& objects) override;
     std::pair<std::unique_ptr<BSDF>, MicroGeometry>
-        intersectTree(const BVHNode& node, const Ray& ray) const;
+            intersect(const Ray& ray) const override;
+    bool occluded(const Ray& ray) const override;
+    size_t memoryUsage() const override;
 
-    std::unique_ptr<BVHNode> root;
+    // Returns true when a grid is likely faster than BVH for objects,
+    // i.e. most cells are occupied and objects overlap few cells.
+    static bool isSuitableFor(const std::vector<Object>& objects);
+private:
+    // Calculate resolution and cell size for bounds.
+    void setupCells(const AABB& bounds, int n_objects);
+
+    // Range of cells (inclusive) overlapping aabb.
+    void cellRange(
+        const AABB& aabb, Eigen::Vector4i& lo, Eigen::Vector4i& hi) const;
+    uint32_t cellIndex(const Eigen::Vector4i& cell) const;
+
+    // Call visit(cell index) for all cells overlapping aabb.
+    template<typename Visitor>
+    void forEachCell(const AABB& aabb, Visitor visit) const;
+
+    // Call visit(cell index, distance where the ray exits the cell)
+    // for cells that the ray passes within [ray.t_min, t_max], in order,
+    // until visit returns false.
+    template<typename Visitor>
+    void traverse(const Ray& ray, float t_max, Visitor visit) const;
+
+    const float density;
+
+    Eigen::Vector4f vmin;
+    Eigen::Vector4f vmax;
+    Eigen::Vector4f cell_size;
+    Eigen::Vector4i resolution;
+    // Objects in i-th cell are
+    // object_refs[cell_refs[cell_begins[i]...cell_begins[i + 1]]].
+    std::vector<uint32_t> cell_begins;
+    std::vector<uint32_t> cell_refs;
+    // borrowed.
+    std::vector<std::reference_wrapper<const Object>> object_refs;
+    // Geometries of object_refs, in the same order.
+    PrimitiveStore primitives;
 };
 
 }  // namespace
@@ -0,0 +1,396 @@
+// Benchmark of accelerators on generated scenes of several kinds and scales.
+// Prints one JSON object per (scene, #objects, accelerator) to stdout,
+// so that results can be collected by scripts.
+//
+// Traversal work (nodes & primitives per ray) is only counted
+// when built with PENTATOPE_TRAVERSAL_STATS (as SConscript does),
+// and Mrays/s includes the small overhead of counting.
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+#include <boost/range/irange.hpp>
+#include <Eigen/Dense>
+#include <glog/logging.h>
+
+#include <accel.h>
+#include <geometry.h>
+#include <material.h>
+#include <object.h>
+#include <space.h>
+
+using namespace pentatope;
+
+namespace {
+
+// All objects share a material, since it doesn't affect traversal.
+Object createObject(std::unique_ptr<Geometry> geometry) {
+    static const std::shared_ptr<Material> material =
+        std::make_shared<UniformLambertMaterial>(fromRgb(1, 1, 1));
+    return Object(std::move(geometry), material);
+}
+
+// Rotation by angle in the plane spanned by axes a0 and a1.
+Eigen::Matrix4f planeRotation(int a0, int a1, float angle) {
+    Eigen::Matrix4f rot = Eigen::Matrix4f::Identity();
+    rot(a0, a0) = std::cos(angle);
+    rot(a0, a1) = -std::sin(angle);
+    rot(a1, a0) = std::sin(angle);
+    rot(a1, a1) = std::cos(angle);
+    return rot;
+}
+
+// Tetrahedra of a bumpy height field on the x-y-z grid, like the land of
+// example/scene_nature.py but as separate objects.
+std::vector<Object> generateLandscape(std::mt19937& rg, int n_target) {
+    const int n = std::max(2, static_cast<int>(std::cbrt(n_target / 6.0)) + 1);
+    const float spacing = 200.0f / (n - 1);
+    std::uniform_real_distribution<float> height(-5, 5);
+    std::vector<Eigen::Vector4f> vertices;
+    for(const int ix : boost::irange(0, n)) {
+        for(const int iy : boost::irange(0, n)) {
+            for(const int iz : boost::irange(0, n)) {
+                vertices.emplace_back(
+                    ix * spacing - 100, iy * spacing - 100,
+                    iz * spacing - 100, height(rg));
+            }
+        }
+    }
+    auto at = [&vertices, n](int ix, int iy, int iz) {
+        return vertices[(ix * n + iy) * n + iz];
+    };
+    // Split each cube into 6 tetrahedra along the diagonal.
+    std::vector<Object> objects;
+    for(const int ix : boost::irange(0, n - 1)) {
+        for(const int iy : boost::irange(0, n - 1)) {
+            for(const int iz : boost::irange(0, n - 1)) {
+                const std::array<Eigen::Vector4f, 6> path = {
+                    at(ix + 1, iy, iz), at(ix + 1, iy + 1, iz),
+                    at(ix, iy + 1, iz), at(ix, iy + 1, iz + 1),
+                    at(ix, iy, iz + 1), at(ix + 1, iy, iz + 1)};
+                for(const int i : boost::irange(0, 6)) {
+                    objects.push_back(createObject(
+                        std::make_unique<Tetrahedron>(
+                            std::array<Eigen::Vector4f, 4>({
+                                at(ix, iy, iz), path[i], path[(i + 1) % 6],
+                                at(ix + 1, iy + 1, iz + 1)}))));
+                }
+            }
+        }
+    }
+    return objects;
+}
+
+// Rooms like the cornell tesseract, arranged on the x-y-z grid.
+// Each room has 8 walls and 4 rotated boxes inside.
+std::vector<Object> generateRooms(std::mt19937& rg, int n_target) {
+    const int n = std::max(1, static_cast<int>(std::cbrt(n_target / 12.0)));
+    const float room_size = 200.0f / n;
+    const float wall_thickness = room_size * 0.01f;
+    std::uniform_real_distribution<float> unit(0, 1);
+    std::vector<Object> objects;
+    for(const int ix : boost::irange(0, n)) {
+        for(const int iy : boost::irange(0, n)) {
+            for(const int iz : boost::irange(0, n)) {
+                const Eigen::Vector4f center(
+                    (ix + 0.5f) * room_size - 100,
+                    (iy + 0.5f) * room_size - 100,
+                    (iz + 0.5f) * room_size - 100,
+                    room_size / 2);
+                for(const int axis : boost::irange(0, 4)) {
+                    for(const float side : {-0.5f, 0.5f}) {
+                        Eigen::Vector4f size =
+                            Eigen::Vector4f::Constant(room_size);
+                        size(axis) = wall_thickness;
+                        Eigen::Vector4f wall_center = center;
+                        wall_center(axis) += side * room_size;
+                        objects.push_back(createObject(
+                            std::make_unique<OBB>(
+                                Pose(Eigen::Matrix4f::Identity(), wall_center),
+                                size)));
+                    }
+                }
+                for(const int i : boost::irange(0, 4)) {
+                    const Eigen::Vector4f offset =
+                        Eigen::Vector4f(
+                            unit(rg), unit(rg), unit(rg), unit(rg)) -
+                        Eigen::Vector4f::Constant(0.5);
+                    const Eigen::Matrix4f rot =
+                        planeRotation(0, 1, unit(rg) * pi) *
+                        planeRotation(2, 3, unit(rg) * pi);
+                    objects.push_back(createObject(
+                        std::make_unique<OBB>(
+                            Pose(rot, center + offset * room_size * 0.5f),
+                            Eigen::Vector4f::Constant(room_size * 0.2f))));
+                }
+            }
+        }
+    }
+    return objects;
+}
+
+// Spheres scattered uniformly, whose sizes vary by 10x.
+std::vector<Object> generateSphereCloud(std::mt19937& rg, int n_target) {
+    // Keep the fraction of occupied space roughly independent of scale.
+    const float radius_max = 200.0f / std::pow(n_target, 0.25f) * 0.5f;
+    std::uniform_real_distribution<float> coord(-100, 100);
+    std::uniform_real_distribution<float> radius(
+        radius_max * 0.1f, radius_max);
+    std::vector<Object> objects;
+    for(const int i : boost::irange(0, n_target)) {
+        objects.push_back(createObject(
+            std::make_unique<Sphere>(
+                Eigen::Vector4f(coord(rg), coord(rg), coord(rg), coord(rg)),
+                radius(rg))));
+    }
+    return objects;
+}
+
+// Uniformly random point in [-100, 100]^4, which covers all scenes.
+Eigen::Vector4f randomPoint(std::mt19937& rg) {
+    std::uniform_real_distribution<float> coord(-100, 100);
+    return Eigen::Vector4f(coord(rg), coord(rg), coord(rg), coord(rg));
+}
+
+// Rays between random points. Occlusion queries are limited to the
+// other end, like shadow rays.
+std::vector<std::pair<Ray, float>> generateRays(std::mt19937& rg, int n) {
+    std::vector<std::pair<Ray, float>> rays;
+    while(static_cast<int>(rays.size()) < n) {
+        const Eigen::Vector4f from = randomPoint(rg);
+        const Eigen::Vector4f delta = randomPoint(rg) - from;
+        const float dist = delta.norm();
+        if(dist > 0) {
+            rays.emplace_back(Ray(from, delta / dist), dist);
+        }
+    }
+    return rays;
+}
+
+// Packets of 8x8 rays sharing origin, about 0.02 rad apart, like
+// primary rays of a block of pixels (see Camera2::renderTile).
+std::vector<std::vector<Ray>> generatePackets(std::mt19937& rg, int n) {
+    const int packet_size = 8;
+    std::vector<std::vector<Ray>> packets;
+    for(int n_rays = 0; n_rays < n; n_rays += packet_size * packet_size) {
+        const Eigen::Vector4f origin = randomPoint(rg);
+        // Orthonormal (center, u, v) by Gram-Schmidt.
+        Eigen::Vector4f center = randomPoint(rg) - origin;
+        Eigen::Vector4f u = randomPoint(rg);
+        Eigen::Vector4f v = randomPoint(rg);
+        center.normalize();
+        u = (u - u.dot(center) * center).normalized();
+        v = (v - v.dot(center) * center - v.dot(u) * u).normalized();
+        std::vector<Ray> packet;
+        for(const int iy : boost::irange(0, packet_size)) {
+            for(const int ix : boost::irange(0, packet_size)) {
+                const Eigen::Vector4f dir = center +
+                    (ix - 3.5f) * 0.02f * u + (iy - 3.5f) * 0.02f * v;
+                packet.emplace_back(origin, dir.normalized());
+            }
+        }
+        packets.push_back(packet);
+    }
+    return packets;
+}
+
+double secondsSince(const std::chrono::steady_clock::time_point& t0) {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - t0).count();
+}
+
+struct SceneKind {
+    std::string name;
+    std::function<std::vector<Object>(std::mt19937&, int)> generate;
+};
+
+struct AccelKind {
+    std::string name;
+    std::function<std::unique_ptr<Accel>()> create;
+    // Skip scenes with more objects than this.
+    int max_objects;
+};
+
+void runBenchmark(
+        const std::string& scene_name, const std::vector<Object>& objects,
+        const AccelKind& accel_kind,
+        const std::vector<std::pair<Ray, float>>& rays,
+        const std::vector<std::vector<Ray>>& packets) {
+    const auto accel = accel_kind.create();
+    const auto t_build = std::chrono::steady_clock::now();
+    accel->build(objects);
+    const double build_sec = secondsSince(t_build);
+
+    TraversalStats& stats = traversalStats();
+    stats = TraversalStats();
+    int n_hits = 0;
+    const auto t_closest = std::chrono::steady_clock::now();
+    for(const auto& ray : rays) {
+        if(accel->intersect(ray.first).first) {
+            n_hits++;
+        }
+    }
+    const double closest_sec = secondsSince(t_closest);
+    const TraversalStats closest_stats = stats;
+
+    stats = TraversalStats();
+    int n_occluded = 0;
+    const auto t_occluded = std::chrono::steady_clock::now();
+    for(const auto& ray : rays) {
+        const Ray shadow_ray(
+            ray.first.origin, ray.first.direction, 0, ray.second);
+        if(accel->occluded(shadow_ray)) {
+            n_occluded++;
+        }
+    }
+    const double occluded_sec = secondsSince(t_occluded);
+    const TraversalStats occluded_stats = stats;
+
+    // Same coherent rays, one by one and as packets.
+    int n_packet_rays = 0;
+    int n_scalar_hits = 0;
+    const auto t_scalar = std::chrono::steady_clock::now();
+    for(const auto& packet : packets) {
+        for(const auto& ray : packet) {
+            if(accel->intersect(ray).first) {
+                n_scalar_hits++;
+            }
+            n_packet_rays++;
+        }
+    }
+    const double scalar_sec = secondsSince(t_scalar);
+    int n_packet_hits = 0;
+    const auto t_packet = std::chrono::steady_clock::now();
+    for(const auto& packet : packets) {
+        for(const auto& isect : accel->intersectPacket(packet)) {
+            if(isect.first) {
+                n_packet_hits++;
+            }
+        }
+    }
+    const double packet_sec = secondsSince(t_packet);
+    CHECK_EQ(n_scalar_hits, n_packet_hits);
+
+    const double n_rays = rays.size();
+    std::ostringstream json;
+    json << "{\"scene\": \"" << scene_name << "\"" <<
+        ", \"n_objects\": " << objects.size() <<
+        ", \"accel\": \"" << accel_kind.name << "\"" <<
+        ", \"build_sec\": " << build_sec <<
+        ", \"memory_bytes\": " << accel->memoryUsage() <<
+        ", \"n_rays\": " << rays.size() <<
+        ", \"hit_ratio\": " << n_hits / n_rays <<
+        ", \"occluded_ratio\": " << n_occluded / n_rays <<
+        ", \"closest_nodes_per_ray\": " <<
+            closest_stats.nodes_visited / n_rays <<
+        ", \"closest_primitives_per_ray\": " <<
+            closest_stats.primitives_tested / n_rays <<
+        ", \"closest_mrays_per_sec\": " << n_rays / closest_sec * 1e-6 <<
+        ", \"occluded_nodes_per_ray\": " <<
+            occluded_stats.nodes_visited / n_rays <<
+        ", \"occluded_primitives_per_ray\": " <<
+            occluded_stats.primitives_tested / n_rays <<
+        ", \"occluded_mrays_per_sec\": " << n_rays / occluded_sec * 1e-6 <<
+        ", \"coherent_scalar_mrays_per_sec\": " <<
+            n_packet_rays / scalar_sec * 1e-6 <<
+        ", \"coherent_packet_mrays_per_sec\": " <<
+            n_packet_rays / packet_sec * 1e-6 <<
+        "}";
+    std::cout << json.str() << std::endl;
+}
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+    using boost::program_options::notify;
+    using boost::program_options::options_description;
+    using boost::program_options::parse_command_line;
+    using boost::program_options::store;
+    using boost::program_options::value;
+    using boost::program_options::variables_map;
+
+    google::InitGoogleLogging(argv[0]);
+
+    options_description desc("Benchmark accelerators on generated scenes");
+    desc.add_options()
+        ("help", "show this message")
+        ("scales", value<std::vector<int>>()->multitoken(), "Numbers of objects to generate (default: 1000 10000 100000).")
+        ("rays", value<int>()->default_value(100000), "Number of rays per query type.")
+        ("threads", value<int>()->default_value(1), "Number of threads for parallel builds.");
+    variables_map vars;
+    store(parse_command_line(argc, argv, desc), vars);
+    notify(vars);
+    if(vars.count("help") > 0) {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+    const std::vector<int> scales = (vars.count("scales") > 0) ?
+        vars["scales"].as<std::vector<int>>() :
+        std::vector<int>({1000, 10000, 100000});
+    const int n_rays = vars["rays"].as<int>();
+    const int n_threads = vars["threads"].as<int>();
+    CHECK_GT(n_rays, 0);
+    CHECK_GT(n_threads, 0);
+
+    const std::vector<SceneKind> scene_kinds = {
+        {"landscape", generateLandscape},
+        {"rooms", generateRooms},
+        {"sphere_cloud", generateSphereCloud}};
+    const std::vector<AccelKind> accel_kinds = {
+        {"brute_force",
+            [] { return std::make_unique<BruteForceAccel>(); }, 1000},
+        {"bvh_midpoint",
+            [] { return std::make_unique<BVHAccel>(
+                BVHBuilder::Method::MIDPOINT); },
+            std::numeric_limits<int>::max()},
+        {"bvh_sah",
+            [] { return std::make_unique<BVHAccel>(
+                BVHBuilder::Method::SAH); },
+            std::numeric_limits<int>::max()},
+        {"bvh_hlbvh",
+            [n_threads] { return std::make_unique<BVHAccel>(
+                BVHBuilder::Method::HLBVH, n_threads); },
+            std::numeric_limits<int>::max()},
+        {"wide_bvh_sah",
+            [] { return std::make_unique<WideBVHAccel>(
+                BVHBuilder::Method::SAH); },
+            std::numeric_limits<int>::max()},
+        {"quantized_bvh_sah",
+            [] { return std::make_unique<QuantizedBVHAccel>(
+                BVHBuilder::Method::SAH); },
+            std::numeric_limits<int>::max()},
+        {"grid",
+            [] { return std::make_unique<GridAccel>(); },
+            std::numeric_limits<int>::max()}};
+
+    for(const auto& scene_kind : scene_kinds) {
+        for(const int scale : scales) {
+            // Same scene and rays for all accelerators.
+            std::mt19937 rg(scale);
+            const auto objects = scene_kind.generate(rg, scale);
+            const auto rays = generateRays(rg, n_rays);
+            const auto packets = generatePackets(rg, n_rays);
+            LOG(INFO) << scene_kind.name << ": grid is " <<
+                (GridAccel::isSuitableFor(objects) ? "" : "not ") <<
+                "suitable";
+            for(const auto& accel_kind : accel_kinds) {
+                if(static_cast<int>(objects.size()) > accel_kind.max_objects) {
+                    continue;
+                }
+                runBenchmark(
+                    scene_kind.name, objects, accel_kind, rays, packets);
+            }
+        }
+    }
+    return 0;
+}
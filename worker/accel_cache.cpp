@@ -0,0 +1,136 @@
+#include "accel_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+#include <glog/logging.h>
+#include <unistd.h>
+
+namespace pentatope {
+
+namespace {
+
+const char magic[8] = {'P', '4', 'A', 'C', 'C', 'E', 'L', '\0'};
+
+// Round size up to a multiple of 16 bytes.
+size_t aligned(size_t size) {
+    return (size + 15) / 16 * 16;
+}
+
+}  // namespace
+
+const uint32_t AccelCache::version;
+
+AccelCache::AccelCache(const std::string& path) : path(path), n_read(0) {
+    static_assert(sizeof(FileHeader) % 16 == 0 &&
+        sizeof(SectionHeader) % 16 == 0,
+        "content after headers must be aligned");
+    std::shared_ptr<const MappedFile> file;
+    try {
+        file = std::make_shared<MappedFile>(path);
+    } catch(const std::runtime_error& e) {
+        return;
+    }
+    FileHeader header;
+    if(file->size() < sizeof(header)) {
+        LOG(WARNING) << "Ignoring incompatible accel cache " << path;
+        return;
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+    if(std::memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+            header.version != version) {
+        LOG(WARNING) << "Ignoring incompatible accel cache " << path;
+        return;
+    }
+    std::vector<Section> sections;
+    size_t offset = sizeof(header);
+    for(const uint32_t i : boost::irange(0u, header.n_sections)) {
+        SectionHeader section_header;
+        if(file->size() - offset < sizeof(section_header)) {
+            LOG(WARNING) << "Ignoring corrupted accel cache " << path;
+            return;
+        }
+        std::memcpy(&section_header, file->data() + offset,
+            sizeof(section_header));
+        offset += sizeof(section_header);
+        if(file->size() - offset < section_header.size) {
+            LOG(WARNING) << "Ignoring corrupted accel cache " << path;
+            return;
+        }
+        sections.push_back({file->data() + offset, section_header.size});
+        offset += std::min(
+            aligned(section_header.size), file->size() - offset);
+    }
+    mapping = std::move(file);
+    mapped_sections = std::move(sections);
+}
+
+boost::optional<AccelCache::Section> AccelCache::nextSection() {
+    if(n_read >= static_cast<int>(mapped_sections.size())) {
+        return boost::none;
+    }
+    return mapped_sections[n_read++];
+}
+
+std::shared_ptr<const MappedFile> AccelCache::getMapping() const {
+    return mapping;
+}
+
+void AccelCache::addSection(std::string content) {
+    added_sections.push_back(std::move(content));
+}
+
+void AccelCache::save() const {
+    if(mapping) {
+        if(!added_sections.empty() ||
+                n_read != static_cast<int>(mapped_sections.size())) {
+            LOG(WARNING) << "Removing stale accel cache " << path;
+            std::remove(path.c_str());
+        }
+        return;
+    }
+    FileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.n_sections = added_sections.size();
+
+    const boost::filesystem::path parent =
+        boost::filesystem::path(path).parent_path();
+    if(!parent.empty()) {
+        boost::filesystem::create_directories(parent);
+    }
+    // Write to a temporary file and rename it, so that other processes
+    // never see a partially written file.
+    const std::string path_temp =
+        path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(path_temp, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for(const auto& content : added_sections) {
+            SectionHeader section_header;
+            std::memset(&section_header, 0, sizeof(section_header));
+            section_header.size = content.size();
+            file.write(reinterpret_cast<const char*>(&section_header),
+                sizeof(section_header));
+            file.write(content.data(), content.size());
+            const std::string padding(
+                aligned(content.size()) - content.size(), '\0');
+            file.write(padding.data(), padding.size());
+        }
+        if(!file) {
+            std::remove(path_temp.c_str());
+            throw std::runtime_error("Failed to write " + path_temp);
+        }
+    }
+    if(std::rename(path_temp.c_str(), path.c_str()) != 0) {
+        std::remove(path_temp.c_str());
+        throw std::runtime_error("Failed to rename to " + path);
+    }
+}
+
+}  // namespace
@@ -0,0 +1,115 @@
+// A file caching acceleration structures of a scene across processes.
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/optional.hpp>
+#include <boost/range/irange.hpp>
+
+#include <bvh_builder.h>
+#include <mapped_file.h>
+
+namespace pentatope {
+
+// Sections of binary data, one per acceleration structure of a scene
+// (BVHs of TetraMeshes in the order they're loaded, and then BVHAccel),
+// so that a restarted worker maps them instead of building.
+// Sections only contain indices (no pointers), so they're valid for any
+// process that loads the same scene; path must be unique to the content
+// of the scene.
+//
+// Layout is [FileHeader]([SectionHeader][content])*. Each content starts
+// at a 16-byte aligned offset, so Eigen types in it can be used in place.
+class AccelCache {
+public:
+    struct Section {
+        const char* data;
+        size_t size;
+    };
+
+    // Map path when it's a valid cache file, so that structures use its
+    // sections instead of building. Otherwise the cache starts empty.
+    AccelCache(const std::string& path);
+
+    // Next section of the mapped file, in the order they were added.
+    // boost::none when there's no more (or nothing was mapped).
+    boost::optional<Section> nextSection();
+
+    // The file that sections point into. Holding it keeps them valid.
+    std::shared_ptr<const MappedFile> getMapping() const;
+
+    // Append content of a structure that was built, because nextSection
+    // gave none or an invalid section.
+    void addSection(std::string content);
+
+    // Write added sections to path, unless all structures came from the
+    // mapped file. When only some of them did, path is stale (e.g.
+    // corrupted), and is removed so that the next load rebuilds it.
+    // Creates missing directories of path.
+    // Throws std::runtime_error when writing fails.
+    void save() const;
+private:
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t n_sections;
+    };
+    struct SectionHeader {
+        uint64_t size;
+        uint64_t reserved;
+    };
+    static const uint32_t version = 2;
+
+    const std::string path;
+    std::shared_ptr<const MappedFile> mapping;
+    std::vector<Section> mapped_sections;
+    int n_read;
+    std::vector<std::string> added_sections;
+};
+
+
+// Whether nodes[0, n_nodes) form a single tree flattened like BVHAccel's:
+// a branch (count == 0) is immediately followed by its first child, and
+// offset is the index of its second child. Every node but the root must
+// have exactly one parent, and depth of branches must be less than
+// BVHBuilder::max_depth, so that traversal stacks can't overflow.
+// Leaves (count > 0) are checked by is_valid_leaf.
+template<typename Node, typename LeafPredicate>
+bool isValidTree(
+        const Node* nodes, uint32_t n_nodes, LeafPredicate is_valid_leaf) {
+    // -1 for nodes not reached yet.
+    std::vector<int> depths(n_nodes, -1);
+    if(n_nodes > 0) {
+        depths[0] = 0;
+    }
+    for(const uint32_t i : boost::irange(0u, n_nodes)) {
+        const Node& node = nodes[i];
+        // Parents precede their children, so a node not reached by now
+        // has no parent.
+        if(depths[i] < 0) {
+            return false;
+        }
+        if(node.count > 0) {
+            if(!is_valid_leaf(node)) {
+                return false;
+            }
+            continue;
+        }
+        if(depths[i] >= BVHBuilder::max_depth ||
+                node.offset <= i + 1 || node.offset >= n_nodes) {
+            return false;
+        }
+        for(const uint32_t child : {i + 1, node.offset}) {
+            if(depths[child] >= 0) {
+                return false;
+            }
+            depths[child] = depths[i] + 1;
+        }
+    }
+    return true;
+}
+
+}  // namespace
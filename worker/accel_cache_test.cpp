@@ -0,0 +1,118 @@
+#include "accel_cache.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/range/irange.hpp>
+#include <gtest/gtest.h>
+
+namespace {
+
+struct Node {
+    uint32_t offset;
+    uint32_t count;
+};
+
+std::string temporaryPath() {
+    return (boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path()).string();
+}
+
+std::string sectionContent(const pentatope::AccelCache::Section& section) {
+    return std::string(section.data, section.size);
+}
+
+}  // namespace
+
+
+TEST(AccelCache, SectionsAreReadInOrder) {
+    const std::string path = temporaryPath();
+    {
+        pentatope::AccelCache cache(path);
+        EXPECT_FALSE(cache.nextSection());
+        cache.addSection("first");
+        cache.addSection("");
+        cache.addSection(std::string(100, 'x'));
+        cache.save();
+    }
+    pentatope::AccelCache cache(path);
+    auto section = cache.nextSection();
+    ASSERT_TRUE(section);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(section->data) % 16);
+    EXPECT_EQ("first", sectionContent(*section));
+    section = cache.nextSection();
+    ASSERT_TRUE(section);
+    EXPECT_EQ("", sectionContent(*section));
+    section = cache.nextSection();
+    ASSERT_TRUE(section);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(section->data) % 16);
+    EXPECT_EQ(std::string(100, 'x'), sectionContent(*section));
+    EXPECT_FALSE(cache.nextSection());
+
+    // All sections were used, so the file is kept.
+    cache.save();
+    EXPECT_TRUE(boost::filesystem::exists(path));
+    boost::filesystem::remove(path);
+}
+
+TEST(AccelCache, StaleFileIsRemoved) {
+    const std::string path = temporaryPath();
+    {
+        pentatope::AccelCache cache(path);
+        cache.addSection("first");
+        cache.save();
+    }
+    // The section was rejected, and rebuilt.
+    pentatope::AccelCache cache(path);
+    ASSERT_TRUE(cache.nextSection());
+    cache.addSection("second");
+    cache.save();
+    EXPECT_FALSE(boost::filesystem::exists(path));
+}
+
+TEST(AccelCache, ValidTreeIsAccepted) {
+    const auto leaf = [](const Node& node) { return node.count <= 4; };
+    // A single leaf, and a branch with 2 leaves.
+    const std::vector<Node> single = {{0, 1}};
+    EXPECT_TRUE(pentatope::isValidTree(single.data(), single.size(), leaf));
+    const std::vector<Node> branch = {{2, 0}, {0, 1}, {1, 1}};
+    EXPECT_TRUE(pentatope::isValidTree(branch.data(), branch.size(), leaf));
+    EXPECT_FALSE(pentatope::isValidTree(branch.data(), branch.size(),
+        [](const Node& node) { return false; }));
+}
+
+TEST(AccelCache, RejectsNodeReachedTwice) {
+    const auto leaf = [](const Node& node) { return true; };
+    // Node 2 is the second child of node 0, and the first child of node 1.
+    const std::vector<Node> shared = {{2, 0}, {3, 0}, {0, 1}, {1, 1}};
+    EXPECT_FALSE(pentatope::isValidTree(shared.data(), shared.size(), leaf));
+    // Node 1 has no parent.
+    const std::vector<Node> orphan = {{0, 1}, {0, 1}};
+    EXPECT_FALSE(pentatope::isValidTree(orphan.data(), orphan.size(), leaf));
+    // Second child must be after the first child, and within nodes.
+    const std::vector<Node> backward = {{1, 0}, {0, 1}};
+    EXPECT_FALSE(
+        pentatope::isValidTree(backward.data(), backward.size(), leaf));
+    const std::vector<Node> outside = {{3, 0}, {0, 1}, {0, 1}};
+    EXPECT_FALSE(pentatope::isValidTree(outside.data(), outside.size(), leaf));
+}
+
+TEST(AccelCache, RejectsTooDeepTree) {
+    const auto leaf = [](const Node& node) { return true; };
+    // A spine of depth branches, whose second children are leaves
+    // after the spine.
+    const auto spine = [](int depth) {
+        std::vector<Node> nodes;
+        for(const int i : boost::irange(0, depth)) {
+            nodes.push_back({static_cast<uint32_t>(depth + 1 + i), 0});
+        }
+        for(const int i : boost::irange(0, depth + 1)) {
+            nodes.push_back({0, 1});
+        }
+        return nodes;
+    };
+    const int max_depth = pentatope::BVHBuilder::max_depth;
+    const auto deepest = spine(max_depth);
+    EXPECT_TRUE(pentatope::isValidTree(deepest.data(), deepest.size(), leaf));
+    const auto too_deep = spine(max_depth + 1);
+    EXPECT_FALSE(
+        pentatope::isValidTree(too_deep.data(), too_deep.size(), leaf));
+}
@@ -3,6 +3,7 @@
 #include <chrono>
 #include <random>
 
+#include <boost/filesystem.hpp>
 #include <boost/range/irange.hpp>
 #include <gtest/gtest.h>
 
@@ -40,6 +41,89 @@ TEST(BVHAccel, BehaveIdenticallyToBruteForce) {
     }
 }
 
+TEST(BVHAccel, MidpointBehaveIdenticallyToBruteForce) {
+    std::mt19937 rg;
+    for(const int i : boost::irange(0, 100)) {
+        const auto objs = arbitraryObjects(rg);
+
+        auto truth = std::make_unique<pentatope::BruteForceAccel>();
+        truth->build(objs);
+
+        auto bvh = std::make_unique<pentatope::BVHAccel>(
+            pentatope::BVHBuilder::Method::MIDPOINT);
+        bvh->build(objs);
+
+        const auto ray = arbitraryRay(rg);
+        const auto isect_truth = truth->intersect(ray);
+        const auto isect_bvh = bvh->intersect(ray);
+        EXPECT_EQ(static_cast<bool>(isect_truth.first),
+            static_cast<bool>(isect_bvh.first));
+        if(isect_truth.first) {
+            EXPECT_EQ(isect_truth.second.pos(), isect_bvh.second.pos());
+            EXPECT_EQ(isect_truth.second.normal(), isect_bvh.second.normal());
+        }
+    }
+}
+
+TEST(BVHAccel, DenseSceneBehaveIdenticallyToBruteForce) {
+    std::mt19937 rg;
+    const auto objs = arbitraryObjects(rg, 3000);
+
+    auto truth = std::make_unique<pentatope::BruteForceAccel>();
+    truth->build(objs);
+    auto bvh = std::make_unique<pentatope::BVHAccel>();
+    bvh->build(objs);
+
+    for(const int i : boost::irange(0, 300)) {
+        const auto ray = arbitraryRay(rg);
+        const auto isect_truth = truth->intersect(ray);
+        const auto isect_bvh = bvh->intersect(ray);
+        EXPECT_EQ(static_cast<bool>(isect_truth.first),
+            static_cast<bool>(isect_bvh.first));
+        if(isect_truth.first && isect_bvh.first) {
+            EXPECT_EQ(isect_truth.second.pos(), isect_bvh.second.pos());
+        }
+    }
+}
+
+TEST(BVHAccel, ParallelBuildBehaveIdenticallyToBruteForce) {
+    std::mt19937 rg;
+    const auto objs = arbitraryObjects(rg, 3000);
+
+    auto truth = std::make_unique<pentatope::BruteForceAccel>();
+    truth->build(objs);
+    for(const auto method : {
+            pentatope::BVHBuilder::Method::LBVH,
+            pentatope::BVHBuilder::Method::HLBVH}) {
+        auto bvh = std::make_unique<pentatope::BVHAccel>(method, 4);
+        bvh->build(objs);
+
+        for(const int i : boost::irange(0, 300)) {
+            const auto ray = arbitraryRay(rg);
+            const auto isect_truth = truth->intersect(ray);
+            const auto isect_bvh = bvh->intersect(ray);
+            EXPECT_EQ(static_cast<bool>(isect_truth.first),
+                static_cast<bool>(isect_bvh.first));
+            if(isect_truth.first && isect_bvh.first) {
+                EXPECT_EQ(isect_truth.second.pos(), isect_bvh.second.pos());
+            }
+        }
+    }
+}
+
+TEST(BVHAccel, SAHIsCheaperThanMidpoint) {
+    std::mt19937 rg;
+    const auto objs = arbitraryObjects(rg, 2000);
+
+    pentatope::BVHAccel bvh_midpoint(pentatope::BVHBuilder::Method::MIDPOINT);
+    bvh_midpoint.build(objs);
+    pentatope::BVHAccel bvh_sah(pentatope::BVHBuilder::Method::SAH);
+    bvh_sah.build(objs);
+
+    EXPECT_LT(0, bvh_sah.sahCost());
+    EXPECT_GE(bvh_midpoint.sahCost(), bvh_sah.sahCost());
+}
+
 TEST(BVHAccel, OperatesAtLogN) {
     std::mt19937 rg;
     
@@ -70,3 +154,245 @@ TEST(BVHAccel, OperatesAtLogN) {
     EXPECT_LT(ratio_theoretical / 2, ratio);
     EXPECT_GT(ratio_theoretical * 2, ratio);
 }
+
+TEST(BVHAccel, LoadedTreeBehaveIdenticallyToBuilt) {
+    std::mt19937 rg;
+    const auto objs = arbitraryObjects(rg, 1000);
+    // save creates the cache directory.
+    const boost::filesystem::path dir =
+        boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path();
+    const std::string path = (dir / "tree.bvh").string();
+
+    pentatope::BVHAccel built;
+    built.build(objs);
+    {
+        pentatope::AccelCache cache(path);
+        built.save(cache);
+        cache.save();
+    }
+
+    pentatope::AccelCache cache(path);
+    pentatope::BVHAccel loaded;
+    ASSERT_TRUE(loaded.load(cache, objs));
+    EXPECT_EQ(built.sahCost(), loaded.sahCost());
+    for(const int i : boost::irange(0, 300)) {
+        const auto ray = arbitraryRay(rg);
+        const auto isect_built = built.intersect(ray);
+        const auto isect_loaded = loaded.intersect(ray);
+        EXPECT_EQ(static_cast<bool>(isect_built.first),
+            static_cast<bool>(isect_loaded.first));
+        if(isect_built.first) {
+            EXPECT_EQ(isect_built.second.pos(), isect_loaded.second.pos());
+            EXPECT_EQ(isect_built.second.normal(), isect_loaded.second.normal());
+        }
+    }
+
+    // Trees for different objects must not be used.
+    pentatope::BVHAccel other;
+    pentatope::AccelCache cache_other(path);
+    EXPECT_FALSE(other.load(cache_other, arbitraryObjects(rg, 10)));
+    boost::filesystem::remove(path);
+    pentatope::AccelCache cache_missing(path);
+    EXPECT_FALSE(other.load(cache_missing, objs));
+    boost::filesystem::remove_all(dir);
+}
+
+TEST(WideBVHAccel, BehaveIdenticallyToBruteForce) {
+    std::mt19937 rg;
+    for(const int i : boost::irange(0, 100)) {
+        const auto objs = arbitraryObjects(rg);
+
+        auto truth = std::make_unique<pentatope::BruteForceAccel>();
+        truth->build(objs);
+
+        auto bvh = std::make_unique<pentatope::WideBVHAccel>();
+        bvh->build(objs);
+
+        const auto ray = arbitraryRay(rg);
+        const auto isect_truth = truth->intersect(ray);
+        const auto isect_bvh = bvh->intersect(ray);
+        EXPECT_EQ(static_cast<bool>(isect_truth.first),
+            static_cast<bool>(isect_bvh.first));
+        if(isect_truth.first) {
+            EXPECT_EQ(isect_truth.second.pos(), isect_bvh.second.pos());
+            EXPECT_EQ(isect_truth.second.normal(), isect_bvh.second.normal());
+        }
+    }
+}
+
+TEST(WideBVHAccel, DenseSceneBehaveIdenticallyToBruteForce) {
+    std::mt19937 rg;
+    const auto objs = arbitraryObjects(rg, 3000);
+
+    auto truth = std::make_unique<pentatope::BruteForceAccel>();
+    truth->build(objs);
+    auto bvh = std::make_unique<pentatope::WideBVHAccel>();
+    bvh->build(objs);
+
+    for(const int i : boost::irange(0, 300)) {
+        const auto ray = arbitraryRay(rg);
+        const auto isect_truth = truth->intersect(ray);
+        const auto isect_bvh = bvh->intersect(ray);
+        EXPECT_EQ(static_cast<bool>(isect_truth.first),
+            static_cast<bool>(isect_bvh.first));
+        if(isect_truth.first && isect_bvh.first) {
+            EXPECT_EQ(isect_truth.second.pos(), isect_bvh.second.pos());
+        }
+    }
+}
+
+TEST(QuantizedBVHAccel, DenseSceneBehaveIdenticallyToBruteForce) {
+    std::mt19937 rg;
+    // Deep enough for quantization errors to accumulate, if any.
+    const auto objs = arbitraryObjects(rg, 10000);
+
+    auto truth = std::make_unique<pentatope::BruteForceAccel>();
+    truth->build(objs);
+    auto bvh = std::make_unique<pentatope::QuantizedBVHAccel>();
+    bvh->build(objs);
+
+    for(const int i : boost::irange(0, 300)) {
+        const auto ray = arbitraryRay(rg);
+        const auto isect_truth = truth->intersect(ray);
+        const auto isect_bvh = bvh->intersect(ray);
+        EXPECT_EQ(static_cast<bool>(isect_truth.first),
+            static_cast<bool>(isect_bvh.first));
+        if(isect_truth.first && isect_bvh.first) {
+            EXPECT_EQ(isect_truth.second.pos(), isect_bvh.second.pos());
+        }
+    }
+}
+
+TEST(GridAccel, BehaveIdenticallyToBruteForce) {
+    std::mt19937 rg;
+    for(const int i : boost::irange(0, 100)) {
+        const auto objs = arbitraryObjects(rg);
+
+        auto truth = std::make_unique<pentatope::BruteForceAccel>();
+        truth->build(objs);
+
+        auto grid = std::make_unique<pentatope::GridAccel>();
+        grid->build(objs);
+
+        const auto ray = arbitraryRay(rg);
+        const auto isect_truth = truth->intersect(ray);
+        const auto isect_grid = grid->intersect(ray);
+        EXPECT_EQ(static_cast<bool>(isect_truth.first),
+            static_cast<bool>(isect_grid.first));
+        if(isect_truth.first) {
+            EXPECT_EQ(isect_truth.second.pos(), isect_grid.second.pos());
+            EXPECT_EQ(isect_truth.second.normal(), isect_grid.second.normal());
+        }
+    }
+}
+
+TEST(GridAccel, DenseSceneBehaveIdenticallyToBruteForce) {
+    std::mt19937 rg;
+    const auto objs = arbitraryObjects(rg, 3000);
+
+    auto truth = std::make_unique<pentatope::BruteForceAccel>();
+    truth->build(objs);
+    auto grid = std::make_unique<pentatope::GridAccel>();
+    grid->build(objs);
+
+    for(const int i : boost::irange(0, 300)) {
+        const auto ray = arbitraryRay(rg);
+        const auto isect_truth = truth->intersect(ray);
+        const auto isect_grid = grid->intersect(ray);
+        EXPECT_EQ(static_cast<bool>(isect_truth.first),
+            static_cast<bool>(isect_grid.first));
+        if(isect_truth.first && isect_grid.first) {
+            EXPECT_EQ(isect_truth.second.pos(), isect_grid.second.pos());
+        }
+    }
+}
+
+TEST(GridAccel, IsSuitableOnlyForEvenlySpreadObjects) {
+    std::mt19937 rg;
+    std::uniform_real_distribution<float> coord(-100, 100);
+    std::vector<pentatope::Object> spread;
+    std::vector<pentatope::Object> clustered;
+    for(const int i : boost::irange(0, 5000)) {
+        const Eigen::Vector4f center(coord(rg), coord(rg), coord(rg), coord(rg));
+        spread.emplace_back(
+            std::make_unique<pentatope::Sphere>(center, 1),
+            std::make_unique<pentatope::UniformLambertMaterial>(
+                pentatope::fromRgb(1, 1, 1)));
+        // Most objects are in a tiny corner of the scene.
+        clustered.emplace_back(
+            std::make_unique<pentatope::Sphere>(
+                (i == 0) ? center : Eigen::Vector4f(center * 1e-3), 0.01),
+            std::make_unique<pentatope::UniformLambertMaterial>(
+                pentatope::fromRgb(1, 1, 1)));
+    }
+    EXPECT_TRUE(pentatope::GridAccel::isSuitableFor(spread));
+    EXPECT_FALSE(pentatope::GridAccel::isSuitableFor(clustered));
+}
+
+TEST(Accel, OcclusionIsConsistentWithIntersection) {
+    std::mt19937 rg;
+    const auto objs = arbitraryObjects(rg, 1000);
+
+    std::vector<std::unique_ptr<pentatope::Accel>> accels;
+    accels.emplace_back(std::make_unique<pentatope::BruteForceAccel>());
+    accels.emplace_back(std::make_unique<pentatope::BVHAccel>());
+    accels.emplace_back(std::make_unique<pentatope::WideBVHAccel>());
+    accels.emplace_back(std::make_unique<pentatope::QuantizedBVHAccel>());
+    accels.emplace_back(std::make_unique<pentatope::GridAccel>());
+    for(auto& accel : accels) {
+        accel->build(objs);
+    }
+
+    for(const int i : boost::irange(0, 300)) {
+        const auto ray = arbitraryRay(rg);
+        const auto isect = accels[0]->intersect(ray);
+        for(const auto& accel : accels) {
+            if(isect.first) {
+                const float t = ray.at(isect.second.pos());
+                EXPECT_TRUE(accel->occluded(
+                    pentatope::Ray(ray.origin, ray.direction, 0, t * 1.01)));
+                EXPECT_FALSE(accel->occluded(
+                    pentatope::Ray(ray.origin, ray.direction, 0, t * 0.99)));
+            } else {
+                EXPECT_FALSE(accel->occluded(ray));
+            }
+        }
+    }
+}
+
+TEST(BVHAccel, PacketBehaveIdenticallyToSingleRays) {
+    std::mt19937 rg;
+    const auto objs = arbitraryObjects(rg, 1000);
+    pentatope::BVHAccel accel;
+    accel.build(objs);
+
+    std::uniform_real_distribution<float> spread(-0.2, 0.2);
+    for(const int i : boost::irange(0, 50)) {
+        // Coherent packet sharing origin, like primary rays of a camera,
+        // and incoherent one that cannot be culled by a frustum.
+        const auto center = arbitraryRay(rg);
+        std::vector<pentatope::Ray> coherent;
+        std::vector<pentatope::Ray> incoherent;
+        for(const int j : boost::irange(0, 64)) {
+            const Eigen::Vector4f dir = center.direction + Eigen::Vector4f(
+                spread(rg), spread(rg), spread(rg), spread(rg));
+            coherent.emplace_back(center.origin, dir.normalized());
+            incoherent.push_back(arbitraryRay(rg));
+        }
+        for(const auto& rays : {coherent, incoherent}) {
+            const auto isects = accel.intersectPacket(rays);
+            ASSERT_EQ(rays.size(), isects.size());
+            for(const int j : boost::irange(0, static_cast<int>(rays.size()))) {
+                const auto isect = accel.intersect(rays[j]);
+                ASSERT_EQ(static_cast<bool>(isect.first),
+                    static_cast<bool>(isects[j].first));
+                if(isect.first) {
+                    EXPECT_NEAR(0,
+                        (isect.second.pos() - isects[j].second.pos()).norm(),
+                        1e-3);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,793 @@
+#include "bvh_builder.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <thread>
+
+#include <boost/range/irange.hpp>
+#include <glog/logging.h>
+
+namespace pentatope {
+
+namespace {
+
+int longestAxis(const AABB& aabb) {
+    const Eigen::Vector4f size = aabb.size();
+    int longest_axis = 0;
+    for(const int axis : boost::irange(1, 4)) {
+        if(size(axis) > size(longest_axis)) {
+            longest_axis = axis;
+        }
+    }
+    return longest_axis;
+}
+
+// Sum of traversal and intersection costs of node and its descendants,
+// weighted by probability of a ray hitting them.
+float sahCostOfSubtree(
+        const BVHBuildNode& node, float surface_root,
+        float cost_traversal, float cost_intersection) {
+    const float prob = (surface_root > 0) ?
+        node.aabb.surface() / surface_root : 1;
+    if(node.isLeaf()) {
+        return prob * node.count * cost_intersection;
+    }
+    return prob * cost_traversal +
+        sahCostOfSubtree(*node.left, surface_root,
+            cost_traversal, cost_intersection) +
+        sahCostOfSubtree(*node.right, surface_root,
+            cost_traversal, cost_intersection);
+}
+
+// Returns none when a and b don't overlap.
+boost::optional<AABB> intersectionOf(const AABB& a, const AABB& b) {
+    const Eigen::Vector4f vmin = a.min().cwiseMax(b.min());
+    const Eigen::Vector4f vmax = a.max().cwiseMin(b.max());
+    if((vmin.array() > vmax.array()).any()) {
+        return boost::none;
+    }
+    return AABB(vmin, vmax);
+}
+
+// Run body(i) for i in [0, n_threads) on separate threads
+// (including the caller's) and wait for all of them.
+void runThreads(int n_threads, const std::function<void(int)>& body) {
+    assert(n_threads > 0);
+    std::vector<std::thread> threads;
+    for(const int i : boost::irange(1, n_threads)) {
+        threads.emplace_back(body, i);
+    }
+    body(0);
+    for(auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// Run body(begin, end) for disjoint ranges covering [0, n).
+void parallelFor(
+        int n_threads, int n, const std::function<void(int, int)>& body) {
+    const int n_chunks = std::max(1, std::min(n_threads, n));
+    runThreads(n_chunks, [n, n_chunks, &body](int i) {
+        body(
+            static_cast<int64_t>(n) * i / n_chunks,
+            static_cast<int64_t>(n) * (i + 1) / n_chunks);
+    });
+}
+
+// Sort chunks in parallel, and then merge them pairwise in parallel.
+void parallelSort(
+        int n_threads, std::vector<std::pair<uint64_t, int>>& values) {
+    const int n = values.size();
+    const int n_chunks = std::max(1, std::min(n_threads, n));
+    std::vector<int> bounds;
+    for(const int i : boost::irange(0, n_chunks + 1)) {
+        bounds.push_back(static_cast<int64_t>(n) * i / n_chunks);
+    }
+    runThreads(n_chunks, [&values, &bounds](int i) {
+        std::sort(
+            values.begin() + bounds[i], values.begin() + bounds[i + 1]);
+    });
+    for(int width = 1; width < n_chunks; width *= 2) {
+        // Merge [i, i + width) and [i + width, i + 2 * width) chunks.
+        std::vector<int> merge_begins;
+        for(int i = 0; i + width < n_chunks; i += 2 * width) {
+            merge_begins.push_back(i);
+        }
+        runThreads(merge_begins.size(),
+            [&values, &bounds, &merge_begins, width, n_chunks](int j) {
+                const int i = merge_begins[j];
+                std::inplace_merge(
+                    values.begin() + bounds[i],
+                    values.begin() + bounds[i + width],
+                    values.begin() + bounds[std::min(i + 2 * width, n_chunks)]);
+            });
+    }
+}
+
+}  // namespace
+
+
+BVHBuildNode::BVHBuildNode() :
+    aabb(Eigen::Vector4f::Zero(), Eigen::Vector4f::Zero()),
+    axis(-1), first(0), count(0) {
+}
+
+bool BVHBuildNode::isLeaf() const {
+    return count > 0;
+}
+
+
+const int BVHBuilder::max_depth;
+const int BVHBuilder::max_objects_per_leaf;
+const int BVHBuilder::max_heuristic_depth;
+const int BVHBuilder::n_bins;
+const int BVHBuilder::n_treelet_bits;
+constexpr float BVHBuilder::cost_traversal;
+constexpr float BVHBuilder::cost_intersection;
+constexpr float BVHBuilder::spatial_split_alpha;
+
+BVHBuilder::PrimitiveInfo::PrimitiveInfo(int index, const AABB& aabb) :
+    index(index), aabb(aabb), centroid(aabb.center()) {
+}
+
+BVHBuilder::BVHBuilder(Method method, int n_threads, int batch_size) :
+        method(method), n_threads(n_threads), batch_size(batch_size),
+        max_leaf_size(
+            (batch_size > 1) ? batch_size : max_objects_per_leaf) {
+    assert(n_threads > 0);
+    assert(batch_size > 0);
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::build(
+        const std::vector<AABB>& bounds) {
+    assert(!bounds.empty());
+    primitives.clear();
+    primitives.reserve(bounds.size());
+    for(const int i : boost::irange(0, static_cast<int>(bounds.size()))) {
+        primitives.emplace_back(i, bounds[i]);
+    }
+    auto root = (method == Method::LBVH || method == Method::HLBVH) ?
+        buildMorton() :
+        buildRange(0, primitives.size(), 0);
+
+    ordered_indices.clear();
+    ordered_indices.reserve(primitives.size());
+    for(const auto& prim : primitives) {
+        ordered_indices.push_back(prim.index);
+    }
+    primitives.clear();
+    morton_codes.clear();
+    return root;
+}
+
+const std::vector<int>& BVHBuilder::getOrderedIndices() const {
+    return ordered_indices;
+}
+
+float BVHBuilder::sahCost(const BVHBuildNode& root) {
+    return sahCostOfSubtree(
+        root, root.aabb.surface(), cost_traversal, cost_intersection);
+}
+
+uint64_t BVHBuilder::mortonCode(
+        uint16_t x, uint16_t y, uint16_t z, uint16_t w) {
+    // Insert 3 zero bits after each bit.
+    auto spread = [](uint64_t v) {
+        v = (v | (v << 24)) & 0x000000ff000000ffull;
+        v = (v | (v << 12)) & 0x000f000f000f000full;
+        v = (v | (v << 6)) & 0x0303030303030303ull;
+        v = (v | (v << 3)) & 0x1111111111111111ull;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1) | (spread(z) << 2) | (spread(w) << 3);
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::buildRange(
+        int begin, int end, int depth) {
+    assert(begin < end);
+    assert(depth <= max_depth);
+    const int n = end - begin;
+    const AABB aabb = boundsOf(primitives, begin, end);
+    if(n == 1) {
+        return createLeaf(aabb, begin, end);
+    }
+
+    int axis = -1;
+    int mid = begin;
+    if(depth < max_heuristic_depth) {
+        mid = (method == Method::SAH) ?
+            partitionSAH(
+                primitives, aabb, begin, end,
+                max_leaf_size, batch_size, axis) :
+            partitionMidpoint(
+                primitives, aabb, begin, end, max_leaf_size, axis);
+    }
+    if(mid == begin || mid == end) {
+        if(n <= max_leaf_size) {
+            return createLeaf(aabb, begin, end);
+        }
+        // Too many primitives for a leaf, but they cannot be
+        // separated spatially (e.g. sharing a centroid), or the tree
+        // is getting too deep.
+        axis = longestAxis(centroidBoundsOf(primitives, begin, end));
+        mid = partitionMedian(primitives, begin, end, axis);
+    }
+    assert(begin < mid && mid < end);
+    return createBranch(aabb, axis,
+        buildRange(begin, mid, depth + 1),
+        buildRange(mid, end, depth + 1));
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::buildSpatial(
+        const std::vector<AABB>& bounds,
+        const ClipFunction& clip, float max_growth) {
+    assert(!bounds.empty());
+    assert(max_growth >= 0);
+    std::vector<PrimitiveInfo> refs;
+    refs.reserve(bounds.size());
+    for(const int i : boost::irange(0, static_cast<int>(bounds.size()))) {
+        refs.emplace_back(i, bounds[i]);
+    }
+    const float surface_root = boundsOf(refs, 0, refs.size()).surface();
+    int budget = max_growth * bounds.size();
+    primitives.clear();
+    auto root = buildSpatialRefs(
+        std::move(refs), clip, surface_root, budget, 0);
+
+    ordered_indices.clear();
+    ordered_indices.reserve(primitives.size());
+    for(const auto& prim : primitives) {
+        ordered_indices.push_back(prim.index);
+    }
+    primitives.clear();
+    return root;
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::buildSpatialRefs(
+        std::vector<PrimitiveInfo> refs, const ClipFunction& clip,
+        float surface_root, int& budget, int depth) {
+    assert(!refs.empty());
+    assert(depth <= max_depth);
+    const int n = refs.size();
+    const AABB aabb = boundsOf(refs, 0, n);
+    auto emitLeaf = [this, &refs, &aabb]() {
+        const int begin = primitives.size();
+        primitives.insert(primitives.end(), refs.begin(), refs.end());
+        return createLeaf(aabb, begin, primitives.size());
+    };
+    if(n == 1) {
+        return emitLeaf();
+    }
+
+    int axis = -1;
+    int mid = 0;
+    if(depth < max_heuristic_depth) {
+        mid = partitionSAH(refs, aabb, 0, n, max_leaf_size, batch_size, axis);
+    }
+    if(0 < mid && mid < n && budget > 0) {
+        // Try a spatial split when the object split leaves
+        // large overlap.
+        const AABB aabb_left = boundsOf(refs, 0, mid);
+        const AABB aabb_right = boundsOf(refs, mid, n);
+        const auto overlap = intersectionOf(aabb_left, aabb_right);
+        auto batchesOf = [this](int count) {
+            return (count + batch_size - 1) / batch_size;
+        };
+        const float cost_object = cost_traversal + cost_intersection * (
+            aabb_left.surface() * batchesOf(mid) +
+            aabb_right.surface() * batchesOf(n - mid)) / aabb.surface();
+        float cost_spatial;
+        int axis_spatial;
+        float position;
+        if(overlap &&
+                overlap->surface() > spatial_split_alpha * surface_root &&
+                findSpatialSplit(
+                    refs, aabb, clip, cost_spatial, axis_spatial, position) &&
+                cost_spatial < cost_object) {
+            std::vector<PrimitiveInfo> refs_left;
+            std::vector<PrimitiveInfo> refs_right;
+            for(const auto& ref : refs) {
+                if(ref.aabb.max()(axis_spatial) <= position) {
+                    refs_left.push_back(ref);
+                } else if(ref.aabb.min()(axis_spatial) >= position) {
+                    refs_right.push_back(ref);
+                } else {
+                    const auto aabb_ref_left = clipRef(
+                        ref, clip, axis_spatial,
+                        ref.aabb.min()(axis_spatial), position);
+                    const auto aabb_ref_right = clipRef(
+                        ref, clip, axis_spatial,
+                        position, ref.aabb.max()(axis_spatial));
+                    if(aabb_ref_left) {
+                        refs_left.emplace_back(ref.index, *aabb_ref_left);
+                    }
+                    if(aabb_ref_right) {
+                        refs_right.emplace_back(ref.index, *aabb_ref_right);
+                    }
+                    if(!aabb_ref_left && !aabb_ref_right) {
+                        // Numerically lost; keep it as is.
+                        refs_left.push_back(ref);
+                    }
+                }
+            }
+            const int growth = refs_left.size() + refs_right.size() - n;
+            if(!refs_left.empty() && !refs_right.empty() &&
+                    static_cast<int>(refs_left.size()) < n &&
+                    static_cast<int>(refs_right.size()) < n &&
+                    growth <= budget) {
+                budget -= growth;
+                refs.clear();
+                refs.shrink_to_fit();
+                auto left = buildSpatialRefs(
+                    std::move(refs_left), clip, surface_root, budget, depth + 1);
+                auto right = buildSpatialRefs(
+                    std::move(refs_right), clip, surface_root, budget, depth + 1);
+                return createBranch(
+                    aabb, axis_spatial, std::move(left), std::move(right));
+            }
+        }
+    }
+    if(mid == 0 || mid == n) {
+        if(n <= max_leaf_size) {
+            return emitLeaf();
+        }
+        axis = longestAxis(centroidBoundsOf(refs, 0, n));
+        mid = partitionMedian(refs, 0, n, axis);
+    }
+    std::vector<PrimitiveInfo> refs_right(refs.begin() + mid, refs.end());
+    refs.erase(refs.begin() + mid, refs.end());
+    auto left = buildSpatialRefs(
+        std::move(refs), clip, surface_root, budget, depth + 1);
+    auto right = buildSpatialRefs(
+        std::move(refs_right), clip, surface_root, budget, depth + 1);
+    return createBranch(aabb, axis, std::move(left), std::move(right));
+}
+
+bool BVHBuilder::findSpatialSplit(
+        const std::vector<PrimitiveInfo>& refs, const AABB& aabb,
+        const ClipFunction& clip,
+        float& cost, int& axis, float& position) const {
+    const float surface_parent = aabb.surface();
+    if(surface_parent <= 0) {
+        return false;
+    }
+    auto batchesOf = [this](int count) {
+        return (count + batch_size - 1) / batch_size;
+    };
+    const float l = std::numeric_limits<float>::lowest();
+    const float m = std::numeric_limits<float>::max();
+    cost = m;
+    axis = -1;
+    for(const int axis_cand : boost::irange(0, 4)) {
+        const float p_min = aabb.min()(axis_cand);
+        const float bin_size = aabb.size()(axis_cand) / n_bins;
+        if(bin_size <= 0) {
+            continue;
+        }
+        auto binOf = [p_min, bin_size](float p) {
+            const int bin = static_cast<int>((p - p_min) / bin_size);
+            return std::min(n_bins - 1, std::max(0, bin));
+        };
+
+        // Clip each reference into bins it covers, and count
+        // the bins it enters and exits.
+        std::array<int, n_bins> entries;
+        std::array<int, n_bins> exits;
+        std::array<Eigen::Vector4f, n_bins> vmins;
+        std::array<Eigen::Vector4f, n_bins> vmaxs;
+        entries.fill(0);
+        exits.fill(0);
+        vmins.fill(Eigen::Vector4f(m, m, m, m));
+        vmaxs.fill(Eigen::Vector4f(l, l, l, l));
+        for(const auto& ref : refs) {
+            const int bin_first = binOf(ref.aabb.min()(axis_cand));
+            const int bin_last = binOf(ref.aabb.max()(axis_cand));
+            entries[bin_first]++;
+            exits[bin_last]++;
+            for(const int bin : boost::irange(bin_first, bin_last + 1)) {
+                const auto aabb_clipped = (bin_first == bin_last) ?
+                    boost::optional<AABB>(ref.aabb) :
+                    clipRef(ref, clip, axis_cand,
+                        p_min + bin * bin_size, p_min + (bin + 1) * bin_size);
+                if(aabb_clipped) {
+                    vmins[bin] = vmins[bin].cwiseMin(aabb_clipped->min());
+                    vmaxs[bin] = vmaxs[bin].cwiseMax(aabb_clipped->max());
+                }
+            }
+        }
+
+        // Sweep from right to get bounds of [split, n_bins).
+        std::array<float, n_bins> surfaces_right;
+        std::array<int, n_bins> counts_right;
+        Eigen::Vector4f vmin_acc(m, m, m, m);
+        Eigen::Vector4f vmax_acc(l, l, l, l);
+        int count_acc = 0;
+        for(int split = n_bins - 1; split > 0; split--) {
+            vmin_acc = vmin_acc.cwiseMin(vmins[split]);
+            vmax_acc = vmax_acc.cwiseMax(vmaxs[split]);
+            count_acc += exits[split];
+            counts_right[split] = count_acc;
+            surfaces_right[split] = (count_acc > 0) ?
+                AABB(vmin_acc, vmax_acc).surface() : 0;
+        }
+
+        // Sweep from left and evaluate each split plane.
+        vmin_acc = Eigen::Vector4f(m, m, m, m);
+        vmax_acc = Eigen::Vector4f(l, l, l, l);
+        count_acc = 0;
+        for(const int split : boost::irange(1, n_bins)) {
+            vmin_acc = vmin_acc.cwiseMin(vmins[split - 1]);
+            vmax_acc = vmax_acc.cwiseMax(vmaxs[split - 1]);
+            count_acc += entries[split - 1];
+            if(count_acc == 0 || counts_right[split] == 0) {
+                continue;
+            }
+            const float cost_cand = cost_traversal + cost_intersection * (
+                AABB(vmin_acc, vmax_acc).surface() * batchesOf(count_acc) +
+                surfaces_right[split] * batchesOf(counts_right[split])) /
+                surface_parent;
+            if(cost_cand < cost) {
+                cost = cost_cand;
+                axis = axis_cand;
+                position = p_min + split * bin_size;
+            }
+        }
+    }
+    return axis >= 0;
+}
+
+boost::optional<AABB> BVHBuilder::clipRef(
+        const PrimitiveInfo& ref, const ClipFunction& clip,
+        int axis, float lo, float hi) {
+    const auto aabb_clipped = clip(ref.index, axis, lo, hi);
+    if(!aabb_clipped) {
+        return boost::none;
+    }
+    // ref may already be clipped by ancestors.
+    Eigen::Vector4f vmin = ref.aabb.min();
+    Eigen::Vector4f vmax = ref.aabb.max();
+    vmin(axis) = std::max(vmin(axis), lo);
+    vmax(axis) = std::min(vmax(axis), hi);
+    return intersectionOf(*aabb_clipped, AABB(vmin, vmax));
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::buildMorton() {
+    const int n = primitives.size();
+
+    // Quantize centroids and calculate codes.
+    const AABB centroid_bounds = centroidBoundsOf(primitives, 0, n);
+    const Eigen::Vector4f c_min = centroid_bounds.min();
+    const Eigen::Vector4f c_size = centroid_bounds.size();
+    std::vector<std::pair<uint64_t, int>> codes(n);
+    parallelFor(n_threads, n, [this, &codes, &c_min, &c_size](int begin, int end) {
+        for(const int i : boost::irange(begin, end)) {
+            std::array<uint16_t, 4> quantized;
+            for(const int axis : boost::irange(0, 4)) {
+                const float v = (c_size(axis) > 0) ?
+                    (primitives[i].centroid(axis) - c_min(axis)) / c_size(axis) :
+                    0;
+                quantized[axis] = std::min(65535.0f, std::max(0.0f, v * 65535));
+            }
+            codes[i] = std::make_pair(
+                mortonCode(quantized[0], quantized[1], quantized[2], quantized[3]),
+                i);
+        }
+    });
+    // Reorder primitives in Morton order. Ties are broken by
+    // original index, to make the tree deterministic.
+    parallelSort(n_threads, codes);
+    std::vector<PrimitiveInfo> primitives_sorted;
+    primitives_sorted.reserve(n);
+    morton_codes.resize(n);
+    for(const int i : boost::irange(0, n)) {
+        primitives_sorted.push_back(primitives[codes[i].second]);
+        morton_codes[i] = codes[i].first;
+    }
+    primitives.swap(primitives_sorted);
+
+    // Group primitives by top bits and build treelets in parallel.
+    const int treelet_shift = 64 - n_treelet_bits;
+    std::vector<int> treelet_begins;
+    for(const int i : boost::irange(0, n)) {
+        if(i == 0 || (morton_codes[i] >> treelet_shift) !=
+                (morton_codes[i - 1] >> treelet_shift)) {
+            treelet_begins.push_back(i);
+        }
+    }
+    const int n_treelets = treelet_begins.size();
+    treelet_begins.push_back(n);
+    std::vector<std::unique_ptr<BVHBuildNode>> roots(n_treelets);
+    std::atomic<int> next_treelet(0);
+    runThreads(std::max(1, std::min(n_threads, n_treelets)),
+        [this, &roots, &treelet_begins, &next_treelet, n_treelets, treelet_shift](int) {
+            while(true) {
+                const int i = next_treelet++;
+                if(i >= n_treelets) {
+                    break;
+                }
+                roots[i] = emitMorton(
+                    treelet_begins[i], treelet_begins[i + 1],
+                    treelet_shift - 1, 0);
+            }
+        });
+
+    // Connect treelets.
+    if(method == Method::LBVH) {
+        return emitTreeletsMorton(roots, treelet_begins, 0, n_treelets, 63);
+    } else {
+        std::vector<PrimitiveInfo> treelets;
+        for(const int i : boost::irange(0, n_treelets)) {
+            treelets.emplace_back(i, roots[i]->aabb);
+        }
+        return buildTreeletsSAH(roots, treelets, 0, n_treelets, 0);
+    }
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::emitMorton(
+        int begin, int end, int bit, int depth) const {
+    assert(begin < end);
+    assert(depth <= max_depth);
+    const int n = end - begin;
+    const AABB aabb = boundsOf(primitives, begin, end);
+    if(n <= max_leaf_size) {
+        return createLeaf(aabb, begin, end);
+    }
+    // Find the highest bit that differs in the range. Since codes are
+    // sorted, it's enough to compare the first and the last.
+    while(bit >= 0 &&
+            (((morton_codes[begin] ^ morton_codes[end - 1]) >> bit) & 1) == 0) {
+        bit--;
+    }
+    int axis;
+    int mid;
+    if(bit < 0 || depth >= max_heuristic_depth) {
+        // Codes are identical, or the tree is getting too deep.
+        axis = longestAxis(aabb);
+        mid = begin + n / 2;
+    } else {
+        axis = bit % 4;
+        mid = std::partition_point(
+            morton_codes.begin() + begin, morton_codes.begin() + end,
+            [bit](uint64_t code) {
+                return ((code >> bit) & 1) == 0;
+            }) - morton_codes.begin();
+        bit--;
+    }
+    assert(begin < mid && mid < end);
+    return createBranch(aabb, axis,
+        emitMorton(begin, mid, bit, depth + 1),
+        emitMorton(mid, end, bit, depth + 1));
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::emitTreeletsMorton(
+        std::vector<std::unique_ptr<BVHBuildNode>>& roots,
+        const std::vector<int>& treelet_begins, int begin, int end, int bit) {
+    assert(begin < end);
+    if(end - begin == 1) {
+        return std::move(roots[begin]);
+    }
+    auto codeOf = [this, &treelet_begins](int i_treelet) {
+        return morton_codes[treelet_begins[i_treelet]];
+    };
+    // Treelets have distinct top bits, so this always terminates
+    // before reaching bits inside treelets.
+    while((((codeOf(begin) ^ codeOf(end - 1)) >> bit) & 1) == 0) {
+        bit--;
+    }
+    assert(bit >= 64 - n_treelet_bits);
+    int mid = begin + 1;
+    while(((codeOf(mid) >> bit) & 1) == 0) {
+        mid++;
+    }
+    assert(begin < mid && mid < end);
+    auto left = emitTreeletsMorton(roots, treelet_begins, begin, mid, bit - 1);
+    auto right = emitTreeletsMorton(roots, treelet_begins, mid, end, bit - 1);
+    const AABB aabb = AABB::fromAABBs({left->aabb, right->aabb});
+    return createBranch(aabb, bit % 4, std::move(left), std::move(right));
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::buildTreeletsSAH(
+        std::vector<std::unique_ptr<BVHBuildNode>>& roots,
+        std::vector<PrimitiveInfo>& treelets, int begin, int end, int depth) {
+    assert(begin < end);
+    if(end - begin == 1) {
+        return std::move(roots[treelets[begin].index]);
+    }
+    const AABB aabb = boundsOf(treelets, begin, end);
+    int axis = -1;
+    int mid = begin;
+    if(depth < max_heuristic_depth) {
+        mid = partitionSAH(treelets, aabb, begin, end, 1, 1, axis);
+    }
+    if(mid == begin || mid == end) {
+        axis = longestAxis(centroidBoundsOf(treelets, begin, end));
+        mid = partitionMedian(treelets, begin, end, axis);
+    }
+    return createBranch(aabb, axis,
+        buildTreeletsSAH(roots, treelets, begin, mid, depth + 1),
+        buildTreeletsSAH(roots, treelets, mid, end, depth + 1));
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::createLeaf(
+        const AABB& aabb, int begin, int end) {
+    auto node = std::make_unique<BVHBuildNode>();
+    node->aabb = aabb;
+    node->first = begin;
+    node->count = end - begin;
+    return node;
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::createBranch(
+        const AABB& aabb, int axis,
+        std::unique_ptr<BVHBuildNode> left,
+        std::unique_ptr<BVHBuildNode> right) {
+    auto node = std::make_unique<BVHBuildNode>();
+    node->aabb = aabb;
+    node->axis = axis;
+    node->left = std::move(left);
+    node->right = std::move(right);
+    return node;
+}
+
+int BVHBuilder::partitionMidpoint(
+        std::vector<PrimitiveInfo>& infos, const AABB& aabb,
+        int begin, int end, int max_leaf_size, int& axis) {
+    if(end - begin <= max_leaf_size) {
+        return begin;
+    }
+    axis = longestAxis(aabb);
+    const float midpoint = aabb.center()(axis);
+    // Partition objects by comparing centroids of objects
+    // with midpoint of the chosen axis.
+    const auto it_mid = std::partition(
+        infos.begin() + begin, infos.begin() + end,
+        [axis, midpoint](const PrimitiveInfo& prim) {
+            return prim.centroid(axis) < midpoint;
+        });
+    const int mid = it_mid - infos.begin();
+    if(mid == begin || mid == end) {
+        return partitionMedian(infos, begin, end, axis);
+    }
+    return mid;
+}
+
+int BVHBuilder::partitionSAH(
+        std::vector<PrimitiveInfo>& infos, const AABB& aabb,
+        int begin, int end, int max_leaf_size, int batch_size, int& axis) {
+    const int n = end - begin;
+    auto batchesOf = [batch_size](int count) {
+        return (count + batch_size - 1) / batch_size;
+    };
+    const float surface_parent = aabb.surface();
+    if(surface_parent <= 0) {
+        // All primitives are squashed into a lower-dimensional box,
+        // so surface cannot tell anything.
+        return partitionMidpoint(
+            infos, aabb, begin, end, max_leaf_size, axis);
+    }
+    const AABB centroid_bounds = centroidBoundsOf(infos, begin, end);
+    const Eigen::Vector4f c_min = centroid_bounds.min();
+    const Eigen::Vector4f c_size = centroid_bounds.size();
+    auto binOf = [&c_min, &c_size](const PrimitiveInfo& prim, int axis) {
+        const int bin = static_cast<int>(
+            n_bins * (prim.centroid(axis) - c_min(axis)) / c_size(axis));
+        return std::min(n_bins - 1, std::max(0, bin));
+    };
+
+    const float l = std::numeric_limits<float>::lowest();
+    const float m = std::numeric_limits<float>::max();
+    float best_cost = m;
+    int best_axis = -1;
+    int best_split = -1;
+    for(const int axis_cand : boost::irange(0, 4)) {
+        if(c_size(axis_cand) <= 0) {
+            continue;
+        }
+        std::array<int, n_bins> counts;
+        std::array<Eigen::Vector4f, n_bins> vmins;
+        std::array<Eigen::Vector4f, n_bins> vmaxs;
+        counts.fill(0);
+        vmins.fill(Eigen::Vector4f(m, m, m, m));
+        vmaxs.fill(Eigen::Vector4f(l, l, l, l));
+        for(const int i : boost::irange(begin, end)) {
+            const auto& prim = infos[i];
+            const int bin = binOf(prim, axis_cand);
+            counts[bin]++;
+            vmins[bin] = vmins[bin].cwiseMin(prim.aabb.min());
+            vmaxs[bin] = vmaxs[bin].cwiseMax(prim.aabb.max());
+        }
+
+        // Sweep from right to get bounds of [split, n_bins).
+        std::array<float, n_bins> surfaces_right;
+        std::array<int, n_bins> counts_right;
+        Eigen::Vector4f vmin_acc(m, m, m, m);
+        Eigen::Vector4f vmax_acc(l, l, l, l);
+        int count_acc = 0;
+        for(int split = n_bins - 1; split > 0; split--) {
+            vmin_acc = vmin_acc.cwiseMin(vmins[split]);
+            vmax_acc = vmax_acc.cwiseMax(vmaxs[split]);
+            count_acc += counts[split];
+            counts_right[split] = count_acc;
+            surfaces_right[split] = (count_acc > 0) ?
+                AABB(vmin_acc, vmax_acc).surface() : 0;
+        }
+
+        // Sweep from left and evaluate each split [0, split) | [split, n_bins).
+        vmin_acc = Eigen::Vector4f(m, m, m, m);
+        vmax_acc = Eigen::Vector4f(l, l, l, l);
+        count_acc = 0;
+        for(const int split : boost::irange(1, n_bins)) {
+            vmin_acc = vmin_acc.cwiseMin(vmins[split - 1]);
+            vmax_acc = vmax_acc.cwiseMax(vmaxs[split - 1]);
+            count_acc += counts[split - 1];
+            if(count_acc == 0 || counts_right[split] == 0) {
+                continue;
+            }
+            const float cost = cost_traversal + cost_intersection * (
+                AABB(vmin_acc, vmax_acc).surface() * batchesOf(count_acc) +
+                surfaces_right[split] * batchesOf(counts_right[split])) /
+                surface_parent;
+            if(cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis_cand;
+                best_split = split;
+            }
+        }
+    }
+    if(best_axis < 0) {
+        return begin;
+    }
+    if(n <= max_leaf_size && batchesOf(n) * cost_intersection <= best_cost) {
+        return begin;
+    }
+
+    axis = best_axis;
+    const auto it_mid = std::partition(
+        infos.begin() + begin, infos.begin() + end,
+        [&binOf, best_axis, best_split](const PrimitiveInfo& prim) {
+            return binOf(prim, best_axis) < best_split;
+        });
+    return it_mid - infos.begin();
+}
+
+int BVHBuilder::partitionMedian(
+        std::vector<PrimitiveInfo>& infos, int begin, int end, int axis) {
+    const int mid = begin + (end - begin) / 2;
+    std::nth_element(
+        infos.begin() + begin,
+        infos.begin() + mid,
+        infos.begin() + end,
+        [axis](const PrimitiveInfo& prim0, const PrimitiveInfo& prim1) {
+            return prim0.centroid(axis) < prim1.centroid(axis);
+        });
+    return mid;
+}
+
+AABB BVHBuilder::boundsOf(
+        const std::vector<PrimitiveInfo>& infos, int begin, int end) {
+    assert(begin < end);
+    Eigen::Vector4f vmin = infos[begin].aabb.min();
+    Eigen::Vector4f vmax = infos[begin].aabb.max();
+    for(const int i : boost::irange(begin + 1, end)) {
+        vmin = vmin.cwiseMin(infos[i].aabb.min());
+        vmax = vmax.cwiseMax(infos[i].aabb.max());
+    }
+    return AABB(vmin, vmax);
+}
+
+AABB BVHBuilder::centroidBoundsOf(
+        const std::vector<PrimitiveInfo>& infos, int begin, int end) {
+    assert(begin < end);
+    Eigen::Vector4f vmin = infos[begin].centroid;
+    Eigen::Vector4f vmax = infos[begin].centroid;
+    for(const int i : boost::irange(begin + 1, end)) {
+        vmin = vmin.cwiseMin(infos[i].centroid);
+        vmax = vmax.cwiseMax(infos[i].centroid);
+    }
+    return AABB(vmin, vmax);
+}
+
+}  // namespace
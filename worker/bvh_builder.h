@@ -0,0 +1,209 @@
+// Construction of binary bounding volume hierarchies.
+// Builders only see bounds of primitives, so they can be shared by
+// accelerators that use different node layouts for traversal.
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <boost/optional.hpp>
+#include <Eigen/Dense>
+
+#include <geometry.h>
+
+namespace pentatope {
+
+// A node of a binary BVH under construction.
+class BVHBuildNode {
+public:
+    // Create an invalid node.
+    BVHBuildNode();
+
+    bool isLeaf() const;
+
+    AABB aabb;
+
+    // Only populated when this node is a branch.
+    std::unique_ptr<BVHBuildNode> left;
+    std::unique_ptr<BVHBuildNode> right;
+    // Axis used to separate left and right. Only valid for a branch.
+    int axis;
+
+    // Only populated when this node is a leaf.
+    // [first, first + count) of BVHBuilder::getOrderedIndices().
+    int first;
+    int count;
+};
+
+
+// Builds a binary BVH from bounds of primitives.
+// See http://www.sci.utah.edu/~wald/Publications/2007/ParallelBVHBuild/fastbuild.pdf
+// for binned SAH, and
+// http://research.nvidia.com/sites/default/files/publications/HLBVH-final.pdf
+// for (H)LBVH, and
+// http://www.nvidia.com/docs/IO/77714/sbvh.pdf
+// for spatial splits.
+class BVHBuilder {
+public:
+    // Returns bounds of the part of the index-th primitive within
+    // [lo, hi] along axis, or none when they don't overlap.
+    using ClipFunction = std::function<
+        boost::optional<AABB>(int index, int axis, float lo, float hi)>;
+
+    enum class Method {
+        // Split at spatial midpoint of the longest axis,
+        // and fallback to median when that fails.
+        MIDPOINT,
+        // Binned surface area heuristic, using 3-d volume of
+        // AABB boundary as the "surface area".
+        SAH,
+        // Sort primitives by 4-d Morton code of centroids and
+        // split where code bits change. Treelets below the top 12 bits
+        // are built in parallel.
+        LBVH,
+        // Same as LBVH, but the top levels above treelets are built
+        // by SAH. Slower to build but gives better trees than LBVH.
+        HLBVH
+    };
+
+    // n_threads is only used by LBVH and HLBVH.
+    // When batch_size > 1, primitives in a leaf are assumed to be
+    // tested together in batches of batch_size (e.g. SIMD width), and
+    // leaves contain at most batch_size primitives.
+    BVHBuilder(Method method, int n_threads = 1, int batch_size = 1);
+
+    // Upper bound of tree depth (root = 0) for any number of primitives
+    // representable by int. Useful to allocate fixed-size traversal stacks.
+    static const int max_depth = 128;
+
+    // bounds[i] is bounds of the i-th primitive. bounds must not be empty.
+    std::unique_ptr<BVHBuildNode> build(const std::vector<AABB>& bounds);
+
+    // Build with spatial splits in addition to SAH object splits.
+    // Spatial splits clip straddling primitives by clip, and put them
+    // into both children. Useful when primitives are long and thin.
+    // Method is ignored. Leaves refer to at most
+    // (1 + max_growth) * bounds.size() primitives in total.
+    std::unique_ptr<BVHBuildNode> buildSpatial(
+        const std::vector<AABB>& bounds,
+        const ClipFunction& clip, float max_growth);
+
+    // Primitive indices in the order referred by leaves of
+    // the last built tree. For (H)LBVH, this is the Morton order.
+    // After buildSpatial, an index can appear multiple times.
+    const std::vector<int>& getOrderedIndices() const;
+
+    // Expected cost of a random ray traversing the tree, in
+    // units of a single primitive intersection.
+    static float sahCost(const BVHBuildNode& root);
+
+    // Interleave 16 bit quantized coordinates into a 64 bit Morton code.
+    // Bit i of axis a goes to bit (4 * i + a).
+    static uint64_t mortonCode(
+        uint16_t x, uint16_t y, uint16_t z, uint16_t w);
+private:
+    // Bounds and centroid of a primitive, computed only once per build.
+    struct PrimitiveInfo {
+        PrimitiveInfo(int index, const AABB& aabb);
+
+        int index;
+        AABB aabb;
+        Eigen::Vector4f centroid;
+    };
+
+    // Build a subtree for primitives[begin, end) by MIDPOINT or SAH.
+    std::unique_ptr<BVHBuildNode> buildRange(int begin, int end, int depth);
+
+    // Sort primitives in Morton order and build a tree from
+    // parallelly built treelets.
+    std::unique_ptr<BVHBuildNode> buildMorton();
+
+    // Build a subtree for primitives[begin, end) that
+    // share Morton code bits above bit.
+    // Only reads primitives, so it can run in parallel.
+    std::unique_ptr<BVHBuildNode> emitMorton(
+        int begin, int end, int bit, int depth) const;
+
+    // Build a subtree for refs by SAH object splits and spatial splits,
+    // consuming budget for duplicated references.
+    // Leaves are appended to primitives.
+    std::unique_ptr<BVHBuildNode> buildSpatialRefs(
+        std::vector<PrimitiveInfo> refs, const ClipFunction& clip,
+        float surface_root, int& budget, int depth);
+
+    // Find the best spatial split plane of refs by binning.
+    // Returns false when none is found.
+    bool findSpatialSplit(
+        const std::vector<PrimitiveInfo>& refs, const AABB& aabb,
+        const ClipFunction& clip,
+        float& cost, int& axis, float& position) const;
+
+    // Bounds of ref clipped to [lo, hi] along axis.
+    static boost::optional<AABB> clipRef(
+        const PrimitiveInfo& ref, const ClipFunction& clip,
+        int axis, float lo, float hi);
+
+    // Build upper levels over treelets[begin, end) by Morton code bits.
+    std::unique_ptr<BVHBuildNode> emitTreeletsMorton(
+        std::vector<std::unique_ptr<BVHBuildNode>>& roots,
+        const std::vector<int>& treelet_begins, int begin, int end, int bit);
+
+    // Build upper levels over treelets[begin, end) by SAH.
+    std::unique_ptr<BVHBuildNode> buildTreeletsSAH(
+        std::vector<std::unique_ptr<BVHBuildNode>>& roots,
+        std::vector<PrimitiveInfo>& treelets, int begin, int end, int depth);
+
+    static std::unique_ptr<BVHBuildNode> createLeaf(
+        const AABB& aabb, int begin, int end);
+
+    static std::unique_ptr<BVHBuildNode> createBranch(
+        const AABB& aabb, int axis,
+        std::unique_ptr<BVHBuildNode> left,
+        std::unique_ptr<BVHBuildNode> right);
+
+    // Split infos[begin, end) and return the boundary index.
+    // Returns begin when it's better to create a leaf
+    // of no more than max_leaf_size primitives.
+    static int partitionMidpoint(
+        std::vector<PrimitiveInfo>& infos, const AABB& aabb,
+        int begin, int end, int max_leaf_size, int& axis);
+    // Cost of primitives is counted by batches of batch_size.
+    static int partitionSAH(
+        std::vector<PrimitiveInfo>& infos, const AABB& aabb,
+        int begin, int end, int max_leaf_size, int batch_size, int& axis);
+    static int partitionMedian(
+        std::vector<PrimitiveInfo>& infos, int begin, int end, int axis);
+
+    static AABB boundsOf(
+        const std::vector<PrimitiveInfo>& infos, int begin, int end);
+    static AABB centroidBoundsOf(
+        const std::vector<PrimitiveInfo>& infos, int begin, int end);
+private:
+    static const int max_objects_per_leaf = 3;
+    // Nodes deeper than this (in a subtree built by a single method)
+    // are split at the median. Because subtrees are at most 2 levels
+    // (treelets and above), depth never exceeds max_depth.
+    static const int max_heuristic_depth = 32;
+    static const int n_bins = 16;
+    // Morton code bits used to group primitives into treelets.
+    static const int n_treelet_bits = 12;
+    // Spatial splits are only tried when children of the object split
+    // overlap more than this, relative to the root surface.
+    static constexpr float spatial_split_alpha = 1e-5;
+    // Relative costs used in SAH.
+    static constexpr float cost_traversal = 0.125;
+    static constexpr float cost_intersection = 1;
+
+    const Method method;
+    const int n_threads;
+    const int batch_size;
+    const int max_leaf_size;
+    std::vector<PrimitiveInfo> primitives;
+    // Only used by (H)LBVH. morton_codes[i] is code of primitives[i].
+    std::vector<uint64_t> morton_codes;
+    std::vector<int> ordered_indices;
+};
+
+}  // namespace
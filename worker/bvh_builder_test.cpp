@@ -0,0 +1,220 @@
+#include "bvh_builder.h"
+
+#include <algorithm>
+#include <random>
+
+#include <boost/range/irange.hpp>
+#include <gtest/gtest.h>
+
+#include <arbitrary_test.h>
+
+namespace {
+
+// Check that every leaf is contained by all of its ancestors,
+// and return number of primitives in the subtree.
+int checkSubtree(
+        const pentatope::BVHBuildNode& node,
+        const std::vector<pentatope::AABB>& bounds,
+        const std::vector<int>& ordered_indices) {
+    if(node.isLeaf()) {
+        for(const int i : boost::irange(node.first, node.first + node.count)) {
+            const auto& aabb = bounds[ordered_indices[i]];
+            EXPECT_TRUE(node.aabb.contains(aabb.min()));
+            EXPECT_TRUE(node.aabb.contains(aabb.max()));
+        }
+        return node.count;
+    }
+    EXPECT_TRUE(node.left && node.right);
+    EXPECT_TRUE(node.aabb.contains(node.left->aabb.min()));
+    EXPECT_TRUE(node.aabb.contains(node.left->aabb.max()));
+    EXPECT_TRUE(node.aabb.contains(node.right->aabb.min()));
+    EXPECT_TRUE(node.aabb.contains(node.right->aabb.max()));
+    return checkSubtree(*node.left, bounds, ordered_indices) +
+        checkSubtree(*node.right, bounds, ordered_indices);
+}
+
+}  // namespace
+
+TEST(BVHBuilder, CoversAllPrimitives) {
+    std::mt19937 rg;
+    for(const auto method : {
+            pentatope::BVHBuilder::Method::MIDPOINT,
+            pentatope::BVHBuilder::Method::SAH}) {
+        for(const int i : boost::irange(0, 10)) {
+            const auto objs = arbitraryObjects(rg);
+            std::vector<pentatope::AABB> bounds;
+            for(const auto& obj : objs) {
+                bounds.push_back(obj.first->bounds());
+            }
+            pentatope::BVHBuilder builder(method);
+            const auto root = builder.build(bounds);
+            ASSERT_TRUE(root);
+
+            // Ordered indices must be a permutation.
+            auto indices = builder.getOrderedIndices();
+            std::sort(indices.begin(), indices.end());
+            ASSERT_EQ(objs.size(), indices.size());
+            for(const int j : boost::irange(0, static_cast<int>(indices.size()))) {
+                EXPECT_EQ(j, indices[j]);
+            }
+            EXPECT_EQ(objs.size(),
+                checkSubtree(*root, bounds, builder.getOrderedIndices()));
+        }
+    }
+}
+
+TEST(BVHBuilder, HandlesIdenticalPrimitives) {
+    const pentatope::AABB aabb(
+        Eigen::Vector4f(0, 0, 0, 0), Eigen::Vector4f(1, 1, 1, 1));
+    const std::vector<pentatope::AABB> bounds(100, aabb);
+
+    pentatope::BVHBuilder builder(pentatope::BVHBuilder::Method::SAH);
+    const auto root = builder.build(bounds);
+    ASSERT_TRUE(root);
+    EXPECT_EQ(100, checkSubtree(*root, bounds, builder.getOrderedIndices()));
+}
+
+TEST(BVHBuilder, BatchedLeavesFitInBatch) {
+    // Heavily overlapping primitives, like tetrahedra of a mesh.
+    std::mt19937 rg;
+    std::uniform_real_distribution<float> coord(-10, 10);
+    std::vector<pentatope::AABB> bounds;
+    for(const int i : boost::irange(0, 1000)) {
+        const Eigen::Vector4f center(coord(rg), coord(rg), coord(rg), coord(rg));
+        bounds.emplace_back(
+            center - Eigen::Vector4f(2, 2, 2, 2),
+            center + Eigen::Vector4f(2, 2, 2, 2));
+    }
+    // Count leaves, checking that they fit in max_leaf_size.
+    auto countLeaves = [](const pentatope::BVHBuildNode& root, int max_leaf_size) {
+        int n_leaves = 0;
+        std::vector<const pentatope::BVHBuildNode*> stack = {&root};
+        while(!stack.empty()) {
+            const auto node = stack.back();
+            stack.pop_back();
+            if(node->isLeaf()) {
+                EXPECT_GE(max_leaf_size, node->count);
+                n_leaves++;
+            } else {
+                stack.push_back(node->left.get());
+                stack.push_back(node->right.get());
+            }
+        }
+        return n_leaves;
+    };
+
+    pentatope::BVHBuilder builder_scalar(pentatope::BVHBuilder::Method::SAH);
+    const auto root_scalar = builder_scalar.build(bounds);
+    pentatope::BVHBuilder builder(pentatope::BVHBuilder::Method::SAH, 1, 4);
+    const auto root = builder.build(bounds);
+    ASSERT_TRUE(root);
+    EXPECT_EQ(bounds.size(),
+        checkSubtree(*root, bounds, builder.getOrderedIndices()));
+    // Leaves should be fuller, since a batch costs the same
+    // regardless of the number of primitives in it.
+    EXPECT_GT(countLeaves(*root_scalar, 3), countLeaves(*root, 4));
+}
+
+TEST(BVHBuilder, SpatialSplitsSeparateDiagonalPrimitives) {
+    // Long diagonal segments, whose AABBs overlap each other heavily.
+    std::mt19937 rg;
+    std::uniform_real_distribution<float> coord(-100, 100);
+    std::vector<std::pair<Eigen::Vector4f, Eigen::Vector4f>> segments;
+    std::vector<pentatope::AABB> bounds;
+    for(const int i : boost::irange(0, 500)) {
+        const Eigen::Vector4f p0(coord(rg), coord(rg), coord(rg), coord(rg));
+        const Eigen::Vector4f p1 = p0 + Eigen::Vector4f(30, 30, 30, 30);
+        segments.emplace_back(p0, p1);
+        bounds.emplace_back(p0, p1);
+    }
+    auto clip = [&segments](int index, int axis, float lo, float hi) {
+        const auto& seg = segments[index];
+        const float d = seg.second(axis) - seg.first(axis);
+        const float t0 = std::max(0.0f, (lo - seg.first(axis)) / d);
+        const float t1 = std::min(1.0f, (hi - seg.first(axis)) / d);
+        if(t0 > t1) {
+            return boost::optional<pentatope::AABB>();
+        }
+        const Eigen::Vector4f q0 = seg.first + t0 * (seg.second - seg.first);
+        const Eigen::Vector4f q1 = seg.first + t1 * (seg.second - seg.first);
+        return boost::optional<pentatope::AABB>(
+            pentatope::AABB(q0.cwiseMin(q1), q0.cwiseMax(q1)));
+    };
+
+    pentatope::BVHBuilder builder(pentatope::BVHBuilder::Method::SAH);
+    const auto root_object = builder.build(bounds);
+    const float cost_object = pentatope::BVHBuilder::sahCost(*root_object);
+    const auto root = builder.buildSpatial(bounds, clip, 0.3);
+    const float cost_spatial = pentatope::BVHBuilder::sahCost(*root);
+
+    // Every primitive is referred, within the growth limit.
+    const auto& indices = builder.getOrderedIndices();
+    EXPECT_LT(bounds.size(), indices.size());
+    EXPECT_GE(bounds.size() * 1.3, indices.size());
+    std::vector<bool> referred(bounds.size(), false);
+    for(const int index : indices) {
+        referred[index] = true;
+    }
+    EXPECT_EQ(bounds.size(), std::count(referred.begin(), referred.end(), true));
+    EXPECT_GT(cost_object, cost_spatial);
+}
+
+TEST(BVHBuilder, MortonBuildsCoverAllPrimitives) {
+    std::mt19937 rg;
+    for(const auto method : {
+            pentatope::BVHBuilder::Method::LBVH,
+            pentatope::BVHBuilder::Method::HLBVH}) {
+        for(const int n_threads : {1, 3, 8}) {
+            const auto objs = arbitraryObjects(rg, 1000);
+            std::vector<pentatope::AABB> bounds;
+            for(const auto& obj : objs) {
+                bounds.push_back(obj.first->bounds());
+            }
+            pentatope::BVHBuilder builder(method, n_threads);
+            const auto root = builder.build(bounds);
+            ASSERT_TRUE(root);
+
+            auto indices = builder.getOrderedIndices();
+            std::sort(indices.begin(), indices.end());
+            ASSERT_EQ(objs.size(), indices.size());
+            for(const int j : boost::irange(0, static_cast<int>(indices.size()))) {
+                EXPECT_EQ(j, indices[j]);
+            }
+            EXPECT_EQ(objs.size(),
+                checkSubtree(*root, bounds, builder.getOrderedIndices()));
+        }
+    }
+}
+
+TEST(BVHBuilder, MortonBuildIsIndependentOfThreads) {
+    std::mt19937 rg;
+    const auto objs = arbitraryObjects(rg, 1000);
+    std::vector<pentatope::AABB> bounds;
+    for(const auto& obj : objs) {
+        bounds.push_back(obj.first->bounds());
+    }
+    pentatope::BVHBuilder builder_single(
+        pentatope::BVHBuilder::Method::HLBVH, 1);
+    const auto root_single = builder_single.build(bounds);
+    pentatope::BVHBuilder builder_multi(
+        pentatope::BVHBuilder::Method::HLBVH, 4);
+    const auto root_multi = builder_multi.build(bounds);
+
+    EXPECT_EQ(builder_single.getOrderedIndices(),
+        builder_multi.getOrderedIndices());
+    EXPECT_FLOAT_EQ(
+        pentatope::BVHBuilder::sahCost(*root_single),
+        pentatope::BVHBuilder::sahCost(*root_multi));
+}
+
+TEST(BVHBuilder, MortonCodeInterleavesAxes) {
+    EXPECT_EQ(0b0001, pentatope::BVHBuilder::mortonCode(1, 0, 0, 0));
+    EXPECT_EQ(0b0010, pentatope::BVHBuilder::mortonCode(0, 1, 0, 0));
+    EXPECT_EQ(0b0100, pentatope::BVHBuilder::mortonCode(0, 0, 1, 0));
+    EXPECT_EQ(0b1000, pentatope::BVHBuilder::mortonCode(0, 0, 0, 1));
+    EXPECT_EQ(0b10000, pentatope::BVHBuilder::mortonCode(2, 0, 0, 0));
+    EXPECT_EQ(0xffffffffffffffffull,
+        pentatope::BVHBuilder::mortonCode(0xffff, 0xffff, 0xffff, 0xffff));
+    EXPECT_EQ(0x8000000000000000ull,
+        pentatope::BVHBuilder::mortonCode(0, 0, 0, 0x8000));
+}
@@ -1,7 +1,11 @@
 #include "camera.h"
 
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include <boost/range/irange.hpp>
@@ -27,14 +31,145 @@ Camera2::Camera2(Pose pose,
 }
 
 
+namespace {
+
+// Scalar brightness of a sample, to estimate noise.
+float luminance(const cv::Vec3f& color) {
+    return (color[0] + color[1] + color[2]) / 3;
+}
+
+}  // namespace
+
+
 // return 8 bit BGR image.
 cv::Mat Camera2::render(
         const Scene& scene, Sampler& sampler,
-        const int samples_per_pixel,
-        const int n_threads) const {
-    boost::lockfree::queue<TileSpecifier> tiles(0);
+        const int samples_per_pixel, const int max_depth,
+        const int n_threads, const bool adaptive,
+        const ProgressCallback& progress) const {
+    assert(samples_per_pixel > 0);
+    Accumulator accum;
+    accum.sum = cv::Mat(height, width, CV_32FC3);
+    accum.sum = 0.0f;
+    accum.sum_sq = cv::Mat(height, width, CV_32FC1);
+    accum.sum_sq = 0.0f;
+    accum.count = cv::Mat(height, width, CV_32SC1);
+    accum.count = 0;
+
+    cv::Mat target_count(height, width, CV_32SC1);
+    // Variance needs at least 2 samples / px.
+    const int base_samples = std::max(2, samples_per_pixel / 4);
+    if(adaptive && samples_per_pixel > base_samples) {
+        target_count = base_samples;
+        if(!renderPasses(scene, sampler, max_depth, n_threads,
+                target_count, accum, progress)) {
+            return resolve(accum);
+        }
+
+        double mean_image = 0;
+        for(int y = 0; y < height; y++) {
+            for(int x = 0; x < width; x++) {
+                mean_image += luminance(accum.sum.at<cv::Vec3f>(y, x));
+            }
+        }
+        mean_image /= static_cast<double>(width) * height * base_samples;
+
+        // Optimal number of samples is proportional to standard
+        // deviation. Relative to brightness because tonemapped noise is,
+        // but not too much so that dark pixels don't take everything.
+        std::vector<float> weights;
+        weights.reserve(width * height);
+        for(int y = 0; y < height; y++) {
+            for(int x = 0; x < width; x++) {
+                const float n = base_samples;
+                const float mean =
+                    luminance(accum.sum.at<cv::Vec3f>(y, x)) / n;
+                const float variance = std::max(0.0f,
+                    (accum.sum_sq.at<float>(y, x) - n * mean * mean) /
+                    (n - 1));
+                const float scale = std::abs(mean) + 0.1f * mean_image;
+                weights.push_back(
+                    (scale > 0) ? std::sqrt(variance) / scale : 0.0f);
+            }
+        }
+        const auto extra_samples = distributeSamples(weights,
+            static_cast<int64_t>(samples_per_pixel - base_samples) *
+            width * height);
+        int i = 0;
+        for(int y = 0; y < height; y++) {
+            for(int x = 0; x < width; x++) {
+                target_count.at<int32_t>(y, x) =
+                    base_samples + extra_samples[i++];
+            }
+        }
+        LOG(INFO) << "Adaptive sampling: " << base_samples
+            << " samples/px traced, rest distributed by variance";
+    } else {
+        target_count = samples_per_pixel;
+    }
+    renderPasses(scene, sampler, max_depth, n_threads,
+        target_count, accum, progress);
+    return resolve(accum);
+}
+
+
+cv::Mat Camera2::resolve(const Accumulator& accum) const {
     cv::Mat film(height, width, CV_32FC3);
-    film = 0.0f;
+    for(int y = 0; y < height; y++) {
+        for(int x = 0; x < width; x++) {
+            const int count = accum.count.at<int32_t>(y, x);
+            film.at<cv::Vec3f>(y, x) = (count > 0) ?
+                accum.sum.at<cv::Vec3f>(y, x) / count :
+                cv::Vec3f(0, 0, 0);
+        }
+    }
+    return film;
+}
+
+
+bool Camera2::renderPasses(
+        const Scene& scene, Sampler& sampler, const int max_depth,
+        const int n_threads, const cv::Mat& target_count,
+        Accumulator& accum, const ProgressCallback& progress) const {
+    if(!progress) {
+        renderPass(scene, sampler, max_depth, n_threads, target_count, accum);
+        return true;
+    }
+    int min_count = std::numeric_limits<int>::max();
+    int max_target = 0;
+    for(int y = 0; y < height; y++) {
+        for(int x = 0; x < width; x++) {
+            min_count = std::min(min_count, accum.count.at<int32_t>(y, x));
+            max_target = std::max(max_target, target_count.at<int32_t>(y, x));
+        }
+    }
+    // Double samples from what all pixels already have.
+    cv::Mat pass_count(height, width, CV_32SC1);
+    for(int n = std::max(1, 2 * min_count); ; n *= 2) {
+        for(int y = 0; y < height; y++) {
+            for(int x = 0; x < width; x++) {
+                pass_count.at<int32_t>(y, x) =
+                    std::min(n, target_count.at<int32_t>(y, x));
+            }
+        }
+        renderPass(scene, sampler, max_depth, n_threads, pass_count, accum);
+        LOG(INFO) << "Progressive rendering: pass with up to " << n
+            << " samples/px done";
+        if(!progress(resolve(accum), accum.count)) {
+            return false;
+        }
+        if(n >= max_target) {
+            return true;
+        }
+    }
+}
+
+
+void Camera2::renderPass(
+        const Scene& scene, Sampler& sampler, const int max_depth,
+        const int n_threads, const cv::Mat& target_count,
+        Accumulator& accum) const {
+    boost::lockfree::queue<TileSpecifier> tiles(0);
 
     // Divide image into tiles.
     const int tile_size = 32;
@@ -63,9 +198,10 @@ cv::Mat Camera2::render(
     assert(n_threads > 0);
     if(n_threads == 1) {
         // Don't spawn threads for easy debugging.
-        workerBody(scene, sampler, samples_per_pixel, film, tiles);
+        workerBody(scene, sampler, max_depth, target_count, accum, tiles);
     } else {
-        auto child_samplers = sampler.split(n_threads);
+        // Samples only depend on pixels, so threads can share the settings.
+        std::vector<Sampler> child_samplers(n_threads, sampler);
         std::vector<std::thread> workers;
         for(int i : boost::irange(0, n_threads)) {
             workers.emplace_back(
@@ -73,8 +209,9 @@ cv::Mat Camera2::render(
                 this,
                 std::cref(scene),
                 std::ref(child_samplers[i]),
-                samples_per_pixel,
-                std::ref(film),
+                max_depth,
+                std::cref(target_count),
+                std::ref(accum),
                 std::ref(tiles));
         }
         for(std::thread& worker : workers) {
@@ -83,19 +220,17 @@ cv::Mat Camera2::render(
     }
 
     assert(tiles.empty());
-    return film;
 }
 
 
 void Camera2::workerBody(
-        const Scene& scene, Sampler& sampler,
-        const int samples_per_pixel,
-        cv::Mat& film,
+        const Scene& scene, Sampler& sampler, const int max_depth,
+        const cv::Mat& target_count, Accumulator& accum,
         boost::lockfree::queue<TileSpecifier>& task_queue) const {
     while(!task_queue.empty()) {
         TileSpecifier tile;
         if(task_queue.pop(tile)) {
-            renderTile(scene, sampler, samples_per_pixel, film, tile);
+            renderTile(scene, sampler, max_depth, target_count, accum, tile);
         } else {
             std::this_thread::yield();
         }
@@ -104,34 +239,80 @@ void Camera2::workerBody(
 
 
 void Camera2::renderTile(
-        const Scene& scene, Sampler& sampler,
-        const int samples_per_pixel,
-        cv::Mat& film,
+        const Scene& scene, Sampler& sampler, const int max_depth,
+        const cv::Mat& target_count, Accumulator& accum,
         TileSpecifier tile) const {
     assert(tile.dx > 0);
     assert(tile.dy > 0);
-    assert(samples_per_pixel > 0);
     // TODO: use Spectrum array.
     const float c_dx = std::tan(fov_x / 2);
     const float c_dy = std::tan(fov_y / 2);
     const Eigen::Vector4f org_w = pose.asAffine().translation();
-    std::uniform_real_distribution<float> px_var(-0.5, 0.5);
-    for(const int y : boost::irange(tile.y0,  tile.y0 + tile.dy)) {
-        for(const int x : boost::irange(tile.x0, tile.x0 + tile.dx)) {
-            cv::Vec3f accum(0, 0, 0);
-            for(const int i : boost::irange(0, samples_per_pixel)) {
-                Eigen::Vector4f dir_c(
-                    (((x + px_var(sampler.gen)) * 1.0f / width) - 0.5) * c_dx,
-                    (((y + px_var(sampler.gen)) * 1.0f / height) - 0.5) * c_dy,
-                    0,
-                    1);
-                dir_c.normalize();
-                Eigen::Vector4f dir_w = pose.asAffine().rotation() * dir_c;
-
-                Ray ray(org_w, dir_w);
-                accum += toCvRgb(scene.trace(ray, sampler, 5));
+    // Primary rays of a small block of pixels are coherent,
+    // so trace them together as a packet.
+    const int packet_size = 8;
+    std::vector<Ray> rays;
+    // (pixel, sample index) of each ray.
+    std::vector<std::pair<uint64_t, uint32_t>> samples;
+    for(const int by : boost::irange(0, tile.dy, packet_size)) {
+        for(const int bx : boost::irange(0, tile.dx, packet_size)) {
+            const int y0 = tile.y0 + by;
+            const int y1 = tile.y0 + std::min(tile.dy, by + packet_size);
+            const int x0 = tile.x0 + bx;
+            const int x1 = tile.x0 + std::min(tile.dx, bx + packet_size);
+            int max_new_samples = 0;
+            for(const int y : boost::irange(y0, y1)) {
+                for(const int x : boost::irange(x0, x1)) {
+                    max_new_samples = std::max(max_new_samples,
+                        target_count.at<int32_t>(y, x) -
+                        accum.count.at<int32_t>(y, x));
+                }
+            }
+            for(const int i : boost::irange(0, max_new_samples)) {
+                // Pixels that still need samples continue their sample
+                // indices.
+                rays.clear();
+                samples.clear();
+                for(const int y : boost::irange(y0, y1)) {
+                    for(const int x : boost::irange(x0, x1)) {
+                        const int index = accum.count.at<int32_t>(y, x) + i;
+                        if(index >= target_count.at<int32_t>(y, x)) {
+                            continue;
+                        }
+                        samples.emplace_back(y * width + x, index);
+                        sampler.startPixelSample(y * width + x, index);
+                        const float px = x + sampler.next1D() - 0.5f;
+                        const float py = y + sampler.next1D() - 0.5f;
+                        Eigen::Vector4f dir_c(
+                            ((px * 1.0f / width) - 0.5) * c_dx,
+                            ((py * 1.0f / height) - 0.5) * c_dy,
+                            0,
+                            1);
+                        dir_c.normalize();
+                        Eigen::Vector4f dir_w = pose.asAffine().rotation() * dir_c;
+                        rays.emplace_back(org_w, dir_w);
+                    }
+                }
+                auto isects = scene.intersectPacket(rays);
+                for(const int j : boost::irange(0, static_cast<int>(rays.size()))) {
+                    // Continue the sample of this pixel.
+                    sampler.startPixelSample(samples[j].first, samples[j].second);
+                    const cv::Vec3f value = toCvRgb(scene.shade(
+                        rays[j], std::move(isects[j]), sampler, max_depth));
+                    const int y = samples[j].first / width;
+                    const int x = samples[j].first % width;
+                    accum.sum.at<cv::Vec3f>(y, x) += value;
+                    accum.sum_sq.at<float>(y, x) +=
+                        luminance(value) * luminance(value);
+                }
+            }
+            for(const int y : boost::irange(y0, y1)) {
+                for(const int x : boost::irange(x0, x1)) {
+                    accum.count.at<int32_t>(y, x) = std::max(
+                        accum.count.at<int32_t>(y, x),
+                        target_count.at<int32_t>(y, x));
+                }
             }
-            film.at<cv::Vec3f>(y, x) = accum / samples_per_pixel;
         }
     }
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <functional>
+
 #include <boost/lockfree/queue.hpp>
 #include <opencv2/opencv.hpp>
 
@@ -16,14 +18,28 @@ cv::Vec3f toCvRgb(const Spectrum& spec);
 // Points to W+ direction, and records light rays with Z=0.
 class Camera2 {
 public:
+    // Called after each pass of progressive rendering with the current
+    // estimate (same format as render result) and the number of samples
+    // of each pixel (CV_32SC1). Return false to stop rendering.
+    using ProgressCallback = std::function<
+        bool(const cv::Mat& film, const cv::Mat& sample_count)>;
+
     Camera2(Pose pose,
             int width, int height, Radianf fov_x, Radianf fov_y);
 
     // return 32 bit float BGR image.
+    // Paths have at most max_depth surface interactions.
+    // When adaptive, some samples are traced first, and the rest go
+    // to pixels with high relative variance; samples_per_pixel
+    // is kept as the average over the image.
+    // When progress is given, samples are traced in passes that double
+    // samples of each pixel (1, 2, 4, ...), and progress is called after
+    // each. When it returns false, the current estimate is returned.
     cv::Mat render(
         const Scene& scene, Sampler& sampler,
-        const int samples_per_pixel,
-        const int n_threads) const;
+        const int samples_per_pixel, const int max_depth,
+        const int n_threads, const bool adaptive = false,
+        const ProgressCallback& progress = ProgressCallback()) const;
     static cv::Mat tonemapLinear(const cv::Mat& image);
 private:
     // std::tuple<int, int, int, int> doesn't work because it lacks
@@ -35,18 +51,43 @@ private:
         int dy;
     };
 
+    // Sums of samples of each pixel.
+    struct Accumulator {
+        // CV_32FC3, sum of radiance.
+        cv::Mat sum;
+        // CV_32FC1, sum of squared luminance.
+        cv::Mat sum_sq;
+        // CV_32SC1, number of samples.
+        cv::Mat count;
+    };
+
+    // Average of samples of each pixel. Black for pixels without samples.
+    cv::Mat resolve(const Accumulator& accum) const;
+
+    // Same as renderPass, but split into passes and report them to
+    // progress when it's given. Returns false when progress stopped it.
+    bool renderPasses(
+        const Scene& scene, Sampler& sampler, const int max_depth,
+        const int n_threads, const cv::Mat& target_count,
+        Accumulator& accum, const ProgressCallback& progress) const;
+
+    // Add samples to accum until each pixel has as many samples as
+    // target_count (CV_32SC1), using n_threads threads.
+    void renderPass(
+        const Scene& scene, Sampler& sampler, const int max_depth,
+        const int n_threads, const cv::Mat& target_count,
+        Accumulator& accum) const;
+
     // Run until all tiles in task_queue is consumed.
     void workerBody(
-        const Scene& scene, Sampler& sampler,
-        const int sampler_per_pixel,
-        cv::Mat& target,
+        const Scene& scene, Sampler& sampler, const int max_depth,
+        const cv::Mat& target_count, Accumulator& accum,
         boost::lockfree::queue<TileSpecifier>& task_queue) const;
 
-    // Write rendered samples to specified rectangle region of target.
+    // Add samples to specified rectangle region of accum.
     void renderTile(
-        const Scene& scene, Sampler& sampler,
-        const int sampler_per_pixel,
-        cv::Mat& target,
+        const Scene& scene, Sampler& sampler, const int max_depth,
+        const cv::Mat& target_count, Accumulator& accum,
         TileSpecifier tile) const;
 private:
     const Pose pose;
@@ -8,6 +8,34 @@
 
 namespace pentatope {
 
+namespace {
+
+// Outward normal of the face of [vmin, vmax] nearest to pos,
+// which is assumed to be on the boundary.
+Eigen::Vector4f faceNormal(
+        const Eigen::Vector4f& vmin, const Eigen::Vector4f& vmax,
+        const Eigen::Vector4f& pos) {
+    int face_axis = 0;
+    bool face_positive = false;
+    float min_dist = std::numeric_limits<float>::max();
+    for(const int axis : boost::irange(0, 4)) {
+        for(const bool is_positive : {false, true}) {
+            const float dist = std::abs(
+                (is_positive ? vmax(axis) : vmin(axis)) - pos(axis));
+            if(dist < min_dist) {
+                min_dist = dist;
+                face_axis = axis;
+                face_positive = is_positive;
+            }
+        }
+    }
+    Eigen::Vector4f normal = Eigen::Vector4f::Zero();
+    normal(face_axis) = face_positive ? 1 : -1;
+    return normal;
+}
+
+}  // namespace
+
 MicroGeometry::MicroGeometry() {
 }
 
@@ -24,76 +52,82 @@ Eigen::Vector4f MicroGeometry::normal() const {
 }
 
 
-Sphere::Sphere(Eigen::Vector4f center, float radius) :
-        center(center), radius(radius) {
+RayHit::RayHit() : index(-1), element(0) {
 }
 
-boost::optional<MicroGeometry>
-        Sphere::intersect(const Ray& ray) const {
-    const Eigen::Vector4f delta = ray.origin - center;
-    // turn into a quadratic equation at^2+bt+c=0
-    const float a = std::pow(ray.direction.norm(), 2);
-    const float b = 2 * delta.dot(ray.direction);
-    const float c = std::pow(delta.norm(), 2) - std::pow(radius, 2);
-    const float det = b * b - 4 * a * c;
-    if(det < 0) {
-        return boost::none;
-    }
-    const float t0 = (-b - std::sqrt(det)) / (2 * a);
-    const float t1 = (-b + std::sqrt(det)) / (2 * a);
-    float t_isect;
-    if(t0 > 0) {
-        t_isect = t0;
-    } else if(t1 > 0) {
-        t_isect = t1;
-    } else {
+RayHit::RayHit(float t, const Eigen::Vector3f& uvw) :
+        t(t), index(-1), element(0), uvw(uvw) {
+}
+
+
+boost::optional<MicroGeometry> Geometry::intersect(const Ray& ray) const {
+    const auto hit = intersectHit(ray);
+    if(!hit) {
         return boost::none;
     }
-    // store intersection
-    const Eigen::Vector4f p = ray.at(t_isect);
-    return MicroGeometry(p, (p - center).normalized());
+    return microGeometry(ray, *hit);
+}
+
+
+Sphere::Sphere(Eigen::Vector4f center, float radius) {
+    data.center = center;
+    data.radius = radius;
+}
+
+MicroGeometry Sphere::microGeometry(
+        const Ray& ray, const RayHit& hit) const {
+    const Eigen::Vector4f p = ray.at(hit.t);
+    return MicroGeometry(p, (p - data.center).normalized());
+}
+
+boost::optional<RayHit> Sphere::intersectHit(const Ray& ray) const {
+    return data.intersect(ray);
 }
 
 AABB Sphere::bounds() const {
-    return AABB(
-        center - Eigen::Vector4f(radius, radius, radius, radius),
-        center + Eigen::Vector4f(radius, radius, radius, radius));
+    const Eigen::Vector4f r(data.radius, data.radius, data.radius, data.radius);
+    return AABB(data.center - r, data.center + r);
+}
+
+const SphereData& Sphere::getData() const {
+    return data;
 }
 
 
 Disc::Disc(const Eigen::Vector4f& center,
-        const Eigen::Vector4f& normal, float radius) :
-        center(center), normal(normal), radius(radius),
-        d(normal.dot(center)) {
+        const Eigen::Vector4f& normal, float radius) {
+    data.center = center;
+    data.normal = normal;
+    data.radius = radius;
+    data.d = normal.dot(center);
 }
 
-boost::optional<MicroGeometry>
-        Disc::intersect(const Ray& ray) const {
-    const float perp_dir = normal.dot(ray.direction);
-    if(perp_dir == 0) {
-        return boost::none;
-    }
-    const float t = (d - normal.dot(ray.origin)) / perp_dir;
-    if(t <= 0) {
-        return boost::none;
-    }
-    if((ray.at(t) - center).norm() > radius) {
-        return boost::none;
-    }
+MicroGeometry Disc::microGeometry(
+        const Ray& ray, const RayHit& hit) const {
     // perp_dir > 0: negative side
     // perp_dir < 0: positive side
+    const float perp_dir = data.normal.dot(ray.direction);
     return MicroGeometry(
-        ray.at(t),
-        (perp_dir > 0) ? static_cast<Eigen::Vector4f>(-normal) : normal);
+        ray.at(hit.t),
+        (perp_dir > 0) ?
+            static_cast<Eigen::Vector4f>(-data.normal) : data.normal);
+}
+
+boost::optional<RayHit> Disc::intersectHit(const Ray& ray) const {
+    return data.intersect(ray);
 }
 
 AABB Disc::bounds() const {
     Eigen::Vector4f d_bound;
     for(const int axis : boost::irange(0, 4)) {
-        const float sin_axis = std::sqrt(1 - std::pow(normal(axis), 2));
-        d_bound(axis) = std::max(1e-3f, sin_axis * radius);  // make bound size non-zero to avoid numeric instability.
+        const float sin_axis = std::sqrt(1 - std::pow(data.normal(axis), 2));
+        d_bound(axis) = std::max(1e-3f, sin_axis * data.radius);  // make bound size non-zero to avoid numeric instability.
     }
-    return AABB(center - d_bound, center + d_bound);
+    return AABB(data.center - d_bound, data.center + d_bound);
+}
+
+const DiscData& Disc::getData() const {
+    return data;
 }
 
 
@@ -131,59 +165,18 @@ AABB AABB::fromConvexVertices(const std::vector<Eigen::Vector4f>& vertices) {
     return AABB(vmin, vmax);
 }
 
-boost::optional<MicroGeometry>
-        AABB::intersect(const Ray& ray) const {
-    // AABB is an intersection of 8 half-spaces, 2 for
-    // each axis.
-    std::pair<float, Eigen::Vector4f> min_t_n;
-    min_t_n.first = std::numeric_limits<float>::max();
-    for(int i : boost::irange(0, 4)) {
-        // Check two planes' t. (positive and negative)
-        const float perp_dir = ray.direction(i);
-        if(perp_dir == 0) {
-            continue;
-        }
-        const float inv_perp_dir = 1.0 / perp_dir;
-
-        //  neg     pos
-        //  |        |
-        //  |        |
-        // vmin    vmax
-        // hit point on the positive/negative plane
-        // must also be within the AABB boundary.
-        const float t_org = ray.origin(i);
-
-        for(const bool is_positive : {false, true}) {
-            // Check whether ray can intersect the current side of the plane.
-            const float t = ((is_positive ? vmax(i) : vmin(i)) - t_org) * inv_perp_dir;
-            if(t <= 0) {
-                continue;
-            }
-            // Infinite plane intersects the ray, so proceed to boundary check.
-            Eigen::Vector4f normal = Eigen::Vector4f::Zero();
-            normal(i) = (is_positive ? 1 : -1);
-            bool within_boundary = true;
-            const Eigen::Vector4f pos_cand = ray.at(t);
-            for(const int axis : boost::irange(0, 4)) {
-                // Avoid instability.
-                if(i == axis) {
-                    continue;
-                }
-                within_boundary &= (vmin(axis) <= pos_cand(axis));
-                within_boundary &= (pos_cand(axis) <= vmax(axis));
-            }
-            if(within_boundary && t < min_t_n.first) {
-                min_t_n = std::make_pair(t, normal);
-            }
-        }
-    }
-    assert(min_t_n.first > 0);
-
-    if(min_t_n.first == std::numeric_limits<float>::max()) {
+boost::optional<RayHit> AABB::intersectHit(const Ray& ray) const {
+    const auto t = slabDistance(
+        vmin, vmax, ray.origin, ray.direction, ray.t_min, ray.t_max);
+    if(!t) {
         return boost::none;
-    } else {
-        return MicroGeometry(ray.at(min_t_n.first), min_t_n.second);
     }
+    return RayHit(*t, Eigen::Vector3f::Zero());
+}
+
+MicroGeometry AABB::microGeometry(const Ray& ray, const RayHit& hit) const {
+    const Eigen::Vector4f pos = ray.at(hit.t);
+    return MicroGeometry(pos, faceNormal(vmin, vmax, pos));
 }
 
 AABB AABB::bounds() const {
@@ -207,6 +200,22 @@ Eigen::Vector4f AABB::center() const {
     return (vmin + vmax) / 2;
 }
 
+float AABB::volume() const {
+    const Eigen::Vector4f s = size();
+    return s(0) * s(1) * s(2) * s(3);
+}
+
+float AABB::surface() const {
+    // 8 cells, 2 for each axis. A cell perpendicular to an axis
+    // is spanned by the remaining 3 axes.
+    const Eigen::Vector4f s = size();
+    return 2 * (
+        s(1) * s(2) * s(3) +
+        s(0) * s(2) * s(3) +
+        s(0) * s(1) * s(3) +
+        s(0) * s(1) * s(2));
+}
+
 Eigen::Vector4f AABB::min() const {
     return vmin;
 
@@ -217,131 +226,117 @@ Eigen::Vector4f AABB::max() const {
 }
 
 
-OBB::OBB(const Pose& pose, const Eigen::Vector4f& size) :
-        pose(pose), half_size(size / 2) {
+OBB::OBB(const Pose& pose, const Eigen::Vector4f& size) : pose(pose) {
     if(size(0) <= 0 || size(1) <= 0 || size(2) <= 0 || size(3) <= 0) {
         throw std::invalid_argument("OBB size must be positive");
     }
-    world_to_local = pose.asInverseAffine();
-}
-
-boost::optional<MicroGeometry>
-        OBB::intersect(const Ray& ray) const {
-    const Ray ray_local(
-        world_to_local * ray.origin,
-        world_to_local.rotation() * ray.direction);
-
-    // AABB is an intersection of 8 half-spaces, 2 for
-    // each axis.
-    std::pair<float, Eigen::Vector4f> min_t_n;
-    min_t_n.first = std::numeric_limits<float>::max();
-    for(int i : boost::irange(0, 4)) {
-        // Check two planes' t. (positive and negative)
-        const float perp_dir = ray_local.direction(i);
-        if(perp_dir == 0) {
-            continue;
-        }
-        const float inv_perp_dir = 1.0 / perp_dir;
-
-        //  neg     pos
-        //  |        |
-        //  |        |
-        // vmin    vmax
-        // hit point on the positive/negative plane
-        // must also be within the AABB boundary.
-        const float t_org = ray_local.origin(i);
+    const auto world_to_local = pose.asInverseAffine();
+    data.rotation = world_to_local.linear();
+    data.translation = world_to_local.translation();
+    data.half_size = size / 2;
+}
 
-        for(const bool is_positive : {false, true}) {
-            // Check whether ray can intersect the current side of the plane.
-            const float t = ((is_positive ? half_size(i) : -half_size(i)) - t_org) * inv_perp_dir;
-            if(t <= 0) {
-                continue;
-            }
-            // Infinite plane intersects the ray, so proceed to boundary check.
-            Eigen::Vector4f normal = Eigen::Vector4f::Zero();
-            normal(i) = (is_positive ? 1 : -1);
-            bool within_boundary = true;
-            const Eigen::Vector4f pos_cand = ray_local.at(t);
-            for(const int axis : boost::irange(0, 4)) {
-                // Avoid instability.
-                if(i == axis) {
-                    continue;
-                }
-                within_boundary &= (std::abs(pos_cand(axis)) <= half_size(axis));
-            }
-            if(within_boundary && t < min_t_n.first) {
-                min_t_n = std::make_pair(t, normal);
-            }
-        }
-    }
-    assert(min_t_n.first > 0);
+boost::optional<RayHit> OBB::intersectHit(const Ray& ray) const {
+    return data.intersect(ray);
+}
 
-    if(min_t_n.first == std::numeric_limits<float>::max()) {
-        return boost::none;
-    } else {
-        return MicroGeometry(ray.at(min_t_n.first),
-            pose.asAffine().rotation() * min_t_n.second);
-    }
+MicroGeometry OBB::microGeometry(const Ray& ray, const RayHit& hit) const {
+    const Eigen::Vector4f pos = ray.at(hit.t);
+    const Eigen::Vector4f normal_local = faceNormal(
+        -data.half_size, data.half_size,
+        data.rotation * pos + data.translation);
+    return MicroGeometry(pos, pose.asAffine().linear() * normal_local);
 }
 
 AABB OBB::bounds() const {
-    std::vector<Eigen::Vector4f> vs;
-    vs.reserve(16);
-    for(const int i_vertex : boost::irange(0, 16)) {
-        const Eigen::Vector4f vertex_local(
-            (i_vertex & 0b0001) ? -half_size(0) : half_size(0),
-            (i_vertex & 0b0010) ? -half_size(1) : half_size(1),
-            (i_vertex & 0b0100) ? -half_size(2) : half_size(2),
-            (i_vertex & 0b1000) ? -half_size(3) : half_size(3));
-        vs.emplace_back(pose.asAffine() * vertex_local);
-    }
-    return AABB::fromConvexVertices(vs);
+    // Extent along each world axis is the sum of |projections| of
+    // local half axes, which is same as taking AABB of all 16 vertices.
+    const auto local_to_world = pose.asAffine();
+    const Eigen::Vector4f extent =
+        local_to_world.linear().cwiseAbs() * data.half_size;
+    const Eigen::Vector4f center = local_to_world.translation();
+    return AABB(center - extent, center + extent);
 }
 
-
-Tetrahedron::Tetrahedron(
-        const std::array<Eigen::Vector4f, 4>& vertices) :
-        vertices(vertices) {
+const OBBData& OBB::getData() const {
+    return data;
 }
 
-boost::optional<MicroGeometry>
-        Tetrahedron::intersect(const Ray& ray) const {
-    // v0 + (v1 - v0)t1 + (v2 - v0)t2 + (v3 - v0)t3 = o + dt
-    // reorganaize it.
-    // |v1-v0 v2-v0 v3-v0 -d| (t1 t2 t3 t)^t = o - v0
+
+TetrahedronBasis::TetrahedronBasis(
+        const std::array<Eigen::Vector4f, 4>& vertices) {
+    _normal = cross(
+        vertices[1] - vertices[0],
+        vertices[2] - vertices[0],
+        vertices[3] - vertices[0]);
+    // norm is 6x volume; compare it with the volume of the box spanned
+    // by the edges, so that the check doesn't depend on scale.
+    const float norm = _normal.norm();
+    const float edges =
+        (vertices[1] - vertices[0]).norm() *
+        (vertices[2] - vertices[0]).norm() *
+        (vertices[3] - vertices[0]).norm();
+    if(norm <= 1e-5 * edges) {
+        // Leave everything zero, so that perp_dir is always 0.
+        _normal = Eigen::Vector4f::Zero();
+        d = 0;
+        for(auto& b : basis) {
+            b = Eigen::Vector4f::Zero();
+        }
+        offset = Eigen::Vector3f::Zero();
+        return;
+    }
+    _normal /= norm;
+    d = _normal.dot(vertices[0]);
+    // Rows of inverse of |v1-v0 v2-v0 v3-v0 n| are dual to the columns;
+    // first 3 rows give barycentric coordinates, and are
+    // orthogonal to n (so off-plane offsets don't matter).
     Eigen::Matrix4f m;
-    Eigen::Vector4f v;
     m.col(0) = vertices[1] - vertices[0];
     m.col(1) = vertices[2] - vertices[0];
     m.col(2) = vertices[3] - vertices[0];
-    m.col(3) = -ray.direction;
-    v = ray.origin - vertices[0];
-    if(std::abs(m.determinant()) < 1e-6) {
-        // degenerate -> ray is parallel to tetrahedron, or
-        // tetrahedron itself is degenerate.
-        return boost::none;
-    }
-    // Reject false intersections.
-    const Eigen::Vector4f params = m.inverse() * v;
-    for(const int i : boost::irange(0, 4)) {
-        if(params(i) < 0) {
-            return boost::none;
-        }
-    }
-    if(params(0) + params(1) + params(2) > 1) {
-        return boost::none;
-    }
-    Eigen::Vector4f n = cross(
-        vertices[1] - vertices[0],
-        vertices[2] - vertices[0],
-        vertices[3] - vertices[0]);
-    n.normalize();
-    if(ray.direction.dot(n) > 0) {
-        n *= -1;
+    m.col(3) = _normal;
+    const Eigen::Matrix4f m_inv = m.inverse();
+    for(const int i : boost::irange(0, 3)) {
+        basis[i] = m_inv.row(i).transpose();
+        offset(i) = -basis[i].dot(vertices[0]);
     }
+}
+
+Eigen::Vector4f TetrahedronBasis::normal() const {
+    return _normal;
+}
+
+float TetrahedronBasis::distance() const {
+    return d;
+}
+
+Eigen::Vector4f TetrahedronBasis::barycentricBasis(int i) const {
+    return basis[i];
+}
+
+float TetrahedronBasis::barycentricOffset(int i) const {
+    return offset(i);
+}
+
+
+Tetrahedron::Tetrahedron(
+        const std::array<Eigen::Vector4f, 4>& vertices) :
+        vertices(vertices), basis(vertices) {
+}
+
+MicroGeometry Tetrahedron::microGeometry(
+        const Ray& ray, const RayHit& hit) const {
+    // Face the ray.
+    const Eigen::Vector4f normal = basis.normal();
     return MicroGeometry(
-        ray.at(params(3)),
-        n);
+        ray.at(hit.t),
+        (ray.direction.dot(normal) > 0) ?
+            static_cast<Eigen::Vector4f>(-normal) : normal);
+}
+
+boost::optional<RayHit> Tetrahedron::intersectHit(const Ray& ray) const {
+    return basis.intersect(ray);
 }
 
 AABB Tetrahedron::bounds() const {
@@ -349,4 +344,8 @@ AABB Tetrahedron::bounds() const {
     return AABB::fromConvexVertices(vs);
 }
 
+const TetrahedronBasis& Tetrahedron::getBasis() const {
+    return basis;
+}
+
 };
@@ -6,7 +6,10 @@
 // Remeber, all surface is 3-d and all volume is 4-d.
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <limits>
 
 #include <boost/optional.hpp>
 #include <Eigen/Dense>
@@ -37,13 +40,79 @@ private:
 };
 
 
+// A compact record of a ray hitting a Geometry.
+// Cheap enough to create for every candidate during traversal;
+// MicroGeometry is recovered from it only for the nearest one.
+class RayHit {
+public:
+    // Initialize with undef value.
+    RayHit();
+
+    RayHit(float t, const Eigen::Vector3f& uvw);
+
+    // Distance along the ray. (ray.at(pos) == t)
+    float t;
+    // Index of the hit primitive, assigned by whoever manages
+    // multiple primitives (e.g. Accel). -1 when unassigned.
+    int index;
+    // Index of the hit element within the Geometry
+    // (e.g. a tetrahedron of TetraMesh). 0 for single-element shapes.
+    int element;
+    // Parametric coordinates of the hit point. For Tetrahedron,
+    // barycentric coordinates of vertices 1, 2, 3. Zero for other shapes.
+    Eigen::Vector3f uvw;
+};
+
+
 class AABB;
 
 
+// Compact data of simple shapes. Ray tests are defined inline, so that
+// code that knows the shape type (e.g. PrimitiveStore) can inline them
+// instead of calling Geometry::intersectHit virtually.
+// Geometry classes below wrap them.
+struct SphereData {
+    Eigen::Vector4f center;
+    float radius;
+
+    boost::optional<RayHit> intersect(const Ray& ray) const;
+};
+
+struct DiscData {
+    Eigen::Vector4f center;
+    // Unit vector.
+    Eigen::Vector4f normal;
+    float radius;
+    float d;  // == normal.dot(center)
+
+    boost::optional<RayHit> intersect(const Ray& ray) const;
+};
+
+// [-half_size, half_size] in the local coordinates.
+struct OBBData {
+    // World to local transform: rotation * p + translation
+    Eigen::Matrix4f rotation;
+    Eigen::Vector4f translation;
+    Eigen::Vector4f half_size;
+
+    boost::optional<RayHit> intersect(const Ray& ray) const;
+};
+
+
 // Definition of shape in 4-d space.
 class Geometry {
 public:
-    virtual boost::optional<MicroGeometry> intersect(const Ray& ray) const = 0;
+    virtual ~Geometry() {}
+
+    // Returns the nearest hit in (ray.t_min, ray.t_max),
+    // without calculating normal.
+    virtual boost::optional<RayHit> intersectHit(const Ray& ray) const = 0;
+    // Surface properties at hit, which was returned by intersectHit(ray).
+    virtual MicroGeometry microGeometry(
+        const Ray& ray, const RayHit& hit) const = 0;
+    // intersectHit followed by microGeometry.
+    boost::optional<MicroGeometry> intersect(const Ray& ray) const;
+
     virtual AABB bounds() const = 0;
 };
 
@@ -52,13 +121,16 @@ class Sphere : public Geometry {
 public:
     Sphere(Eigen::Vector4f center, float radius);
 
-    boost::optional<MicroGeometry>
-        intersect(const Ray& ray) const override;
+    boost::optional<RayHit>
+        intersectHit(const Ray& ray) const override;
+    MicroGeometry microGeometry(
+        const Ray& ray, const RayHit& hit) const override;
 
     AABB bounds() const override;
+
+    const SphereData& getData() const;
 private:
-    const Eigen::Vector4f center;
-    const float radius;
+    SphereData data;
 };
 
 
@@ -71,15 +143,16 @@ public:
         const Eigen::Vector4f& center,
         const Eigen::Vector4f& normal, float radius);
 
-    boost::optional<MicroGeometry>
-        intersect(const Ray& ray) const override;
+    boost::optional<RayHit>
+        intersectHit(const Ray& ray) const override;
+    MicroGeometry microGeometry(
+        const Ray& ray, const RayHit& hit) const override;
 
     AABB bounds() const override;
+
+    const DiscData& getData() const;
 private:
-    Eigen::Vector4f center;
-    Eigen::Vector4f normal;
-    float radius;
-    float d;  // == normal.dot(center)
+    DiscData data;
 };
 
 
@@ -93,8 +166,10 @@ public:
     // Create an AABB from vertices of a convex.
     static AABB fromConvexVertices(const std::vector<Eigen::Vector4f>& vertices);
 
-    boost::optional<MicroGeometry>
-        intersect(const Ray& ray) const override;
+    boost::optional<RayHit>
+        intersectHit(const Ray& ray) const override;
+    MicroGeometry microGeometry(
+        const Ray& ray, const RayHit& hit) const override;
 
     AABB bounds() const override;
 
@@ -105,6 +180,12 @@ public:
     Eigen::Vector4f size() const;
     Eigen::Vector4f center() const;
 
+    // 4-d volume enclosed by this AABB.
+    float volume() const;
+    // 3-d volume of the boundary. This is what "surface area"
+    // means in 4-d SAH.
+    float surface() const;
+
     Eigen::Vector4f min() const;
     Eigen::Vector4f max() const;
 private:
@@ -117,14 +198,49 @@ class OBB : public Geometry {
 public:
     OBB(const Pose& pose, const Eigen::Vector4f& size);
 
-    boost::optional<MicroGeometry>
-        intersect(const Ray& ray) const override;
+    boost::optional<RayHit>
+        intersectHit(const Ray& ray) const override;
+    MicroGeometry microGeometry(
+        const Ray& ray, const RayHit& hit) const override;
 
     AABB bounds() const override;
+
+    const OBBData& getData() const;
 private:
     Pose pose;
-    Eigen::Transform<float, 4, Eigen::Affine> world_to_local;
-    Eigen::Vector4f half_size;
+    OBBData data;
+};
+
+
+// Data of a tetrahedron precomputed for fast ray intersection:
+// its hyperplane, and a basis that maps a point on the hyperplane to
+// barycentric coordinates. A ray test costs only a few dot products.
+class TetrahedronBasis {
+public:
+    TetrahedronBasis(const std::array<Eigen::Vector4f, 4>& vertices);
+
+    // Returns hit in (ray.t_min, ray.t_max), with barycentric
+    // coordinates of vertices 1, 2, 3.
+    // Degenerate tetrahedra (whose volume is negligible relative to
+    // their edges, at any scale) never intersect.
+    boost::optional<RayHit> intersect(const Ray& ray) const;
+
+    // Unit normal of the hyperplane, with arbitrary sign.
+    // Zero when degenerate.
+    Eigen::Vector4f normal() const;
+    // Hyperplane is normal().dot(p) == distance().
+    float distance() const;
+    // Barycentric coordinate i (of vertex i + 1) of p on the hyperplane
+    // is barycentricBasis(i).dot(p) + barycentricOffset(i).
+    Eigen::Vector4f barycentricBasis(int i) const;
+    float barycentricOffset(int i) const;
+private:
+    // Hyperplane: normal.dot(p) == d
+    Eigen::Vector4f _normal;
+    float d;
+    // Barycentric coordinate i of p is basis[i].dot(p) + offset(i).
+    std::array<Eigen::Vector4f, 3> basis;
+    Eigen::Vector3f offset;
 };
 
 
@@ -133,12 +249,120 @@ class Tetrahedron : public Geometry {
 public:
     Tetrahedron(const std::array<Eigen::Vector4f, 4>& vertices);
 
-    boost::optional<MicroGeometry>
-        intersect(const Ray& ray) const override;
+    boost::optional<RayHit>
+        intersectHit(const Ray& ray) const override;
+    MicroGeometry microGeometry(
+        const Ray& ray, const RayHit& hit) const override;
 
     AABB bounds() const override;
+
+    const TetrahedronBasis& getBasis() const;
 private:
     std::array<Eigen::Vector4f, 4> vertices;
+    TetrahedronBasis basis;
 };
 
+
+// Distance to the nearest boundary of [vmin, vmax] in (t_min, t_max).
+// When the ray starts inside, it's the exiting point.
+inline boost::optional<float> slabDistance(
+        const Eigen::Vector4f& vmin, const Eigen::Vector4f& vmax,
+        const Eigen::Vector4f& origin, const Eigen::Vector4f& direction,
+        float t_min, float t_max) {
+    float t_near = std::numeric_limits<float>::lowest();
+    float t_far = std::numeric_limits<float>::max();
+    for(int axis = 0; axis < 4; axis++) {
+        const float perp_dir = direction(axis);
+        if(perp_dir == 0) {
+            if(origin(axis) < vmin(axis) || vmax(axis) < origin(axis)) {
+                return boost::none;
+            }
+            continue;
+        }
+        const float inv_perp_dir = 1.0 / perp_dir;
+        float t0 = (vmin(axis) - origin(axis)) * inv_perp_dir;
+        float t1 = (vmax(axis) - origin(axis)) * inv_perp_dir;
+        if(t0 > t1) {
+            std::swap(t0, t1);
+        }
+        t_near = std::max(t_near, t0);
+        t_far = std::min(t_far, t1);
+    }
+    if(t_near > t_far) {
+        return boost::none;
+    }
+    const float t = (t_near > t_min) ? t_near : t_far;
+    if(t <= t_min || t >= t_max) {
+        return boost::none;
+    }
+    return t;
+}
+
+inline boost::optional<RayHit> SphereData::intersect(const Ray& ray) const {
+    const Eigen::Vector4f delta = ray.origin - center;
+    // turn into a quadratic equation at^2+bt+c=0
+    const float a = ray.direction.squaredNorm();
+    const float b = 2 * delta.dot(ray.direction);
+    const float c = delta.squaredNorm() - radius * radius;
+    const float det = b * b - 4 * a * c;
+    if(det < 0) {
+        return boost::none;
+    }
+    const float t0 = (-b - std::sqrt(det)) / (2 * a);
+    const float t1 = (-b + std::sqrt(det)) / (2 * a);
+    const float t = (t0 > ray.t_min) ? t0 : t1;
+    if(t <= ray.t_min || t >= ray.t_max) {
+        return boost::none;
+    }
+    return RayHit(t, Eigen::Vector3f::Zero());
+}
+
+inline boost::optional<RayHit> DiscData::intersect(const Ray& ray) const {
+    const float perp_dir = normal.dot(ray.direction);
+    if(perp_dir == 0) {
+        return boost::none;
+    }
+    const float t = (d - normal.dot(ray.origin)) / perp_dir;
+    if(t <= ray.t_min || t >= ray.t_max) {
+        return boost::none;
+    }
+    if((ray.at(t) - center).squaredNorm() > radius * radius) {
+        return boost::none;
+    }
+    return RayHit(t, Eigen::Vector3f::Zero());
+}
+
+inline boost::optional<RayHit> OBBData::intersect(const Ray& ray) const {
+    // Rigid transform doesn't change distance along the ray.
+    const auto t = slabDistance(-half_size, half_size,
+        rotation * ray.origin + translation,
+        rotation * ray.direction,
+        ray.t_min, ray.t_max);
+    if(!t) {
+        return boost::none;
+    }
+    return RayHit(*t, Eigen::Vector3f::Zero());
+}
+
+inline boost::optional<RayHit> TetrahedronBasis::intersect(
+        const Ray& ray) const {
+    const float perp_dir = _normal.dot(ray.direction);
+    if(perp_dir == 0) {
+        return boost::none;
+    }
+    const float t = (d - _normal.dot(ray.origin)) / perp_dir;
+    if(t <= ray.t_min || t >= ray.t_max) {
+        return boost::none;
+    }
+    const Eigen::Vector4f p = ray.at(t);
+    const Eigen::Vector3f uvw(
+        basis[0].dot(p) + offset(0),
+        basis[1].dot(p) + offset(1),
+        basis[2].dot(p) + offset(2));
+    if(uvw.minCoeff() < 0 || uvw.sum() > 1) {
+        return boost::none;
+    }
+    return RayHit(t, uvw);
+}
+
 }  // namespace
@@ -1,7 +1,10 @@
 #include "geometry.h"
 
+#include <array>
 #include <cmath>
+#include <memory>
 #include <random>
+#include <vector>
 
 #include <boost/range/irange.hpp>
 #include <gtest/gtest.h>
@@ -72,6 +75,14 @@ TEST(AABB, IntersectionOutGoing) {
     }
 }
 
+TEST(AABB, Measures) {
+    const pentatope::AABB aabb(
+        Eigen::Vector4f(0, 0, 0, 0), Eigen::Vector4f(1, 2, 3, 4));
+    EXPECT_FLOAT_EQ(24, aabb.volume());
+    // 2 * (2*3*4 + 1*3*4 + 1*2*4 + 1*2*3)
+    EXPECT_FLOAT_EQ(100, aabb.surface());
+}
+
 TEST(OBB, IntersectionOutGoing) {
     const pentatope::OBB obb(
         pentatope::Pose(),
@@ -177,6 +188,37 @@ TEST(OBB, IntersectionTranslated) {
 }
 
 
+TEST(OBB, BoundsContainVertices) {
+    // Rotate by 45 degrees in XY plane.
+    const float c = std::cos(pentatope::pi / 4);
+    Eigen::Matrix4f rot = Eigen::Matrix4f::Identity();
+    rot(0, 0) = c;
+    rot(0, 1) = -c;
+    rot(1, 0) = c;
+    rot(1, 1) = c;
+    const pentatope::Pose pose(rot, Eigen::Vector4f(1, 2, 3, 4));
+    const Eigen::Vector4f size(1, 2, 3, 4);
+    const pentatope::OBB obb(pose, size);
+
+    const auto aabb = obb.bounds();
+    for(const int i_vertex : boost::irange(0, 16)) {
+        const Eigen::Vector4f vertex_local(
+            (i_vertex & 0b0001) ? -0.5 : 0.5,
+            (i_vertex & 0b0010) ? -1 : 1,
+            (i_vertex & 0b0100) ? -1.5 : 1.5,
+            (i_vertex & 0b1000) ? -2 : 2);
+        const Eigen::Vector4f vertex = pose.asAffine() * vertex_local;
+        for(const int axis : boost::irange(0, 4)) {
+            EXPECT_GE(aabb.max()(axis) + 1e-5, vertex(axis));
+            EXPECT_LE(aabb.min()(axis) - 1e-5, vertex(axis));
+        }
+    }
+    // (0.5 + 1) * cos(45 deg)
+    EXPECT_NEAR(1 - 1.5 * c, aabb.min()(0), 1e-5);
+    EXPECT_NEAR(4 + 2, aabb.max()(3), 1e-5);
+}
+
+
 TEST(Disc, BoundsIsCorrect) {
     std::mt19937 rg;
 
@@ -205,3 +247,133 @@ TEST(Disc, BoundsIsCorrect) {
         }
     }
 }
+
+TEST(Geometry, HitIsConsistentWithMicroGeometry) {
+    std::mt19937 rg;
+    const auto objs = arbitraryObjects(rg, 1000);
+    // Shapes that arbitraryObjects doesn't make.
+    std::vector<std::unique_ptr<pentatope::Geometry>> geoms;
+    geoms.emplace_back(std::make_unique<pentatope::OBB>(
+        pentatope::Pose(), Eigen::Vector4f(50, 50, 50, 50)));
+    geoms.emplace_back(std::make_unique<pentatope::AABB>(
+        Eigen::Vector4f(-10, -20, -30, -40), Eigen::Vector4f(10, 20, 30, 40)));
+    geoms.emplace_back(std::make_unique<pentatope::Tetrahedron>(
+        std::array<Eigen::Vector4f, 4>({
+            Eigen::Vector4f(-50, -50, -50, 0),
+            Eigen::Vector4f(50, -50, -50, 0),
+            Eigen::Vector4f(0, 50, -50, 10),
+            Eigen::Vector4f(0, 0, 50, -10)})));
+
+    auto check = [](const pentatope::Geometry& geom, const pentatope::Ray& ray) {
+        const auto hit = geom.intersectHit(ray);
+        const auto isect = geom.intersect(ray);
+        EXPECT_EQ(static_cast<bool>(hit), static_cast<bool>(isect));
+        if(!hit) {
+            return 0;
+        }
+        EXPECT_GT(hit->t, 0);
+        EXPECT_EQ(-1, hit->index);
+        const auto micro = geom.microGeometry(ray, *hit);
+        EXPECT_NEAR(hit->t, ray.at(micro.pos()), 1e-3);
+        EXPECT_NEAR(1, micro.normal().norm(), 1e-3);
+        return 1;
+    };
+    std::vector<int> n_hits(geoms.size(), 0);
+    for(const int i : boost::irange(0, 1000)) {
+        const auto ray = arbitraryRay(rg);
+        check(*objs[i].first, ray);
+        for(const int j : boost::irange(0, static_cast<int>(geoms.size()))) {
+            n_hits[j] += check(*geoms[j], ray);
+        }
+    }
+    for(const int n : n_hits) {
+        EXPECT_LT(0, n);
+    }
+}
+
+TEST(Geometry, HitIsWithinRayInterval) {
+    std::mt19937 rg;
+    const auto objs = arbitraryObjects(rg, 1000);
+    for(const int i : boost::irange(0, 1000)) {
+        const auto ray = arbitraryRay(rg);
+        const auto hit = objs[i].first->intersectHit(ray);
+        if(!hit) {
+            continue;
+        }
+        const pentatope::Ray before(
+            ray.origin, ray.direction, 0, hit->t * 0.99f);
+        EXPECT_FALSE(objs[i].first->intersectHit(before));
+        const pentatope::Ray around(
+            ray.origin, ray.direction, hit->t * 0.99f, hit->t * 1.01f);
+        const auto hit_around = objs[i].first->intersectHit(around);
+        ASSERT_TRUE(hit_around);
+        EXPECT_NEAR(hit->t, hit_around->t, 1e-3);
+        // Hits beyond t_min, if any, are farther than the original one.
+        const pentatope::Ray after(
+            ray.origin, ray.direction, hit->t * 1.01f);
+        const auto hit_after = objs[i].first->intersectHit(after);
+        if(hit_after) {
+            EXPECT_GT(hit_after->t, hit->t * 1.01f);
+        }
+    }
+}
+
+TEST(Tetrahedron, HitHasBarycentricCoordinates) {
+    std::mt19937 rg;
+    const std::array<Eigen::Vector4f, 4> vertices = {
+        Eigen::Vector4f(-50, -50, -50, 0),
+        Eigen::Vector4f(50, -50, -50, 0),
+        Eigen::Vector4f(0, 50, -50, 10),
+        Eigen::Vector4f(0, 0, 50, -10)};
+    const pentatope::Tetrahedron tetra(vertices);
+    std::uniform_real_distribution<float> param(0, 1);
+    for(const int i : boost::irange(0, 100)) {
+        // Aim at a random point inside the tetrahedron.
+        Eigen::Vector3f uvw(param(rg), param(rg), param(rg));
+        uvw /= std::max(1.0f, uvw.sum() * 1.01f);
+        const Eigen::Vector4f target =
+            vertices[0] +
+            (vertices[1] - vertices[0]) * uvw(0) +
+            (vertices[2] - vertices[0]) * uvw(1) +
+            (vertices[3] - vertices[0]) * uvw(2);
+        const Eigen::Vector4f origin = arbitraryRay(rg).origin;
+        const pentatope::Ray ray(origin, (target - origin).normalized());
+
+        const auto hit = tetra.intersectHit(ray);
+        ASSERT_TRUE(static_cast<bool>(hit));
+        EXPECT_NEAR((target - origin).norm(), hit->t, 1e-2);
+        EXPECT_NEAR(0, (uvw - hit->uvw).norm(), 1e-3);
+    }
+}
+
+TEST(Tetrahedron, DegeneracyDoesNotDependOnScale) {
+    const std::array<Eigen::Vector4f, 4> unit = {
+        Eigen::Vector4f(0, 0, 0, 0),
+        Eigen::Vector4f(1, 0, 0, 0),
+        Eigen::Vector4f(0, 1, 0, 0),
+        Eigen::Vector4f(0, 0, 1, 0)};
+    // The last vertex is almost in the plane of the others.
+    const std::array<Eigen::Vector4f, 4> flat = {
+        Eigen::Vector4f(0, 0, 0, 0),
+        Eigen::Vector4f(1, 0, 0, 0),
+        Eigen::Vector4f(0, 1, 0, 0),
+        Eigen::Vector4f(1, 1, 1e-7, 0)};
+    for(const float scale : {1e-3f, 1.0f, 1e3f}) {
+        std::array<Eigen::Vector4f, 4> small_or_large;
+        std::array<Eigen::Vector4f, 4> flat_scaled;
+        for(const int i : boost::irange(0, 4)) {
+            small_or_large[i] = unit[i] * scale;
+            flat_scaled[i] = flat[i] * scale;
+        }
+        const pentatope::TetrahedronBasis valid(small_or_large);
+        EXPECT_NEAR(1, valid.normal().norm(), 1e-5);
+        const pentatope::Ray ray(
+            Eigen::Vector4f(0.2, 0.2, 0.2, -1) * scale,
+            Eigen::Vector4f(0, 0, 0, 1));
+        EXPECT_TRUE(static_cast<bool>(valid.intersect(ray)));
+
+        const pentatope::TetrahedronBasis degenerate(flat_scaled);
+        EXPECT_EQ(Eigen::Vector4f::Zero(), degenerate.normal());
+        EXPECT_FALSE(static_cast<bool>(degenerate.intersect(ray)));
+    }
+}
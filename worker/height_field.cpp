@@ -0,0 +1,222 @@
+#include "height_field.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include <boost/range/irange.hpp>
+
+#include <slab_ray.h>
+
+namespace pentatope {
+
+namespace {
+
+// Corners (dx, dy, dz) of tetrahedra that fill a unit cube without gaps.
+// x is flipped in cubes of odd parity, so that diagonals of faces
+// shared by neighboring cubes agree.
+// See https://github.com/xanxys/pentatope/issues/30
+const int cell_tetrahedra[5][4][3] = {
+    {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {1, 0, 1}},
+    {{0, 0, 0}, {1, 1, 0}, {0, 1, 0}, {0, 1, 1}},
+    {{1, 0, 1}, {0, 1, 1}, {0, 0, 1}, {0, 0, 0}},
+    {{1, 0, 1}, {1, 1, 1}, {0, 1, 1}, {1, 1, 0}},
+    {{1, 0, 1}, {0, 0, 0}, {1, 1, 0}, {0, 1, 1}}
+};
+
+}  // namespace
+
+const int HeightField::tetrahedra_per_cell;
+
+const int64_t HeightField::max_samples =
+    std::numeric_limits<int>::max() / HeightField::tetrahedra_per_cell;
+
+HeightField::HeightField(
+        const Eigen::Vector3f& xyz_min, const Eigen::Vector3f& xyz_max,
+        const Eigen::Vector3i& resolution, const std::vector<float>& heights) :
+        xyz_min(xyz_min), resolution(resolution), heights(heights) {
+    if(resolution.minCoeff() < 2) {
+        throw std::invalid_argument(
+            "HeightField requires at least 2 samples along each axis");
+    }
+    const int64_t n_samples = static_cast<int64_t>(resolution(0)) *
+        resolution(1) * resolution(2);
+    if(n_samples > max_samples) {
+        throw std::invalid_argument("HeightField has too many samples");
+    }
+    if(static_cast<int64_t>(heights.size()) != n_samples) {
+        throw std::invalid_argument(
+            "HeightField heights must have a sample for each grid point");
+    }
+    if(!(xyz_min.array() < xyz_max.array()).all()) {
+        throw std::invalid_argument("HeightField bounds must be non-empty");
+    }
+    cell_size = (xyz_max - xyz_min).cwiseQuotient(
+        (resolution - Eigen::Vector3i::Ones()).cast<float>());
+
+    const Eigen::Vector3i n_cells = resolution - Eigen::Vector3i::Ones();
+    cell_bounds.resize(n_cells.prod());
+    for(const int ix : boost::irange(0, n_cells(0))) {
+        for(const int iy : boost::irange(0, n_cells(1))) {
+            for(const int iz : boost::irange(0, n_cells(2))) {
+                CellBounds bounds;
+                bounds.w_min = std::numeric_limits<float>::max();
+                bounds.w_max = std::numeric_limits<float>::lowest();
+                for(const int corner : boost::irange(0, 8)) {
+                    const float w = samplePoint(
+                        ix + (corner & 1),
+                        iy + ((corner >> 1) & 1),
+                        iz + ((corner >> 2) & 1))(3);
+                    bounds.w_min = std::min(bounds.w_min, w);
+                    bounds.w_max = std::max(bounds.w_max, w);
+                }
+                cell_bounds[cellIndex(Eigen::Vector3i(ix, iy, iz))] = bounds;
+            }
+        }
+    }
+
+    const auto w_range = std::minmax_element(heights.begin(), heights.end());
+    vmin << xyz_min, *w_range.first;
+    vmax << xyz_max, *w_range.second;
+}
+
+boost::optional<RayHit> HeightField::intersectHit(const Ray& ray) const {
+    const SlabRay slab_ray(ray);
+    float t_entry;
+    if(!slab_ray.intersect(vmin, vmax, ray.t_max, t_entry)) {
+        return boost::none;
+    }
+    // Set up 3-d DDA from the entering point, same as GridAccel.
+    const Eigen::Vector4f pos = ray.at(t_entry);
+    const Eigen::Vector3i n_cells = resolution - Eigen::Vector3i::Ones();
+    Eigen::Vector3i cell;
+    Eigen::Vector3i step;
+    Eigen::Vector3i cell_out;
+    Eigen::Vector3f t_next;
+    Eigen::Vector3f t_delta;
+    for(const int axis : boost::irange(0, 3)) {
+        cell(axis) = std::min(n_cells(axis) - 1, std::max(0,
+            static_cast<int>(std::floor(
+                (pos(axis) - xyz_min(axis)) / cell_size(axis)))));
+        const float dir = ray.direction(axis);
+        if(dir > 0) {
+            step(axis) = 1;
+            cell_out(axis) = n_cells(axis);
+            t_next(axis) = (xyz_min(axis) + (cell(axis) + 1) * cell_size(axis) -
+                ray.origin(axis)) / dir;
+            t_delta(axis) = cell_size(axis) / dir;
+        } else if(dir < 0) {
+            step(axis) = -1;
+            cell_out(axis) = -1;
+            t_next(axis) = (xyz_min(axis) + cell(axis) * cell_size(axis) -
+                ray.origin(axis)) / dir;
+            t_delta(axis) = -cell_size(axis) / dir;
+        } else {
+            step(axis) = 0;
+            cell_out(axis) = -1;
+            t_next(axis) = std::numeric_limits<float>::infinity();
+            t_delta(axis) = 0;
+        }
+    }
+
+    float t_enter = t_entry;
+    while(true) {
+        int axis;
+        const float t_exit = std::min(t_next.minCoeff(&axis), ray.t_max);
+        // w range of the ray within this cell.
+        float w0 = ray.origin(3);
+        float w1 = ray.origin(3);
+        if(ray.direction(3) != 0) {
+            w0 += ray.direction(3) * t_enter;
+            w1 += ray.direction(3) * t_exit;
+        }
+        const CellBounds& bounds = cell_bounds[cellIndex(cell)];
+        if(std::max(w0, w1) >= bounds.w_min &&
+                std::min(w0, w1) <= bounds.w_max) {
+            // Tetrahedra don't stick out of the cell, so the first hit
+            // cell contains the nearest hit.
+            const auto hit = intersectCell(cell, ray);
+            if(hit) {
+                return hit;
+            }
+        }
+        if(t_next(axis) >= ray.t_max) {
+            return boost::none;
+        }
+        cell(axis) += step(axis);
+        if(cell(axis) == cell_out(axis)) {
+            return boost::none;
+        }
+        t_enter = t_next(axis);
+        t_next(axis) += t_delta(axis);
+    }
+}
+
+MicroGeometry HeightField::microGeometry(
+        const Ray& ray, const RayHit& hit) const {
+    // Face the ray, same as Tetrahedron.
+    const Eigen::Vector4f normal =
+        TetrahedronBasis(getTetrahedron(hit.element)).normal();
+    return MicroGeometry(
+        ray.at(hit.t),
+        (ray.direction.dot(normal) > 0) ?
+            static_cast<Eigen::Vector4f>(-normal) : normal);
+}
+
+AABB HeightField::bounds() const {
+    return AABB(vmin, vmax);
+}
+
+int HeightField::size() const {
+    return cell_bounds.size() * tetrahedra_per_cell;
+}
+
+std::array<Eigen::Vector4f, 4> HeightField::getTetrahedron(int i) const {
+    const Eigen::Vector3i n_cells = resolution - Eigen::Vector3i::Ones();
+    const int index = i / tetrahedra_per_cell;
+    const int ix = index / (n_cells(1) * n_cells(2));
+    const int iy = (index / n_cells(2)) % n_cells(1);
+    const int iz = index % n_cells(2);
+    const int parity = (ix + iy + iz) % 2;
+    const auto& corners = cell_tetrahedra[i % tetrahedra_per_cell];
+    std::array<Eigen::Vector4f, 4> vertices;
+    for(const int j : boost::irange(0, 4)) {
+        vertices[j] = samplePoint(
+            ix + (corners[j][0] ^ parity),
+            iy + corners[j][1],
+            iz + corners[j][2]);
+    }
+    return vertices;
+}
+
+int HeightField::cellIndex(const Eigen::Vector3i& cell) const {
+    return (cell(0) * (resolution(1) - 1) + cell(1)) * (resolution(2) - 1) +
+        cell(2);
+}
+
+Eigen::Vector4f HeightField::samplePoint(int ix, int iy, int iz) const {
+    return Eigen::Vector4f(
+        xyz_min(0) + ix * cell_size(0),
+        xyz_min(1) + iy * cell_size(1),
+        xyz_min(2) + iz * cell_size(2),
+        heights[(ix * resolution(1) + iy) * resolution(2) + iz]);
+}
+
+boost::optional<RayHit> HeightField::intersectCell(
+        const Eigen::Vector3i& cell, const Ray& ray) const {
+    const int first = cellIndex(cell) * tetrahedra_per_cell;
+    boost::optional<RayHit> hit_nearest;
+    Ray query(ray);
+    for(const int i : boost::irange(first, first + tetrahedra_per_cell)) {
+        auto hit = TetrahedronBasis(getTetrahedron(i)).intersect(query);
+        if(hit) {
+            hit->element = i;
+            hit_nearest = hit;
+            query.t_max = hit->t;
+        }
+    }
+    return hit_nearest;
+}
+
+}  // namespace
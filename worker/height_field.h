@@ -0,0 +1,76 @@
+// A terrain-like surface w = f(x, y, z), stored as samples on a grid
+// instead of explicit tetrahedra.
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <boost/optional.hpp>
+#include <Eigen/Dense>
+
+#include <geometry.h>
+#include <space.h>
+
+namespace pentatope {
+
+// Heights sampled on a regular 3-d grid spanning [xyz_min, xyz_max].
+// Each cell between 8 neighboring samples is split into 5 tetrahedra,
+// which are only created when a ray visits the cell. Rays walk cells
+// by 3-d DDA, and skip cells whose w range they don't overlap.
+// Stores a float per sample, plus w range of each cell.
+// RayHit::element is 5 * (index of the cell) + (tetrahedron in the cell).
+class HeightField : public Geometry {
+public:
+    // Largest number of samples, so that RayHit::element fits in int.
+    static const int64_t max_samples;
+
+    // resolution is the number of samples along x, y, z.
+    // w of sample (ix, iy, iz) is heights[(ix * ny + iy) * nz + iz].
+    // Throws std::invalid_argument when resolution is less than 2
+    // along any axis, has more than max_samples samples in total,
+    // heights doesn't match resolution, or [xyz_min, xyz_max] is empty.
+    HeightField(
+        const Eigen::Vector3f& xyz_min, const Eigen::Vector3f& xyz_max,
+        const Eigen::Vector3i& resolution, const std::vector<float>& heights);
+
+    boost::optional<RayHit>
+        intersectHit(const Ray& ray) const override;
+    MicroGeometry microGeometry(
+        const Ray& ray, const RayHit& hit) const override;
+
+    AABB bounds() const override;
+
+    // Number of tetrahedra.
+    int size() const;
+
+    // Vertices of the i-th tetrahedron. (i == RayHit::element)
+    std::array<Eigen::Vector4f, 4> getTetrahedron(int i) const;
+private:
+    static const int tetrahedra_per_cell = 5;
+
+    struct CellBounds {
+        float w_min;
+        float w_max;
+    };
+
+    int cellIndex(const Eigen::Vector3i& cell) const;
+    Eigen::Vector4f samplePoint(int ix, int iy, int iz) const;
+
+    // Nearest hit with the tetrahedra of cell.
+    boost::optional<RayHit> intersectCell(
+        const Eigen::Vector3i& cell, const Ray& ray) const;
+
+    Eigen::Vector3f xyz_min;
+    Eigen::Vector3f cell_size;
+    // Number of samples along each axis. (cells are 1 less)
+    Eigen::Vector3i resolution;
+    std::vector<float> heights;
+    // Indexed by cellIndex.
+    std::vector<CellBounds> cell_bounds;
+    // Bounds of the whole field.
+    Eigen::Vector4f vmin;
+    Eigen::Vector4f vmax;
+};
+
+}  // namespace
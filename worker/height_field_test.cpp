@@ -0,0 +1,90 @@
+#include "height_field.h"
+
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/range/irange.hpp>
+#include <gtest/gtest.h>
+
+#include <arbitrary_test.h>
+#include <tetra_mesh.h>
+
+
+TEST(HeightField, RejectsInvalidGrid) {
+    const Eigen::Vector3f vmin(0, 0, 0);
+    const Eigen::Vector3f vmax(1, 1, 1);
+    EXPECT_THROW(
+        pentatope::HeightField(
+            vmin, vmax, Eigen::Vector3i(1, 2, 2), std::vector<float>(4)),
+        std::invalid_argument);
+    EXPECT_THROW(
+        pentatope::HeightField(
+            vmin, vmax, Eigen::Vector3i(2, 2, 2), std::vector<float>(7)),
+        std::invalid_argument);
+    EXPECT_THROW(
+        pentatope::HeightField(
+            vmax, vmin, Eigen::Vector3i(2, 2, 2), std::vector<float>(8)),
+        std::invalid_argument);
+    // Too many samples to index, even though each axis fits in int.
+    EXPECT_THROW(
+        pentatope::HeightField(
+            vmin, vmax, Eigen::Vector3i(100000, 100000, 100000),
+            std::vector<float>()),
+        std::invalid_argument);
+}
+
+TEST(HeightField, BehaveIdenticallyToTetraMesh) {
+    std::mt19937 rg;
+    std::uniform_real_distribution<float> height(-5, 5);
+    const Eigen::Vector3f xyz_min(-40, -30, -50);
+    const Eigen::Vector3f xyz_max(40, 30, 50);
+    const Eigen::Vector3i resolution(7, 5, 9);
+    std::vector<float> heights(resolution.prod());
+    for(auto& h : heights) {
+        h = height(rg);
+    }
+    const pentatope::HeightField field(
+        xyz_min, xyz_max, resolution, heights);
+
+    // The same tetrahedra, as a mesh.
+    std::vector<Eigen::Vector4f> vertices;
+    std::vector<std::array<uint32_t, 4>> indices;
+    for(const int i : boost::irange(0, field.size())) {
+        std::array<uint32_t, 4> tetra;
+        for(const auto& vertex : field.getTetrahedron(i)) {
+            tetra[vertices.size() % 4] = vertices.size();
+            vertices.push_back(vertex);
+        }
+        indices.push_back(tetra);
+    }
+    const pentatope::TetraMesh mesh(vertices, indices);
+    EXPECT_EQ(field.bounds().min(), mesh.bounds().min());
+    EXPECT_EQ(field.bounds().max(), mesh.bounds().max());
+
+    std::uniform_real_distribution<float> unit(0, 1);
+    int n_hits = 0;
+    for(const int i : boost::irange(0, 1000)) {
+        // Half of rays start far away, and the others inside the field.
+        const pentatope::Ray ray_base = arbitraryRay(rg);
+        const Eigen::Vector4f origin = (i % 2 == 0) ?
+            ray_base.origin :
+            Eigen::Vector4f(
+                xyz_min(0) + unit(rg) * (xyz_max(0) - xyz_min(0)),
+                xyz_min(1) + unit(rg) * (xyz_max(1) - xyz_min(1)),
+                xyz_min(2) + unit(rg) * (xyz_max(2) - xyz_min(2)),
+                height(rg));
+        const pentatope::Ray ray(origin, ray_base.direction);
+        const auto expected = mesh.intersectHit(ray);
+        const auto hit = field.intersectHit(ray);
+        ASSERT_EQ(static_cast<bool>(expected), static_cast<bool>(hit));
+        if(hit) {
+            EXPECT_NEAR(expected->t, hit->t, 1e-3);
+            const auto geom_expected = mesh.microGeometry(ray, *expected);
+            const auto geom = field.microGeometry(ray, *hit);
+            EXPECT_NEAR(0, (geom_expected.pos() - geom.pos()).norm(), 1e-3);
+            n_hits++;
+        }
+    }
+    EXPECT_LT(100, n_hits);
+}
@@ -0,0 +1,43 @@
+#include "instance.h"
+
+namespace pentatope {
+
+Instance::Instance(
+        std::shared_ptr<const Geometry> prototype, const Pose& pose) :
+        prototype(prototype), pose(pose),
+        world_to_local(pose.asInverseAffine()) {
+    assert(prototype);
+}
+
+boost::optional<RayHit> Instance::intersectHit(const Ray& ray) const {
+    // Rigid transform doesn't change distance along the ray,
+    // so the hit is valid in the world as is.
+    return prototype->intersectHit(toLocal(ray));
+}
+
+MicroGeometry Instance::microGeometry(
+        const Ray& ray, const RayHit& hit) const {
+    const MicroGeometry geom_local =
+        prototype->microGeometry(toLocal(ray), hit);
+    return MicroGeometry(
+        ray.at(hit.t), pose.asAffine().linear() * geom_local.normal());
+}
+
+AABB Instance::bounds() const {
+    // Same as OBB::bounds, with the prototype bounds as the box.
+    const AABB bounds_local = prototype->bounds();
+    const auto local_to_world = pose.asAffine();
+    const Eigen::Vector4f extent =
+        local_to_world.linear().cwiseAbs() * (bounds_local.size() / 2);
+    const Eigen::Vector4f center = local_to_world * bounds_local.center();
+    return AABB(center - extent, center + extent);
+}
+
+Ray Instance::toLocal(const Ray& ray) const {
+    return Ray(
+        world_to_local * ray.origin,
+        world_to_local.linear() * ray.direction,
+        ray.t_min, ray.t_max);
+}
+
+}  // namespace
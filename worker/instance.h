@@ -0,0 +1,38 @@
+// Placement of shared geometry, so that a scene can contain many
+// copies of the same shape (e.g. trees) without copying it.
+#pragma once
+
+#include <memory>
+
+#include <boost/optional.hpp>
+#include <Eigen/Dense>
+
+#include <geometry.h>
+#include <space.h>
+
+namespace pentatope {
+
+// A prototype Geometry placed by a rigid transform.
+// When the prototype has its own acceleration structure (e.g. TetraMesh),
+// a BVHAccel over Instances becomes a two-level hierarchy, and memory &
+// build time only grow with the number of unique prototypes.
+class Instance : public Geometry {
+public:
+    // pose transforms the local coordinates of prototype to the world.
+    Instance(std::shared_ptr<const Geometry> prototype, const Pose& pose);
+
+    boost::optional<RayHit>
+        intersectHit(const Ray& ray) const override;
+    MicroGeometry microGeometry(
+        const Ray& ray, const RayHit& hit) const override;
+
+    AABB bounds() const override;
+private:
+    Ray toLocal(const Ray& ray) const;
+
+    const std::shared_ptr<const Geometry> prototype;
+    Pose pose;
+    Eigen::Transform<float, 4, Eigen::Affine> world_to_local;
+};
+
+}  // namespace
@@ -0,0 +1,74 @@
+#include "instance.h"
+
+#include <cmath>
+#include <random>
+
+#include <boost/range/irange.hpp>
+#include <gtest/gtest.h>
+
+#include <arbitrary_test.h>
+#include <tetra_mesh.h>
+
+namespace {
+
+// Rotate by 30 degrees in ZW plane, and translate.
+pentatope::Pose arbitraryPose() {
+    const float c = std::cos(pentatope::pi / 6);
+    const float s = std::sin(pentatope::pi / 6);
+    Eigen::Matrix4f rot = Eigen::Matrix4f::Identity();
+    rot(2, 2) = c;
+    rot(2, 3) = -s;
+    rot(3, 2) = s;
+    rot(3, 3) = c;
+    return pentatope::Pose(rot, Eigen::Vector4f(10, -20, 5, 3));
+}
+
+}  // namespace
+
+
+TEST(Instance, BehaveIdenticallyToTransformedGeometry) {
+    std::mt19937 rg;
+    const auto pose = arbitraryPose();
+    const std::array<Eigen::Vector4f, 4> vertices_local = {
+        Eigen::Vector4f(-50, -50, -50, 0),
+        Eigen::Vector4f(50, -50, -50, 0),
+        Eigen::Vector4f(0, 50, -50, 10),
+        Eigen::Vector4f(0, 0, 50, -10)};
+    std::array<Eigen::Vector4f, 4> vertices_world;
+    for(const int i : boost::irange(0, 4)) {
+        vertices_world[i] = pose.asAffine() * vertices_local[i];
+    }
+    const pentatope::Instance instance(
+        std::make_shared<pentatope::TetraMesh>(
+            std::vector<Eigen::Vector4f>(
+                vertices_local.begin(), vertices_local.end()),
+            std::vector<std::array<uint32_t, 4>>({{0, 1, 2, 3}})),
+        pose);
+    const pentatope::Tetrahedron tetra(vertices_world);
+
+    const auto aabb = instance.bounds();
+    for(const auto& vertex : vertices_world) {
+        for(const int axis : boost::irange(0, 4)) {
+            EXPECT_GE(aabb.max()(axis) + 1e-3, vertex(axis));
+            EXPECT_LE(aabb.min()(axis) - 1e-3, vertex(axis));
+        }
+    }
+
+    int n_hits = 0;
+    for(const int i : boost::irange(0, 1000)) {
+        const auto ray = arbitraryRay(rg);
+        const auto hit_expected = tetra.intersectHit(ray);
+        const auto hit = instance.intersectHit(ray);
+        ASSERT_EQ(static_cast<bool>(hit_expected), static_cast<bool>(hit));
+        if(!hit) {
+            continue;
+        }
+        n_hits++;
+        EXPECT_NEAR(hit_expected->t, hit->t, 1e-2);
+        const auto geom_expected = tetra.microGeometry(ray, *hit_expected);
+        const auto geom = instance.microGeometry(ray, *hit);
+        EXPECT_NEAR(0, (geom_expected.pos() - geom.pos()).norm(), 1e-2);
+        EXPECT_NEAR(0, (geom_expected.normal() - geom.normal()).norm(), 1e-3);
+    }
+    EXPECT_LT(0, n_hits);
+}
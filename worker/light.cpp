@@ -22,6 +22,14 @@ Spectrum BSDF::bsdf(
     return Spectrum::Zero();
 }
 
+std::pair<Eigen::Vector4f, Spectrum> BSDF::sample(
+        const Eigen::Vector4f& dir_out, Sampler& sampler) const {
+    const Eigen::Vector4f dir_in = sampler.uniformHemisphere(geom.normal());
+    return std::make_pair(dir_in,
+        bsdf(dir_in, dir_out) *
+        (std::abs(geom.normal().dot(dir_in)) * pi * pi));
+}
+
 Spectrum BSDF::emission(const Eigen::Vector4f& dir_out) const {
     return Spectrum::Zero();
 }
@@ -36,6 +44,11 @@ Spectrum LambertBRDF::bsdf(const Eigen::Vector4f& dir_in, const Eigen::Vector4f&
     return refl_normalized;
 }
 
+std::pair<Eigen::Vector4f, Spectrum> LambertBRDF::sample(
+        const Eigen::Vector4f& dir_out, Sampler& sampler) const {
+    return std::make_pair(sampler.cosineHemisphere(geom.normal()), refl);
+}
+
 
 EmissionBRDF::EmissionBRDF(const MicroGeometry& geom, const Spectrum& e_radiance) :
         BSDF(geom), e_radiance(e_radiance) {
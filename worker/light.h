@@ -12,6 +12,7 @@
 #include <Eigen/Dense>
 
 #include <geometry.h>
+#include <sampling.h>
 #include <space.h>
 
 namespace pentatope {
@@ -43,6 +44,12 @@ public:
     virtual Spectrum bsdf(
         const Eigen::Vector4f& dir_in, const Eigen::Vector4f& dir_out) const;
 
+    // Sample dir_in for non-specular BSDF, and return
+    // (dir_in, bsdf * |cos| / pdf). Uniform over the hemisphere
+    // of normal unless overridden.
+    virtual std::pair<Eigen::Vector4f, Spectrum>
+        sample(const Eigen::Vector4f& dir_out, Sampler& sampler) const;
+
     virtual Spectrum emission(const Eigen::Vector4f& dir_out) const;
 protected:
     MicroGeometry geom;
@@ -55,6 +62,9 @@ public:
     LambertBRDF(const MicroGeometry& geom, const Spectrum& refl);
 
     Spectrum bsdf(const Eigen::Vector4f& dir_in, const Eigen::Vector4f& dir_out) const override;
+    // Cosine-weighted, so the weight is always refl.
+    std::pair<Eigen::Vector4f, Spectrum>
+        sample(const Eigen::Vector4f& dir_out, Sampler& sampler) const override;
 private:
     Spectrum refl;
     Spectrum refl_normalized;
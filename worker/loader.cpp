@@ -1,8 +1,10 @@
 #include "loader.h"
 
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <stdexcept>
 #include <streambuf>
 #include <string>
@@ -14,11 +16,14 @@
 
 #include <camera.h>
 #include <geometry.h>
+#include <height_field.h>
+#include <instance.h>
 #include <light.h>
 #include <material.h>
 #include <sampling.h>
 #include <scene.h>
 #include <space.h>
+#include <tetra_mesh.h>
 
 namespace pentatope {
 
@@ -64,7 +69,10 @@ Eigen::Vector4f loadDirection(const Direction& dir) {
     return d;
 }
 
-std::unique_ptr<Geometry> loadGeometry(const ObjectGeometry& og) {
+std::unique_ptr<Geometry> loadGeometry(
+        const ObjectGeometry& og,
+        const std::vector<std::shared_ptr<const Geometry>>& prototypes,
+        AccelCache* cache) {
     if(og.type() == ObjectGeometry::OBB) {
         const OBBGeometry& obb =
             og.GetExtension(OBBGeometry::geom);
@@ -114,6 +122,81 @@ std::unique_ptr<Geometry> loadGeometry(const ObjectGeometry& og) {
             loadPoint(disc.center()),
             loadDirection(disc.normal()),
             disc.radius());
+    } else if(og.type() == ObjectGeometry::TETRA_MESH) {
+        const TetraMeshGeometry& mesh =
+            og.GetExtension(TetraMeshGeometry::geom);
+        if(mesh.vertices_size() % 4 != 0) {
+            throw invalid_task("TetraMesh vertices must be 4-dimensional");
+        }
+        if(mesh.indices_size() == 0 || mesh.indices_size() % 4 != 0) {
+            throw invalid_task("TetraMesh requires 4 indices per tetrahedron");
+        }
+        std::vector<Eigen::Vector4f> vertices(mesh.vertices_size() / 4);
+        for(const int i : boost::irange(0, mesh.vertices_size())) {
+            vertices[i / 4](i % 4) = mesh.vertices(i);
+        }
+        std::vector<std::array<uint32_t, 4>> indices(mesh.indices_size() / 4);
+        for(const int i : boost::irange(0, mesh.indices_size())) {
+            if(mesh.indices(i) >= vertices.size()) {
+                throw invalid_task("TetraMesh index out of range");
+            }
+            indices[i / 4][i % 4] = mesh.indices(i);
+        }
+        if(mesh.spatial_split_growth() < 0) {
+            throw invalid_task("spatial_split_growth must be non-negative");
+        }
+        return std::make_unique<TetraMesh>(
+            vertices, indices, mesh.spatial_split_growth(), cache);
+    } else if(og.type() == ObjectGeometry::HEIGHT_FIELD) {
+        const HeightFieldGeometry& field =
+            og.GetExtension(HeightFieldGeometry::geom);
+        if(field.resolution_size() != 3 ||
+                field.xyz_min_size() != 3 || field.xyz_max_size() != 3) {
+            throw invalid_task(
+                "HeightField resolution and bounds must be 3-dimensional");
+        }
+        Eigen::Vector3i resolution;
+        Eigen::Vector3f xyz_min;
+        Eigen::Vector3f xyz_max;
+        // Check each axis before converting to int, and the total
+        // in int64, so that huge resolutions can't overflow.
+        int64_t n_samples = 1;
+        for(const int axis : boost::irange(0, 3)) {
+            if(field.resolution(axis) < 2) {
+                throw invalid_task(
+                    "HeightField requires at least 2 samples along each axis");
+            }
+            if(field.resolution(axis) > HeightField::max_samples) {
+                throw invalid_task("HeightField resolution is too large");
+            }
+            resolution(axis) = field.resolution(axis);
+            n_samples *= resolution(axis);
+            if(n_samples > HeightField::max_samples) {
+                throw invalid_task("HeightField resolution is too large");
+            }
+            xyz_min(axis) = field.xyz_min(axis);
+            xyz_max(axis) = field.xyz_max(axis);
+            if(!(xyz_min(axis) < xyz_max(axis))) {
+                throw invalid_task("HeightField bounds must be non-empty");
+            }
+        }
+        if(field.heights_size() != n_samples) {
+            throw invalid_task("HeightField heights doesn't match resolution");
+        }
+        return std::make_unique<HeightField>(
+            xyz_min, xyz_max, resolution,
+            std::vector<float>(field.heights().begin(), field.heights().end()));
+    } else if(og.type() == ObjectGeometry::INSTANCE) {
+        const InstanceGeometry& instance =
+            og.GetExtension(InstanceGeometry::geom);
+        if(instance.prototype() >= prototypes.size()) {
+            throw invalid_task("Instance refers to unknown prototype");
+        }
+        return std::make_unique<Instance>(
+            prototypes[instance.prototype()],
+            instance.has_local_to_world() ?
+                loadPoseFromRigidTransform(instance.local_to_world()) :
+                Pose());
     } else {
         throw invalid_task("Unknown geometry type");
     }
@@ -146,17 +229,31 @@ std::unique_ptr<Material> loadMaterial(const ObjectMaterial& om) {
     }
 }
 
-Object loadObject(const SceneObject& object) {
+Object loadObject(
+        const SceneObject& object,
+        const std::vector<std::shared_ptr<const Geometry>>& prototypes,
+        const std::vector<std::shared_ptr<Material>>& materials,
+        AccelCache* cache) {
     // Load geometry.
     if(!object.has_geometry()) {
         throw invalid_task("Object requires geometry.");
     }
-    std::unique_ptr<Geometry> geom = loadGeometry(object.geometry());
-    // Load material.
-    if(!object.has_material()) {
-        throw invalid_task("Object requires material.");
+    std::unique_ptr<Geometry> geom =
+        loadGeometry(object.geometry(), prototypes, cache);
+    // Load or share material.
+    if(object.has_material() == object.has_material_index()) {
+        throw invalid_task(
+            "Object requires exactly one of material and material_index.");
+    }
+    std::shared_ptr<Material> material;
+    if(object.has_material()) {
+        material = loadMaterial(object.material());
+    } else {
+        if(object.material_index() >= materials.size()) {
+            throw invalid_task("Object refers to unknown material");
+        }
+        material = materials[object.material_index()];
     }
-    std::unique_ptr<Material> material = loadMaterial(object.material());
     // Construct and append object.
     assert(geom);
     assert(material);
@@ -185,7 +282,7 @@ std::unique_ptr<Light> loadLight(const SceneLight& light_proto) {
     }
 }
 
-std::unique_ptr<Scene> loadScene(const RenderScene& rs) {
+std::unique_ptr<Scene> loadScene(const RenderScene& rs, AccelCache* cache) {
     Spectrum background(fromRgb(0, 0, 0));
     if(rs.has_background_radiance()) {
         background = loadSpectrum(rs.background_radiance());
@@ -199,8 +296,17 @@ std::unique_ptr<Scene> loadScene(const RenderScene& rs) {
     }
     std::unique_ptr<Scene> scene_p(new Scene(background, scattering_sigma));
     Scene& scene = *scene_p;
+    // Each prototype can only refer to earlier ones, so there's no cycle.
+    std::vector<std::shared_ptr<const Geometry>> prototypes;
+    for(const auto& prototype : rs.prototypes()) {
+        prototypes.push_back(loadGeometry(prototype, prototypes, cache));
+    }
+    std::vector<std::shared_ptr<Material>> materials;
+    for(const auto& material : rs.materials()) {
+        materials.push_back(loadMaterial(material));
+    }
     for(const auto& object : rs.objects()) {
-        scene.addObject(loadObject(object));
+        scene.addObject(loadObject(object, prototypes, materials, cache));
     }
     for(const auto& light_proto : rs.lights()) {
         scene.addLight(loadLight(light_proto));
@@ -208,16 +314,57 @@ std::unique_ptr<Scene> loadScene(const RenderScene& rs) {
     return scene_p;
 }
 
-std::unique_ptr<Scene> loadSceneFromRenderTask(const RenderTask& rt) {
-    std::unique_ptr<Scene> scene;
-    if(rt.has_scene()) {
-        scene = loadScene(rt.scene());
-    } else {
+uint64_t sceneContentHash(const RenderScene& rs) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(const char c : rs.SerializeAsString()) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+std::unique_ptr<Scene> loadSceneFromRenderTask(
+        const RenderTask& rt, int n_threads,
+        const std::string& accel_cache_dir) {
+    if(!rt.has_scene()) {
         throw invalid_task(
             "Scene specification not found");
     }
+    std::unique_ptr<AccelCache> cache;
+    if(!accel_cache_dir.empty()) {
+        std::ostringstream name;
+        name << std::hex << std::setw(16) << std::setfill('0') <<
+            sceneContentHash(rt.scene());
+        cache = std::make_unique<AccelCache>(
+            accel_cache_dir + "/" + name.str() + ".bvh");
+    }
+    std::unique_ptr<Scene> scene = loadScene(rt.scene(), cache.get());
     assert(scene);
-    scene->finalize();
+    const RenderScene::Accelerator accelerator = rt.scene().accelerator();
+    AccelType accel_type;
+    if(accelerator == RenderScene::AUTO) {
+        accel_type = AccelType::AUTO;
+    } else if(accelerator == RenderScene::BVH) {
+        accel_type = AccelType::BVH;
+    } else if(accelerator == RenderScene::WIDE_BVH) {
+        accel_type = AccelType::WIDE_BVH;
+    } else if(accelerator == RenderScene::QUANTIZED_BVH) {
+        accel_type = AccelType::QUANTIZED_BVH;
+    } else if(accelerator == RenderScene::GRID) {
+        accel_type = AccelType::GRID;
+    } else {
+        throw invalid_task("Unknown accelerator");
+    }
+    scene->finalize(
+        n_threads, accel_type, cache.get(), rt.packet_tracing());
+    if(cache) {
+        // Failing to cache only makes next load slower.
+        try {
+            cache->save();
+        } catch(const std::runtime_error& e) {
+            LOG(WARNING) << "Failed to save accel cache: " << e.what();
+        }
+    }
     return scene;
 }
 
@@ -301,10 +448,15 @@ std::unique_ptr<Camera2> loadCameraFromCameraConfig(const CameraConfig& config)
 }
 
 // parse RenderTask from given prototxt file,
-// and return (scene, camera, #samples/px)
-std::tuple<std::unique_ptr<Scene>, std::unique_ptr<Camera2>, int>
-        loadRenderTask(const RenderTask& rt) {
-    std::unique_ptr<Scene> scene = loadSceneFromRenderTask(rt);
+// and return (scene, camera, #samples/px, max path depth,
+// adaptive sampling)
+std::tuple<
+        std::unique_ptr<Scene>, std::unique_ptr<Camera2>, int, int, bool>
+        loadRenderTask(
+            const RenderTask& rt, int n_threads,
+            const std::string& accel_cache_dir) {
+    std::unique_ptr<Scene> scene =
+        loadSceneFromRenderTask(rt, n_threads, accel_cache_dir);
 
     if(!rt.has_camera()) {
         throw std::runtime_error("camera not found");
@@ -319,9 +471,28 @@ std::tuple<std::unique_ptr<Scene>, std::unique_ptr<Camera2>, int>
     if(sample_per_px <= 0) {
         throw physics_error("sampler_per_px must be > 0");
     }
+    // Deeper paths contribute nothing visible, and huge depths would
+    // overflow int (and sample dimensions of Sampler).
+    if(rt.max_path_depth() == 0 ||
+            rt.max_path_depth() > max_path_depth_limit) {
+        throw invalid_task("max_path_depth must be within [1, " +
+            std::to_string(max_path_depth_limit) + "]");
+    }
+    const int max_depth = rt.max_path_depth();
 
     return std::make_tuple(
-        std::move(scene), std::move(camera), sample_per_px);
+        std::move(scene), std::move(camera), sample_per_px, max_depth,
+        rt.adaptive_sampling());
+}
+
+Sampler loadSamplerFromRenderTask(const RenderTask& rt) {
+    if(rt.sample_sequence() == RenderTask::RANDOM) {
+        return Sampler(Sampler::Sequence::RANDOM, rt.seed());
+    } else if(rt.sample_sequence() == RenderTask::HALTON) {
+        return Sampler(Sampler::Sequence::HALTON, rt.seed());
+    } else {
+        throw invalid_task("Unknown sample_sequence");
+    }
 }
 
 RenderTask readRenderTaskFromFile(const std::string& path) {
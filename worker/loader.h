@@ -1,13 +1,16 @@
 // Load external config in prototxt to renderable Scene, Camera etc.
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include <Eigen/Dense>
 
 #include <camera.h>
+#include <sampling.h>
 #include <scene.h>
 #include <space.h>
 
@@ -28,17 +31,40 @@ Spectrum loadSpectrum(const SpectrumProto& sp);
 Eigen::Vector4f loadPoint(const Point& pt);
 Eigen::Vector4f loadDirection(const Direction& pt);
 
-std::unique_ptr<Geometry> loadGeometry(const ObjectGeometry& og);
+// prototypes are referred by InstanceGeometry.
+// Acceleration structures of geometries (e.g. TetraMesh) are loaded from
+// or added to cache, when given.
+std::unique_ptr<Geometry> loadGeometry(
+    const ObjectGeometry& og,
+    const std::vector<std::shared_ptr<const Geometry>>& prototypes = {},
+    AccelCache* cache = nullptr);
 
 std::unique_ptr<Material> loadMaterial(const ObjectMaterial& og);
 
-Object loadObject(const SceneObject& so);
+// materials are referred by SceneObject.material_index.
+Object loadObject(
+    const SceneObject& so,
+    const std::vector<std::shared_ptr<const Geometry>>& prototypes = {},
+    const std::vector<std::shared_ptr<Material>>& materials = {},
+    AccelCache* cache = nullptr);
 
 std::unique_ptr<Light> loadLight(const SceneLight& sl);
 
-std::unique_ptr<Scene> loadScene(const RenderScene& rs);
+// cache is used as in loadGeometry.
+std::unique_ptr<Scene> loadScene(
+    const RenderScene& rs, AccelCache* cache = nullptr);
 
-std::unique_ptr<Scene> loadSceneFromRenderTask(const RenderTask& rt);
+// 64 bit hash of serialized rs (FNV-1a). Same scenes have the same hash
+// as long as they are serialized by the same protobuf implementation.
+uint64_t sceneContentHash(const RenderScene& rs);
+
+// Load and finalize the scene, using up to n_threads threads.
+// When accel_cache_dir is not empty, acceleration structures are
+// cached in the directory (created when needed), keyed by
+// sceneContentHash.
+std::unique_ptr<Scene> loadSceneFromRenderTask(
+    const RenderTask& rt, int n_threads,
+    const std::string& accel_cache_dir = "");
 
 // Parse RigidTransform.
 // When rotation or translation is lacking, identity will be used.
@@ -48,10 +74,21 @@ Pose loadPoseFromRigidTransform(const RigidTransform& rigid);
 std::unique_ptr<Camera2> loadCameraFromCameraConfig(
     const CameraConfig& config);
 
+// Sampler for RenderTask.sample_sequence and seed.
+Sampler loadSamplerFromRenderTask(const RenderTask& rt);
+
+// Largest RenderTask.max_path_depth accepted by loadRenderTask.
+const uint32_t max_path_depth_limit = 1024;
+
 // load RenderTask from given prototxt or binary proto file,
-// and return (scene, camera, #samples/px)
-std::tuple<std::unique_ptr<Scene>, std::unique_ptr<Camera2>, int>
-    loadRenderTask(const RenderTask& task);
+// and return (scene, camera, #samples/px, max path depth,
+// adaptive sampling)
+// n_threads and accel_cache_dir are used to finalize the scene.
+std::tuple<
+        std::unique_ptr<Scene>, std::unique_ptr<Camera2>, int, int, bool>
+    loadRenderTask(
+        const RenderTask& task, int n_threads,
+        const std::string& accel_cache_dir = "");
 
 
 // fast but ugly code to get file content onto memory.
@@ -0,0 +1,185 @@
+#include "loader.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/text_format.h>
+#include <gtest/gtest.h>
+
+#include <geometry.h>
+#include <material.h>
+
+namespace {
+
+template<typename Proto>
+Proto parseText(const std::string& text) {
+    Proto proto;
+    EXPECT_TRUE(google::protobuf::TextFormat::ParseFromString(text, &proto));
+    return proto;
+}
+
+// Geometry of objects in the material tests.
+const std::string sphere_text =
+    "geometry {"
+    "  type: SPHERE"
+    "  [pentatope.SphereGeometry.geom] {"
+    "    center { x: 0 y: 0 z: 0 w: 0 }"
+    "    radius: 1"
+    "  }"
+    "}";
+
+const std::string lambert_text =
+    "type: UNIFORM_LAMBERT"
+    "[pentatope.UniformLambertMaterialProto.material] {"
+    "  reflectance { r: 0.5 g: 0.5 b: 0.5 }"
+    "}";
+
+std::vector<std::shared_ptr<pentatope::Material>> arbitraryMaterials() {
+    return {
+        std::make_shared<pentatope::GlassMaterial>(1.5),
+        std::make_shared<pentatope::UniformLambertMaterial>(
+            pentatope::fromRgb(0.5, 0.5, 0.5))};
+}
+
+}  // namespace
+
+
+TEST(Loader, InstancePlacesPrototype) {
+    // Unit sphere at (1, 0, 0, 0), rotated by 90 degrees in XY plane
+    // (x -> y) and translated by (10, 0, 0, 0).
+    // It ends up at (10, 1, 0, 0) in the world.
+    const auto scene = parseText<pentatope::RenderScene>(
+        "prototypes {"
+        "  type: SPHERE"
+        "  [pentatope.SphereGeometry.geom] {"
+        "    center { x: 1 y: 0 z: 0 w: 0 }"
+        "    radius: 1"
+        "  }"
+        "}"
+        "objects {"
+        "  geometry {"
+        "    type: INSTANCE"
+        "    [pentatope.InstanceGeometry.geom] {"
+        "      prototype: 0"
+        "      local_to_world {"
+        "        rotation: [0, -1, 0, 0, 1, 0, 0, 0,"
+        "                   0, 0, 1, 0, 0, 0, 0, 1]"
+        "        translation: [10, 0, 0, 0]"
+        "      }"
+        "    }"
+        "  }"
+        "  material {" + lambert_text + "}"
+        "}");
+    const std::vector<std::shared_ptr<const pentatope::Geometry>> prototypes =
+        {pentatope::loadGeometry(scene.prototypes(0))};
+    const auto object = pentatope::loadObject(scene.objects(0), prototypes);
+
+    const auto aabb = object.first->bounds();
+    const Eigen::Vector4f center(10, 1, 0, 0);
+    for(const int axis : {0, 1, 2, 3}) {
+        EXPECT_NEAR(center(axis) - 1, aabb.min()(axis), 1e-3);
+        EXPECT_NEAR(center(axis) + 1, aabb.max()(axis), 1e-3);
+    }
+
+    const pentatope::Ray ray(
+        Eigen::Vector4f(0, 1, 0, 0), Eigen::Vector4f(1, 0, 0, 0));
+    const auto isect = object.first->intersect(ray);
+    ASSERT_TRUE(isect);
+    EXPECT_TRUE(isect->pos().isApprox(Eigen::Vector4f(9, 1, 0, 0), 1e-4));
+    EXPECT_TRUE(isect->normal().isApprox(Eigen::Vector4f(-1, 0, 0, 0), 1e-4));
+
+    // The whole scene loads the same way.
+    EXPECT_NO_THROW(pentatope::loadScene(scene));
+}
+
+TEST(Loader, InstanceRejectsUnknownPrototype) {
+    const auto geometry = parseText<pentatope::ObjectGeometry>(
+        "type: INSTANCE"
+        "[pentatope.InstanceGeometry.geom] { prototype: 0 }");
+    EXPECT_THROW(pentatope::loadGeometry(geometry), pentatope::invalid_task);
+}
+
+TEST(Loader, MaterialIndexSharesMaterial) {
+    const auto materials = arbitraryMaterials();
+    const auto object = pentatope::loadObject(
+        parseText<pentatope::SceneObject>(
+            sphere_text + "material_index: 1"),
+        {}, materials);
+    EXPECT_EQ(materials[1], object.second);
+}
+
+TEST(Loader, MaterialIndexMustBeInRange) {
+    EXPECT_THROW(
+        pentatope::loadObject(
+            parseText<pentatope::SceneObject>(
+                sphere_text + "material_index: 2"),
+            {}, arbitraryMaterials()),
+        pentatope::invalid_task);
+}
+
+TEST(Loader, ObjectRequiresExactlyOneMaterial) {
+    EXPECT_THROW(
+        pentatope::loadObject(
+            parseText<pentatope::SceneObject>(
+                sphere_text + "material {" + lambert_text + "}" +
+                "material_index: 0"),
+            {}, arbitraryMaterials()),
+        pentatope::invalid_task);
+    EXPECT_THROW(
+        pentatope::loadObject(
+            parseText<pentatope::SceneObject>(sphere_text),
+            {}, arbitraryMaterials()),
+        pentatope::invalid_task);
+}
+
+TEST(Loader, HeightFieldRejectsInvalidResolution) {
+    const auto heightField = [](const std::string& resolution) {
+        return parseText<pentatope::ObjectGeometry>(
+            "type: HEIGHT_FIELD"
+            "[pentatope.HeightFieldGeometry.geom] {"
+            "  resolution: [" + resolution + "]"
+            "  heights: [0, 0, 0, 0, 0, 0, 0, 0]"
+            "  xyz_min: [0, 0, 0]"
+            "  xyz_max: [1, 1, 1]"
+            "}");
+    };
+    EXPECT_NO_THROW(pentatope::loadGeometry(heightField("2, 2, 2")));
+    EXPECT_THROW(
+        pentatope::loadGeometry(heightField("0, 2, 2")),
+        pentatope::invalid_task);
+    // Negative when cast to int.
+    EXPECT_THROW(
+        pentatope::loadGeometry(heightField("2, 4294967295, 2")),
+        pentatope::invalid_task);
+    // Overflows int when multiplied.
+    EXPECT_THROW(
+        pentatope::loadGeometry(heightField("65536, 65536, 2")),
+        pentatope::invalid_task);
+}
+
+TEST(Loader, MaxPathDepthMustBeWithinLimit) {
+    const auto renderTask = [](const std::string& max_path_depth) {
+        return parseText<pentatope::RenderTask>(
+            "sample_per_pixel: 1 "
+            "max_path_depth: " + max_path_depth + " "
+            "camera {"
+            "  camera_type: \"perspective2\""
+            "  size_x: 4 size_y: 4 fov_x: 60 fov_y: 60"
+            "}"
+            "scene { objects {" + sphere_text +
+            "  material {" + lambert_text + "}"
+            "} }");
+    };
+    EXPECT_NO_THROW(pentatope::loadRenderTask(renderTask("1024"), 1));
+    EXPECT_THROW(
+        pentatope::loadRenderTask(renderTask("0"), 1),
+        pentatope::invalid_task);
+    EXPECT_THROW(
+        pentatope::loadRenderTask(renderTask("1025"), 1),
+        pentatope::invalid_task);
+    // Negative when cast to int.
+    EXPECT_THROW(
+        pentatope::loadRenderTask(renderTask("4294967295"), 1),
+        pentatope::invalid_task);
+}
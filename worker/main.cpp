@@ -23,15 +23,22 @@
 using namespace pentatope;
 
 
-cv::Mat executeRenderTask(const int n_threads, const RenderTask& rtask) {
-    auto task = loadRenderTask(rtask);
+cv::Mat executeRenderTask(
+        const int n_threads, const std::string& accel_cache_dir,
+        const RenderTask& rtask,
+        const Camera2::ProgressCallback& progress = Camera2::ProgressCallback()) {
+    auto task = loadRenderTask(rtask, n_threads, accel_cache_dir);
     auto scene = std::move(std::get<0>(task));
     const auto camera = std::move(std::get<1>(task));
     const auto sample_per_px = std::get<2>(task);
+    const auto max_depth = std::get<3>(task);
+    const auto adaptive = std::get<4>(task);
 
     LOG(INFO) << "Starting task";
-    Sampler sampler;
-    return camera->render(*scene, sampler, sample_per_px, n_threads);
+    Sampler sampler = loadSamplerFromRenderTask(rtask);
+    return camera->render(
+        *scene, sampler, sample_per_px, max_depth, n_threads, adaptive,
+        progress);
 }
 
 
@@ -42,7 +49,8 @@ using http_server = http::server<RenderHandler>;
 
 class RenderHandler {
 public:
-    RenderHandler(int n_threads) : n_threads(n_threads) {
+    RenderHandler(int n_threads, const std::string& accel_cache_dir) :
+            n_threads(n_threads), accel_cache_dir(accel_cache_dir) {
         assert(n_threads > 0);
     }
 
@@ -106,7 +114,8 @@ private:
             }
         }
 
-        const cv::Mat result_hdr = executeRenderTask(n_threads, cached_task);
+        const cv::Mat result_hdr = executeRenderTask(
+            n_threads, accel_cache_dir, cached_task);
         setImageTileFrom(result_hdr, *response.mutable_output_tile());
         response.set_status(RenderResponse::SUCCESS);
     }
@@ -134,6 +143,7 @@ private:
     std::map<uint64_t, RenderScene> scene_cache;
 
     const int n_threads;
+    const std::string accel_cache_dir;
 };
 
 
@@ -156,7 +166,9 @@ int main(int argc, char** argv) {
         ("help", "show this message")
         ("render", value<std::string>(), "run given RenderTask (either text or binary)")
         ("output", value<std::string>(), "write output to given path (only works with --render)")
-        ("max-threads", value<int>(), "Maximum number of worker threads (default: nproc).");
+        ("preview", "render progressively, and overwrite output after each pass (only works with --render)")
+        ("max-threads", value<int>(), "Maximum number of worker threads (default: nproc).")
+        ("accel-cache", value<std::string>(), "Directory to cache acceleration structures of scenes across runs (default: no cache).");
     variables_map vars;
     store(parse_command_line(argc, argv, desc), vars);
     notify(vars);
@@ -170,6 +182,12 @@ int main(int argc, char** argv) {
     }
     LOG(INFO) << "Using #threads=" << n_threads;
 
+    std::string accel_cache_dir;
+    if(vars.count("accel-cache") > 0) {
+        accel_cache_dir = vars["accel-cache"].as<std::string>();
+        LOG(INFO) << "Caching acceleration structures in " << accel_cache_dir;
+    }
+
     if(vars.count("help") > 0) {
         std::cout << desc << std::endl;
     } else if(vars.count("render") > 0) {
@@ -183,7 +201,17 @@ int main(int argc, char** argv) {
         auto task = readRenderTaskFromFile(task_path);
 
         const auto output_path = vars["output"].as<std::string>();
-        const cv::Mat result = executeRenderTask(n_threads, task);
+        Camera2::ProgressCallback progress;
+        if(vars.count("preview") > 0) {
+            progress = [&output_path](
+                    const cv::Mat& film, const cv::Mat& sample_count) {
+                LOG(INFO) << "Writing preview to " << output_path;
+                cv::imwrite(output_path, film);
+                return true;
+            };
+        }
+        const cv::Mat result =
+            executeRenderTask(n_threads, accel_cache_dir, task, progress);
         LOG(INFO) << "Writing render result to " << output_path;
         cv::imwrite(output_path, result);
     } else {
@@ -191,7 +219,7 @@ int main(int argc, char** argv) {
             LOG(WARNING) << "Service mode ignores --output";
         }
         LOG(INFO) << "Running as an HTTP service, listening on port 80";
-        RenderHandler handler(n_threads);
+        RenderHandler handler(n_threads, accel_cache_dir);
         http_server server(
             http_server::options(handler)
                 .address("0.0.0.0")
@@ -0,0 +1,51 @@
+#include "mapped_file.h"
+
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pentatope {
+
+MappedFile::MappedFile(const std::string& path) :
+        content(nullptr), content_size(0) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to stat " + path);
+    }
+    content_size = st.st_size;
+    if(content_size > 0) {
+        void* addr = mmap(
+            nullptr, content_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(addr == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Failed to mmap " + path);
+        }
+        content = static_cast<const char*>(addr);
+    }
+    // The mapping stays valid after closing.
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if(content) {
+        munmap(const_cast<char*>(content), content_size);
+    }
+}
+
+const char* MappedFile::data() const {
+    return content;
+}
+
+size_t MappedFile::size() const {
+    return content_size;
+}
+
+}  // namespace
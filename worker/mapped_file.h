@@ -0,0 +1,28 @@
+// Read-only memory mapping of a whole file.
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace pentatope {
+
+// Pages are loaded lazily by the OS, and shared among processes
+// mapping the same file. The mapping is released on destruction.
+class MappedFile {
+public:
+    // Throws std::runtime_error when path can't be opened or mapped.
+    MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Page-aligned start of the content. nullptr when the file is empty.
+    const char* data() const;
+    size_t size() const;
+private:
+    const char* content;
+    size_t content_size;
+};
+
+}  // namespace
@@ -16,8 +16,9 @@
 
 namespace pentatope {
 
+// Material can be shared by many objects (e.g. all leaves of trees).
 using Object = std::pair<
     std::unique_ptr<Geometry>,
-    std::unique_ptr<Material>>;
+    std::shared_ptr<Material>>;
 
 }  // namespace
@@ -0,0 +1,256 @@
+// Simple shapes in blocks of 4 in SoA layout, so that a single SSE
+// kernel tests a ray against all shapes in a block.
+// There's no block of OBBs: the scalar test already fills SSE lanes
+// with its 4x4 matrix, and a block needs a division per axis.
+// Defined inline, since they're in the innermost loop of traversal.
+//
+// Kernels compute the same expressions in the same order as
+// the scalar tests in geometry.h (including the order Eigen sums dot
+// products in), so they return bitwise identical hits.
+#pragma once
+
+#include <xmmintrin.h>
+
+#include <boost/optional.hpp>
+#include <boost/range/irange.hpp>
+#include <Eigen/Dense>
+
+#include <geometry.h>
+#include <space.h>
+
+namespace pentatope {
+
+// Number of shapes in a block.
+const int primitive_block_width = 4;
+
+namespace block_kernel {
+
+// A ray broadcasted to 4 SSE lanes.
+struct RayLanes {
+    RayLanes(const Ray& ray) :
+            t_min(_mm_set1_ps(ray.t_min)), t_max(_mm_set1_ps(ray.t_max)) {
+        for(const int axis : boost::irange(0, 4)) {
+            origin[axis] = _mm_set1_ps(ray.origin(axis));
+            direction[axis] = _mm_set1_ps(ray.direction(axis));
+        }
+    }
+
+    __m128 origin[4];
+    __m128 direction[4];
+    __m128 t_min;
+    __m128 t_max;
+};
+
+// a.dot(b) for 4-d vectors in SoA layout, summed in the same order as
+// Eigen does for Vector4f.
+inline __m128 dot(const __m128 a[4], const __m128 b[4]) {
+    return _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[2], b[2])),
+        _mm_add_ps(_mm_mul_ps(a[1], b[1]), _mm_mul_ps(a[3], b[3])));
+}
+
+// -a, exactly like negating a float.
+inline __m128 negate(__m128 a) {
+    return _mm_xor_ps(a, _mm_set1_ps(-0.0f));
+}
+
+// mask ? a : b
+inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Load [axis][lane] array as SoA vector.
+inline void load(const float soa[4][primitive_block_width], __m128 v[4]) {
+    for(const int axis : boost::irange(0, 4)) {
+        v[axis] = _mm_load_ps(soa[axis]);
+    }
+}
+
+// Returns the nearest hit among lanes that are valid and in lane_mask,
+// and stores its lane to lane. uvw is optional.
+inline boost::optional<RayHit> nearestHit(
+        __m128 t, __m128 valid, int lane_mask, int& lane,
+        const __m128* uvw = nullptr) {
+    const int valid_mask = _mm_movemask_ps(valid) & lane_mask;
+    if(valid_mask == 0) {
+        return boost::none;
+    }
+    alignas(16) float ts[primitive_block_width];
+    _mm_store_ps(ts, t);
+    lane = -1;
+    for(const int i : boost::irange(0, primitive_block_width)) {
+        if((valid_mask & (1 << i)) && (lane < 0 || ts[i] < ts[lane])) {
+            lane = i;
+        }
+    }
+    Eigen::Vector3f uvw_lane = Eigen::Vector3f::Zero();
+    if(uvw) {
+        alignas(16) float uvws[3][primitive_block_width];
+        for(const int i : boost::irange(0, 3)) {
+            _mm_store_ps(uvws[i], uvw[i]);
+            uvw_lane(i) = uvws[i][lane];
+        }
+    }
+    return RayHit(ts[lane], uvw_lane);
+}
+
+}  // namespace block_kernel
+
+
+// Each block returns the nearest hit in (ray.t_min, ray.t_max) among
+// lanes in lane_mask (bit i for lane i), and stores its lane to lane.
+// Lanes not in lane_mask can be left uninitialized (zero).
+
+// SphereData of up to 4 spheres.
+struct SphereBlock {
+    // [axis][lane]
+    alignas(16) float center[4][primitive_block_width];
+    alignas(16) float radius[primitive_block_width];
+
+    void set(int lane, const SphereData& data) {
+        for(const int axis : boost::irange(0, 4)) {
+            center[axis][lane] = data.center(axis);
+        }
+        radius[lane] = data.radius;
+    }
+
+    boost::optional<RayHit> intersect(
+            const Ray& ray, int lane_mask, int& lane) const {
+        using namespace block_kernel;
+        const RayLanes r(ray);
+        __m128 delta[4];
+        for(const int axis : boost::irange(0, 4)) {
+            delta[axis] = _mm_sub_ps(
+                r.origin[axis], _mm_load_ps(center[axis]));
+        }
+        const float a = ray.direction.squaredNorm();
+        const __m128 b = _mm_mul_ps(_mm_set1_ps(2), dot(delta, r.direction));
+        const __m128 radius_v = _mm_load_ps(radius);
+        const __m128 c = _mm_sub_ps(
+            dot(delta, delta), _mm_mul_ps(radius_v, radius_v));
+        const __m128 det = _mm_sub_ps(_mm_mul_ps(b, b),
+            _mm_mul_ps(_mm_set1_ps(4 * a), c));
+        const __m128 valid_det = _mm_cmpge_ps(det, _mm_setzero_ps());
+        // Lanes with negative det are rejected anyway.
+        const __m128 sqrt_det = _mm_sqrt_ps(_mm_max_ps(det, _mm_setzero_ps()));
+        const __m128 a2 = _mm_set1_ps(2 * a);
+        const __m128 neg_b = negate(b);
+        const __m128 t0 = _mm_div_ps(_mm_sub_ps(neg_b, sqrt_det), a2);
+        const __m128 t1 = _mm_div_ps(_mm_add_ps(neg_b, sqrt_det), a2);
+        const __m128 t = select(_mm_cmpgt_ps(t0, r.t_min), t0, t1);
+        const __m128 valid = _mm_and_ps(valid_det, _mm_and_ps(
+            _mm_cmpgt_ps(t, r.t_min), _mm_cmplt_ps(t, r.t_max)));
+        return nearestHit(t, valid, lane_mask, lane);
+    }
+};
+
+// DiscData of up to 4 discs.
+struct DiscBlock {
+    // [axis][lane]
+    alignas(16) float center[4][primitive_block_width];
+    alignas(16) float normal[4][primitive_block_width];
+    alignas(16) float radius[primitive_block_width];
+    alignas(16) float d[primitive_block_width];
+
+    void set(int lane, const DiscData& data) {
+        for(const int axis : boost::irange(0, 4)) {
+            center[axis][lane] = data.center(axis);
+            normal[axis][lane] = data.normal(axis);
+        }
+        radius[lane] = data.radius;
+        d[lane] = data.d;
+    }
+
+    boost::optional<RayHit> intersect(
+            const Ray& ray, int lane_mask, int& lane) const {
+        using namespace block_kernel;
+        const RayLanes r(ray);
+        __m128 n[4];
+        load(normal, n);
+        const __m128 perp_dir = dot(n, r.direction);
+        // NaN (from 0 / 0) fails all ordered comparisons, so
+        // parallel rays are rejected here.
+        const __m128 t = _mm_div_ps(
+            _mm_sub_ps(_mm_load_ps(d), dot(n, r.origin)), perp_dir);
+        __m128 valid = _mm_and_ps(
+            _mm_cmpneq_ps(perp_dir, _mm_setzero_ps()),
+            _mm_and_ps(
+                _mm_cmpgt_ps(t, r.t_min), _mm_cmplt_ps(t, r.t_max)));
+        if(_mm_movemask_ps(valid) == 0) {
+            return boost::none;
+        }
+        __m128 delta[4];
+        for(const int axis : boost::irange(0, 4)) {
+            delta[axis] = _mm_sub_ps(
+                _mm_add_ps(r.origin[axis], _mm_mul_ps(r.direction[axis], t)),
+                _mm_load_ps(center[axis]));
+        }
+        const __m128 radius_v = _mm_load_ps(radius);
+        valid = _mm_and_ps(valid, _mm_cmple_ps(
+            dot(delta, delta), _mm_mul_ps(radius_v, radius_v)));
+        return nearestHit(t, valid, lane_mask, lane);
+    }
+};
+
+// TetrahedronBasis of up to 4 tetrahedra. Hits have barycentric
+// coordinates in uvw.
+struct TetrahedronBlock {
+    // [axis][lane]
+    alignas(16) float normal[4][primitive_block_width];
+    alignas(16) float distance[primitive_block_width];
+    // [barycentric coordinate][axis][lane]
+    alignas(16) float basis[3][4][primitive_block_width];
+    alignas(16) float offset[3][primitive_block_width];
+
+    void set(int lane, const TetrahedronBasis& data) {
+        for(const int axis : boost::irange(0, 4)) {
+            normal[axis][lane] = data.normal()(axis);
+            for(const int i : boost::irange(0, 3)) {
+                basis[i][axis][lane] = data.barycentricBasis(i)(axis);
+            }
+        }
+        distance[lane] = data.distance();
+        for(const int i : boost::irange(0, 3)) {
+            offset[i][lane] = data.barycentricOffset(i);
+        }
+    }
+
+    boost::optional<RayHit> intersect(
+            const Ray& ray, int lane_mask, int& lane) const {
+        using namespace block_kernel;
+        const RayLanes r(ray);
+        __m128 n[4];
+        load(normal, n);
+        const __m128 perp_dir = dot(n, r.direction);
+        const __m128 t = _mm_div_ps(
+            _mm_sub_ps(_mm_load_ps(distance), dot(n, r.origin)), perp_dir);
+        // NaN (from 0 / 0) fails all ordered comparisons, so
+        // parallel rays and degenerate tetrahedra are rejected here.
+        __m128 valid = _mm_and_ps(
+            _mm_cmpneq_ps(perp_dir, _mm_setzero_ps()),
+            _mm_and_ps(
+                _mm_cmpgt_ps(t, r.t_min), _mm_cmplt_ps(t, r.t_max)));
+        if((_mm_movemask_ps(valid) & lane_mask) == 0) {
+            return boost::none;
+        }
+
+        __m128 pos[4];
+        for(const int axis : boost::irange(0, 4)) {
+            pos[axis] = _mm_add_ps(
+                r.origin[axis], _mm_mul_ps(r.direction[axis], t));
+        }
+        __m128 uvw[3];
+        for(const int i : boost::irange(0, 3)) {
+            __m128 b[4];
+            load(basis[i], b);
+            uvw[i] = _mm_add_ps(dot(b, pos), _mm_load_ps(offset[i]));
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(uvw[i], _mm_setzero_ps()));
+        }
+        // Eigen sums 3 coefficients in order.
+        const __m128 uvw_sum = _mm_add_ps(_mm_add_ps(uvw[0], uvw[1]), uvw[2]);
+        valid = _mm_and_ps(valid, _mm_cmple_ps(uvw_sum, _mm_set1_ps(1)));
+        return nearestHit(t, valid, lane_mask, lane, uvw);
+    }
+};
+
+}  // namespace
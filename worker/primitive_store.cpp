@@ -0,0 +1,155 @@
+#include "primitive_store.h"
+
+#include <boost/range/irange.hpp>
+
+namespace pentatope {
+
+namespace {
+
+std::vector<int> allIndices(int n) {
+    std::vector<int> indices;
+    indices.reserve(n);
+    for(const int i : boost::irange(0, n)) {
+        indices.push_back(i);
+    }
+    return indices;
+}
+
+}  // namespace
+
+PrimitiveStore::PrimitiveStore() {
+}
+
+PrimitiveStore::PrimitiveStore(
+        const std::vector<const Geometry*>& geometries) :
+        PrimitiveStore(geometries, allIndices(geometries.size())) {
+}
+
+PrimitiveStore::PrimitiveStore(
+        const std::vector<const Geometry*>& geometries,
+        const std::vector<int>& group_begins) {
+    const int n = geometries.size();
+    std::vector<bool> is_group_begin(n, false);
+    for(const int index : group_begins) {
+        assert(0 <= index && index < n);
+        is_group_begin[index] = true;
+    }
+    std::vector<Type> types;
+    types.reserve(n);
+    for(const auto geometry : geometries) {
+        types.push_back(typeOf(geometry));
+    }
+
+    entries.reserve(n);
+    int first = 0;
+    while(first < n) {
+        // Run of the same type within a group, up to a block.
+        const Type type = types[first];
+        const bool pack = packable(geometries[first]);
+        int end = first + 1;
+        while(pack && end < n &&
+                end - first < primitive_block_width &&
+                !is_group_begin[end] && types[end] == type) {
+            end++;
+        }
+        const int n_lanes = end - first;
+        for(const int lane : boost::irange(0, n_lanes)) {
+            const Geometry* geometry = geometries[first + lane];
+            Entry entry;
+            entry.lane = lane;
+            entry.n_lanes = n_lanes;
+            if(n_lanes == 1) {
+                entry.type = type;
+                if(type == Type::SPHERE) {
+                    entry.offset = spheres.size();
+                    spheres.push_back(
+                        static_cast<const Sphere*>(geometry)->getData());
+                } else if(type == Type::DISC) {
+                    entry.offset = discs.size();
+                    discs.push_back(
+                        static_cast<const Disc*>(geometry)->getData());
+                } else if(type == Type::OBB) {
+                    entry.offset = obbs.size();
+                    obbs.push_back(
+                        static_cast<const OBB*>(geometry)->getData());
+                } else if(type == Type::TETRAHEDRON) {
+                    entry.offset = tetrahedra.size();
+                    tetrahedra.push_back(
+                        static_cast<const Tetrahedron*>(geometry)->getBasis());
+                } else {
+                    entry.offset = this->geometries.size();
+                    this->geometries.push_back(geometry);
+                }
+            } else if(type == Type::SPHERE) {
+                entry.type = Type::SPHERE_BLOCK;
+                if(lane == 0) {
+                    sphere_blocks.emplace_back();
+                }
+                entry.offset = sphere_blocks.size() - 1;
+                sphere_blocks.back().set(lane,
+                    static_cast<const Sphere*>(geometry)->getData());
+            } else if(type == Type::DISC) {
+                entry.type = Type::DISC_BLOCK;
+                if(lane == 0) {
+                    disc_blocks.emplace_back();
+                }
+                entry.offset = disc_blocks.size() - 1;
+                disc_blocks.back().set(lane,
+                    static_cast<const Disc*>(geometry)->getData());
+            } else {
+                assert(type == Type::TETRAHEDRON);
+                entry.type = Type::TETRAHEDRON_BLOCK;
+                if(lane == 0) {
+                    tetrahedron_blocks.emplace_back();
+                }
+                entry.offset = tetrahedron_blocks.size() - 1;
+                tetrahedron_blocks.back().set(lane,
+                    static_cast<const Tetrahedron*>(geometry)->getBasis());
+            }
+            entries.push_back(entry);
+        }
+        first = end;
+    }
+}
+
+int PrimitiveStore::size() const {
+    return entries.size();
+}
+
+size_t PrimitiveStore::memoryUsage() const {
+    return entries.capacity() * sizeof(Entry) +
+        spheres.capacity() * sizeof(SphereData) +
+        discs.capacity() * sizeof(DiscData) +
+        obbs.capacity() * sizeof(OBBData) +
+        tetrahedra.capacity() * sizeof(TetrahedronBasis) +
+        geometries.capacity() * sizeof(const Geometry*) +
+        sphere_blocks.capacity() * sizeof(SphereBlock) +
+        disc_blocks.capacity() * sizeof(DiscBlock) +
+        tetrahedron_blocks.capacity() * sizeof(TetrahedronBlock);
+}
+
+int PrimitiveStore::blockKind(const Geometry* geometry) {
+    return static_cast<int>(typeOf(geometry));
+}
+
+bool PrimitiveStore::packable(const Geometry* geometry) {
+    const Type type = typeOf(geometry);
+    return type == Type::SPHERE || type == Type::DISC ||
+        type == Type::TETRAHEDRON;
+}
+
+PrimitiveStore::Type PrimitiveStore::typeOf(const Geometry* geometry) {
+    if(dynamic_cast<const Sphere*>(geometry)) {
+        return Type::SPHERE;
+    } else if(dynamic_cast<const Disc*>(geometry)) {
+        return Type::DISC;
+    } else if(dynamic_cast<const OBB*>(geometry)) {
+        return Type::OBB;
+    } else if(dynamic_cast<const Tetrahedron*>(geometry)) {
+        return Type::TETRAHEDRON;
+    } else {
+        return Type::GEOMETRY;
+    }
+}
+
+}  // namespace
@@ -0,0 +1,169 @@
+// Devirtualized storage of primitives for traversal loops.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <boost/optional.hpp>
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+#include <geometry.h>
+#include <primitive_block.h>
+#include <space.h>
+
+namespace pentatope {
+
+// Copies of simple shapes (Sphere, Disc, OBB, Tetrahedron) packed into
+// contiguous per-type arrays of compact data, so that ray tests don't
+// chase a pointer per primitive nor call virtually, and can be inlined
+// into traversal loops.
+// Other shapes (e.g. TetraMesh, Instance) are tested through Geometry.
+//
+// Consecutive packable shapes of the same type in a group (e.g. a BVH
+// leaf) are packed into SoA blocks (see primitive_block.h), and tested
+// together by intersectRange. Callers should sort shapes in each group
+// by blockKind, so that each group is tested by as few blocks as
+// possible.
+class PrimitiveStore {
+public:
+    // Create an empty store.
+    PrimitiveStore();
+
+    // Index i of the store refers to geometries[i].
+    // Geometries that are not copied must outlive this.
+    // Each primitive is its own group, for callers that test them
+    // one by one (e.g. GridAccel).
+    PrimitiveStore(const std::vector<const Geometry*>& geometries);
+
+    // Same as above, but groups start at indices in group_begins
+    // (and at 0).
+    PrimitiveStore(
+        const std::vector<const Geometry*>& geometries,
+        const std::vector<int>& group_begins);
+
+    // Same as geometries[index]->intersectHit(ray).
+    boost::optional<RayHit> intersectHit(int index, const Ray& ray) const;
+
+    // The nearest hit among geometries[first, first + count), with index
+    // set to the index of the hit geometry.
+    boost::optional<RayHit> intersectRange(
+        int first, int count, const Ray& ray) const;
+
+    int size() const;
+
+    // Bytes used by the packed arrays.
+    size_t memoryUsage() const;
+
+    // Geometries of the same kind can share a block.
+    static int blockKind(const Geometry* geometry);
+
+    // Whether geometry can share a block with others of the same kind.
+    // Spheres, Discs and Tetrahedra can; OBBs are always tested alone
+    // (see primitive_block.h).
+    static bool packable(const Geometry* geometry);
+private:
+    enum class Type : uint8_t {
+        SPHERE,
+        DISC,
+        OBB,
+        TETRAHEDRON,
+        // Anything else, tested by Geometry::intersectHit.
+        GEOMETRY,
+        // Blocks of 2 or more shapes.
+        SPHERE_BLOCK,
+        DISC_BLOCK,
+        TETRAHEDRON_BLOCK
+    };
+
+    // Where a primitive is: lane of arrays[type][offset].
+    // Types other than blocks always have a single lane.
+    struct Entry {
+        Type type;
+        // Lane of this primitive, and number of lanes used by the block.
+        uint8_t lane;
+        uint8_t n_lanes;
+        uint32_t offset;
+    };
+
+    // Type of geometry when it's not in a block.
+    static Type typeOf(const Geometry* geometry);
+
+    // Nearest hit in lanes of lane_mask of the block of entry.
+    boost::optional<RayHit> intersectBlock(
+        const Entry& entry, const Ray& ray, int lane_mask, int& lane) const;
+
+    template<typename T>
+    using AlignedVector = std::vector<T, Eigen::aligned_allocator<T>>;
+
+    std::vector<Entry> entries;
+    AlignedVector<SphereData> spheres;
+    AlignedVector<DiscData> discs;
+    AlignedVector<OBBData> obbs;
+    AlignedVector<TetrahedronBasis> tetrahedra;
+    std::vector<const Geometry*> geometries;
+    AlignedVector<SphereBlock> sphere_blocks;
+    AlignedVector<DiscBlock> disc_blocks;
+    AlignedVector<TetrahedronBlock> tetrahedron_blocks;
+};
+
+
+inline boost::optional<RayHit> PrimitiveStore::intersectBlock(
+        const Entry& entry, const Ray& ray, int lane_mask, int& lane) const {
+    lane = 0;
+    switch(entry.type) {
+    case Type::SPHERE:
+        return spheres[entry.offset].intersect(ray);
+    case Type::DISC:
+        return discs[entry.offset].intersect(ray);
+    case Type::OBB:
+        return obbs[entry.offset].intersect(ray);
+    case Type::TETRAHEDRON:
+        return tetrahedra[entry.offset].intersect(ray);
+    case Type::GEOMETRY:
+        return geometries[entry.offset]->intersectHit(ray);
+    case Type::SPHERE_BLOCK:
+        return sphere_blocks[entry.offset].intersect(ray, lane_mask, lane);
+    case Type::DISC_BLOCK:
+        return disc_blocks[entry.offset].intersect(ray, lane_mask, lane);
+    case Type::TETRAHEDRON_BLOCK:
+        return tetrahedron_blocks[entry.offset].intersect(
+            ray, lane_mask, lane);
+    }
+    assert(false);
+    return boost::none;
+}
+
+inline boost::optional<RayHit> PrimitiveStore::intersectHit(
+        int index, const Ray& ray) const {
+    const Entry& entry = entries[index];
+    int lane;
+    return intersectBlock(entry, ray, 1 << entry.lane, lane);
+}
+
+inline boost::optional<RayHit> PrimitiveStore::intersectRange(
+        int first, int count, const Ray& ray) const {
+    boost::optional<RayHit> hit_nearest;
+    // Shrinks as nearer hits are found.
+    Ray query(ray);
+    const int end = first + count;
+    int i = first;
+    while(i < end) {
+        const Entry& entry = entries[i];
+        // Lanes of the block within [i, end).
+        const int n = std::min<int>(entry.n_lanes - entry.lane, end - i);
+        int lane;
+        const auto hit = intersectBlock(
+            entry, query, ((1 << n) - 1) << entry.lane, lane);
+        if(hit) {
+            hit_nearest = hit;
+            hit_nearest->index = i + lane - entry.lane;
+            query.t_max = hit->t;
+        }
+        i += n;
+    }
+    return hit_nearest;
+}
+
+}  // namespace
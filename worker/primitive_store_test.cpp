@@ -0,0 +1,166 @@
+#include "primitive_store.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <boost/range/irange.hpp>
+#include <gtest/gtest.h>
+
+#include <arbitrary_test.h>
+
+
+namespace {
+
+// All kinds of geometries, some of which are packed by PrimitiveStore.
+struct ArbitraryGeometries {
+    ArbitraryGeometries(std::mt19937& rg) {
+        std::uniform_real_distribution<float> coord(-100, 100);
+        std::uniform_real_distribution<float> angle(0, 2 * pentatope::pi);
+        auto randomPoint = [&]() {
+            return Eigen::Vector4f(coord(rg), coord(rg), coord(rg), coord(rg));
+        };
+
+        // Spheres and Discs.
+        objs = arbitraryObjects(rg, 200);
+        for(const int i : boost::irange(0, 50)) {
+            // Rotate in xy and zw planes.
+            const float a = angle(rg);
+            const float b = angle(rg);
+            Eigen::Matrix4f rot = Eigen::Matrix4f::Zero();
+            rot(0, 0) = std::cos(a);
+            rot(0, 1) = -std::sin(a);
+            rot(1, 0) = std::sin(a);
+            rot(1, 1) = std::cos(a);
+            rot(2, 2) = std::cos(b);
+            rot(2, 3) = -std::sin(b);
+            rot(3, 2) = std::sin(b);
+            rot(3, 3) = std::cos(b);
+            extras.push_back(std::make_unique<pentatope::OBB>(
+                pentatope::Pose(rot, randomPoint()),
+                Eigen::Vector4f(10, 20, 5, 15)));
+
+            const Eigen::Vector4f base = randomPoint();
+            extras.push_back(std::make_unique<pentatope::Tetrahedron>(
+                std::array<Eigen::Vector4f, 4>({
+                    base,
+                    base + Eigen::Vector4f(30, 0, 0, 5),
+                    base + Eigen::Vector4f(0, 30, 0, -5),
+                    base + Eigen::Vector4f(0, 0, 30, 10)})));
+
+            // Not packed.
+            extras.push_back(std::make_unique<pentatope::AABB>(
+                base, base + Eigen::Vector4f(10, 10, 10, 10)));
+        }
+
+        for(const auto& obj : objs) {
+            geometries.push_back(obj.first.get());
+        }
+        for(const auto& extra : extras) {
+            geometries.push_back(extra.get());
+        }
+    }
+
+    std::vector<pentatope::Object> objs;
+    std::vector<std::unique_ptr<pentatope::Geometry>> extras;
+    std::vector<const pentatope::Geometry*> geometries;
+};
+
+}  // namespace
+
+
+TEST(PrimitiveStore, BehaveIdenticallyToGeometry) {
+    std::mt19937 rg;
+    ArbitraryGeometries arbitrary(rg);
+    auto& geometries = arbitrary.geometries;
+    std::stable_sort(geometries.begin(), geometries.end(),
+        [](const pentatope::Geometry* a, const pentatope::Geometry* b) {
+            return pentatope::PrimitiveStore::blockKind(a) <
+                pentatope::PrimitiveStore::blockKind(b);
+        });
+    // Not packed, and packed into blocks as much as possible.
+    const pentatope::PrimitiveStore stores[] = {
+        pentatope::PrimitiveStore(geometries),
+        pentatope::PrimitiveStore(geometries, std::vector<int>())
+    };
+    for(const auto& store : stores) {
+        ASSERT_EQ(geometries.size(), store.size());
+
+        int n_hits = 0;
+        for(const int i : boost::irange(0, 200)) {
+            const auto ray = arbitraryRay(rg);
+            for(const int j : boost::irange(0, store.size())) {
+                const auto expected = geometries[j]->intersectHit(ray);
+                const auto hit = store.intersectHit(j, ray);
+                ASSERT_EQ(
+                    static_cast<bool>(expected), static_cast<bool>(hit));
+                if(hit) {
+                    EXPECT_EQ(expected->t, hit->t);
+                    EXPECT_EQ(expected->uvw, hit->uvw);
+                    n_hits++;
+                }
+            }
+        }
+        EXPECT_LT(0, n_hits);
+    }
+}
+
+TEST(PrimitiveStore, RangeFindsNearestInRange) {
+    std::mt19937 rg;
+    ArbitraryGeometries arbitrary(rg);
+    // Put the same kinds next to each other to fill blocks, and start
+    // groups at random places so that some blocks are partially filled.
+    auto& geometries = arbitrary.geometries;
+    std::stable_sort(geometries.begin(), geometries.end(),
+        [](const pentatope::Geometry* a, const pentatope::Geometry* b) {
+            return pentatope::PrimitiveStore::blockKind(a) <
+                pentatope::PrimitiveStore::blockKind(b);
+        });
+    std::vector<int> group_begins;
+    for(const int i : boost::irange(0, static_cast<int>(geometries.size()))) {
+        if(std::bernoulli_distribution(0.2)(rg)) {
+            group_begins.push_back(i);
+        }
+    }
+    const pentatope::PrimitiveStore store(geometries, group_begins);
+    ASSERT_EQ(geometries.size(), store.size());
+
+    std::uniform_int_distribution<int> index(0, store.size() - 1);
+    int n_hits = 0;
+    for(const int i : boost::irange(0, 2000)) {
+        // Ranges that don't necessarily align with blocks, and rays of
+        // various lengths towards one of them.
+        const int first = index(rg);
+        const int count = std::min(
+            store.size() - first,
+            std::uniform_int_distribution<int>(1, 12)(rg));
+        const Eigen::Vector4f target = geometries[
+            std::uniform_int_distribution<int>(first, first + count - 1)(rg)]->
+            bounds().center();
+        const auto ray_base = arbitraryRay(rg);
+        const pentatope::Ray ray(
+            ray_base.origin, (target - ray_base.origin).normalized(), 0,
+            std::uniform_real_distribution<float>(50, 300)(rg));
+
+        boost::optional<pentatope::RayHit> expected;
+        int expected_index = -1;
+        for(const int j : boost::irange(first, first + count)) {
+            const auto hit = geometries[j]->intersectHit(ray);
+            if(hit && (!expected || hit->t < expected->t)) {
+                expected = hit;
+                expected_index = j;
+            }
+        }
+        const auto hit = store.intersectRange(first, count, ray);
+        ASSERT_EQ(static_cast<bool>(expected), static_cast<bool>(hit));
+        if(hit) {
+            EXPECT_EQ(expected_index, hit->index);
+            EXPECT_EQ(expected->t, hit->t);
+            EXPECT_EQ(expected->uvw, hit->uvw);
+            n_hits++;
+        }
+    }
+    EXPECT_LT(0, n_hits);
+}
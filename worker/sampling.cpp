@@ -1,69 +1,191 @@
 #include "sampling.h"
 
-#include <limits>
-
-#include <boost/range/irange.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
 
 
 namespace pentatope {
 
-Sampler::Sampler() {
-}
+namespace {
 
-Eigen::Vector4f Sampler::uniformHemisphere(const Eigen::Vector4f& normal) {
-    std::uniform_real_distribution<float> interval(-1, 1);
-    Eigen::Vector4f result;
-    while(true) {
-        result = Eigen::Vector4f(
-            interval(gen),
-            interval(gen),
-            interval(gen),
-            interval(gen));
-        const float radius = result.norm();
-        if(radius > 1 || radius == 0) {
-            continue;
-        }
-        const float cosine = result.dot(normal);
-        if(cosine >= 0) {
-            result /= radius;
-        } else {
-            result /= -radius;
+// Number of dimensions that use Halton sequence.
+const int halton_dimensions = 256;
+
+// Prime bases of Halton sequence, one for each dimension.
+const std::vector<int>& haltonBases() {
+    static const std::vector<int> bases = []() {
+        std::vector<int> primes;
+        for(int n = 2; static_cast<int>(primes.size()) < halton_dimensions; n++) {
+            const bool is_prime = std::all_of(primes.begin(), primes.end(),
+                [n](int p) { return n % p != 0; });
+            if(is_prime) {
+                primes.push_back(n);
+            }
         }
-        return result;
+        return primes;
+    }();
+    return bases;
+}
+
+// Finalizer of MurmurHash3. Maps similar inputs to unrelated outputs.
+uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Radical inverse of index in base, with k-th digit d replaced by
+// (mult_k * d + shift_k) mod base, where 0 < mult_k < base.
+// That's a permutation of digits since base is prime.
+// mult_k and shift_k are derived from seed.
+// Digits are continued beyond index, because zeros are scrambled too.
+//
+// A shift alone keeps the first digits of consecutive indices
+// consecutive. In large bases, a few samples then fall in a narrow
+// window, and neighboring dimensions are strongly correlated.
+float scrambledRadicalInverse(int base, uint32_t index, uint64_t seed) {
+    const double inv_base = 1.0 / base;
+    double scale = inv_base;
+    double result = 0;
+    for(int k = 0; scale > 1e-8; k++) {
+        const uint64_t hash = mix64(seed + k);
+        const uint64_t mult = 1 + (hash >> 32) % (base - 1);
+        const uint64_t shift = (hash & 0xffffffff) % base;
+        const int digit = (mult * (index % base) + shift) % base;
+        result += digit * scale;
+        index /= base;
+        scale *= inv_base;
     }
+    return std::min(static_cast<float>(result),
+        std::nextafter(1.0f, 0.0f));
 }
 
+}  // namespace
 
-Eigen::Vector4f Sampler::uniformSphere() {
-    std::uniform_real_distribution<float> interval(-1, 1);
-    Eigen::Vector4f result;
-    while(true) {
-        result = Eigen::Vector4f(
-            interval(gen),
-            interval(gen),
-            interval(gen),
-            interval(gen));
-        const float radius = result.norm();
-        if(radius > 1 || radius == 0) {
-            continue;
-        }
-        result /= radius;
-        return result;
+std::array<uint32_t, 4> philox4x32(
+        std::array<uint32_t, 4> counter, std::array<uint32_t, 2> key) {
+    for(int round = 0; round < 10; round++) {
+        const uint64_t p0 = 0xD2511F53ULL * counter[0];
+        const uint64_t p1 = 0xCD9E8D57ULL * counter[2];
+        counter = {{
+            static_cast<uint32_t>(p1 >> 32) ^ counter[1] ^ key[0],
+            static_cast<uint32_t>(p1),
+            static_cast<uint32_t>(p0 >> 32) ^ counter[3] ^ key[1],
+            static_cast<uint32_t>(p0)}};
+        key[0] += 0x9E3779B9;
+        key[1] += 0xBB67AE85;
+    }
+    return counter;
+}
+
+const int Sampler::pixel_dimensions;
+const int Sampler::bounce_dimensions;
+
+Sampler::Sampler(Sequence sequence, uint64_t seed) :
+        sequence(sequence), seed(seed),
+        pixel(0), sample_index(0), dimension(0) {
+}
+
+void Sampler::startPixelSample(uint64_t pixel, uint32_t sample_index) {
+    this->pixel = pixel;
+    this->sample_index = sample_index;
+    dimension = 0;
+}
+
+void Sampler::startBounce(int depth) {
+    assert(depth >= 0);
+    dimension = pixel_dimensions + depth * bounce_dimensions;
+}
+
+float Sampler::next1D() {
+    const int dim = dimension++;
+    if(sequence == Sequence::HALTON && dim < halton_dimensions) {
+        // Hash seed alone first. Combining seed and pixel linearly
+        // (e.g. seed ^ pixel) would make seed s at pixel p identical to
+        // seed 0 at pixel p ^ s, and seeds of movie frames are
+        // consecutive.
+        const uint64_t pixel_key = mix64(mix64(seed) + pixel);
+        return scrambledRadicalInverse(haltonBases()[dim], sample_index,
+            mix64(pixel_key ^ (static_cast<uint64_t>(dim) << 40)));
+    } else {
+        const auto bits = philox4x32(
+            {{static_cast<uint32_t>(pixel), static_cast<uint32_t>(pixel >> 32),
+                sample_index, static_cast<uint32_t>(dim)}},
+            {{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)}});
+        // Top 24 bits, which floats in [0, 1) can represent exactly.
+        return (bits[0] >> 8) * (1.0f / (1 << 24));
     }
 }
 
-std::vector<Sampler> Sampler::split(int n) {
-    assert(n >= 0);
-    std::uniform_int_distribution<uint64_t> prob_seed(
-        std::numeric_limits<uint64_t>::min(),
-        std::numeric_limits<uint64_t>::max());
-    std::vector<Sampler> samplers;
-    for(int i : boost::irange(0, n)) {
-        Sampler s = *this;
-        s.gen.seed(prob_seed(gen));
-        samplers.push_back(s);
+Eigen::Vector4f Sampler::uniformHemisphere(const Eigen::Vector4f& normal) {
+    const Eigen::Vector4f result = uniformSphere();
+    return (result.dot(normal) >= 0) ?
+        result : static_cast<Eigen::Vector4f>(-result);
+}
+
+// Malley's method extended to 4-d: uniform points in the 3-d unit ball,
+// lifted to the hemisphere, are distributed by cosine.
+Eigen::Vector4f Sampler::cosineHemisphere(const Eigen::Vector4f& normal) {
+    const float z = 2 * next1D() - 1;
+    const float phi = 2 * pi * next1D();
+    const float radius = std::cbrt(next1D());
+    const float r_xy = radius * std::sqrt(std::max(0.0f, 1 - z * z));
+    // Sample around (0, 0, 0, 1).
+    const Eigen::Vector4f local(
+        r_xy * std::cos(phi),
+        r_xy * std::sin(phi),
+        radius * z,
+        std::sqrt(std::max(0.0f, 1 - radius * radius)));
+
+    // Householder reflection that swaps (0, 0, 0, 1) and normal.
+    const Eigen::Vector4f v = Eigen::Vector4f(0, 0, 0, 1) - normal;
+    const float v_sq = v.squaredNorm();
+    if(v_sq < 1e-12) {
+        return local;
+    }
+    return local - (2 * v.dot(local) / v_sq) * v;
+}
+
+// Hopf coordinates: two circles with radii sqrt(u) and sqrt(1 - u).
+Eigen::Vector4f Sampler::uniformSphere() {
+    const float u = next1D();
+    const float a = 2 * pi * next1D();
+    const float b = 2 * pi * next1D();
+    const float r0 = std::sqrt(u);
+    const float r1 = std::sqrt(1 - u);
+    return Eigen::Vector4f(
+        r0 * std::cos(a), r0 * std::sin(a),
+        r1 * std::cos(b), r1 * std::sin(b));
+}
+
+std::vector<int> distributeSamples(
+        const std::vector<float>& weights, int64_t budget) {
+    assert(budget >= 0);
+    double total = 0;
+    for(const float weight : weights) {
+        assert(weight >= 0);
+        total += weight;
+    }
+    // Round cumulative sums, so that rounding errors don't add up.
+    std::vector<int> counts;
+    counts.reserve(weights.size());
+    double cumulative = 0;
+    int64_t assigned = 0;
+    for(const float weight : weights) {
+        cumulative += (total > 0) ? weight / total : 1.0 / weights.size();
+        const int64_t next = std::min(budget,
+            static_cast<int64_t>(std::llround(cumulative * budget)));
+        counts.push_back(next - assigned);
+        assigned = next;
+    }
+    if(!counts.empty()) {
+        counts.back() += budget - assigned;
     }
-    return samplers;
+    return counts;
 }
 
 }  // namespace
@@ -1,6 +1,8 @@
 #pragma once
 
-#include <random>
+#include <array>
+#include <cstdint>
+#include <vector>
 
 #include <boost/optional.hpp>
 #include <Eigen/Dense>
@@ -9,18 +11,73 @@
 
 namespace pentatope {
 
+// Source of numbers in [0, 1) for Monte Carlo integration.
+//
+// Numbers are drawn by dimensions of a sample (a path through a pixel),
+// in a fixed layout: first pixel_dimensions for the position in the pixel,
+// then bounce_dimensions for each bounce (see startBounce).
+// This lets a low discrepancy sequence stratify each decision
+// separately from the others.
 class Sampler {
 public:
-    Sampler();
+    enum class Sequence {
+        // Independent pseudo-random numbers, from a counter-based
+        // generator (Philox) keyed by seed.
+        RANDOM,
+        // Halton sequence, with random linear digit scrambling
+        // seeded by seed and pixel.
+        // Dimensions beyond the table of prime bases are pseudo-random.
+        HALTON
+    };
 
-    // Split this Sampler into independent but deterministic Samplers.
-    // All children and this will be independent too.
-    std::vector<Sampler> split(int n);
+    // Dimensions of the position in a pixel.
+    static const int pixel_dimensions = 2;
+    // Dimensions reserved for each bounce of a path.
+    static const int bounce_dimensions = 5;
 
+    // Samplers with different seeds give independent numbers.
+    Sampler(Sequence sequence = Sequence::RANDOM, uint64_t seed = 0);
+
+    // Start sample_index-th sample of pixel, at dimension 0.
+    // Numbers are determined by (seed, pixel, sample_index, dimension)
+    // alone, so any part of an image can be rendered by any thread or
+    // node, and still be identical to rendering the whole at once.
+    // Before the first call, draws are from sample 0 of pixel 0.
+    void startPixelSample(uint64_t pixel, uint32_t sample_index);
+    // Move to the first dimension of depth-th bounce (0 is the first
+    // surface interaction) of the current sample.
+    void startBounce(int depth);
+    // Draw the next dimension of the current sample.
+    float next1D();
+
+    // Unit vectors on the side of normal. normal must be a unit vector.
+    // Uses 3 dimensions.
+    // pdf: 1 / pi^2
     Eigen::Vector4f uniformHemisphere(const Eigen::Vector4f& normal);
+    // Uses 3 dimensions.
+    // pdf: |cos| / (4/3 pi), where cos is between the sample and normal.
+    Eigen::Vector4f cosineHemisphere(const Eigen::Vector4f& normal);
+    // Uses 3 dimensions.
+    // pdf: 1 / (2 pi^2)
     Eigen::Vector4f uniformSphere();
-public:
-    std::mt19937 gen;
+private:
+    Sequence sequence;
+    uint64_t seed;
+
+    // Current sample.
+    uint64_t pixel;
+    uint32_t sample_index;
+    int dimension;
 };
 
+// Philox4x32-10 counter-based generator (Salmon et al. 2011).
+// Different counters give independent outputs for the same key.
+std::array<uint32_t, 4> philox4x32(
+    std::array<uint32_t, 4> counter, std::array<uint32_t, 2> key);
+
+// Split budget into integers proportional to weights (>= 0),
+// which sum to exactly budget. Split evenly when all weights are 0.
+std::vector<int> distributeSamples(
+    const std::vector<float>& weights, int64_t budget);
+
 }  // namespace
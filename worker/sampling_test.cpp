@@ -1,26 +1,197 @@
 #include "sampling.h"
 
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <numeric>
+#include <vector>
+
+#include <boost/range/irange.hpp>
 
 #include <gtest/gtest.h>
 
-TEST(Sampler, splitGeneratesDifferentSequence) {
-    std::uniform_int_distribution<uint64_t> prob_u64(
-        std::numeric_limits<uint64_t>::min(),
-        std::numeric_limits<uint64_t>::max());
-
-    pentatope::Sampler parent;
-    pentatope::Sampler parent_copy = parent;
-    const uint64_t v_parent_prev = prob_u64(parent_copy.gen);
-
-    auto children = parent.split(2);
-    EXPECT_EQ(2, children.size());
-
-    const uint64_t v_parent = prob_u64(parent.gen);
-    EXPECT_NE(v_parent, v_parent_prev);
-    const uint64_t v_c0 = prob_u64(children[0].gen);
-    const uint64_t v_c1 = prob_u64(children[1].gen);
-    EXPECT_NE(v_parent, v_c0);
-    EXPECT_NE(v_parent, v_c1);
-    EXPECT_NE(v_c0, v_c1);
+TEST(Sampler, uniformSphereIsIsotropic) {
+    pentatope::Sampler sampler;
+    const int n = 100000;
+    Eigen::Vector4f mean = Eigen::Vector4f::Zero();
+    Eigen::Vector4f mean_sq = Eigen::Vector4f::Zero();
+    for(int i = 0; i < n; i++) {
+        const Eigen::Vector4f v = sampler.uniformSphere();
+        EXPECT_NEAR(1, v.norm(), 1e-5);
+        mean += v / n;
+        mean_sq += v.cwiseProduct(v) / n;
+    }
+    for(int axis = 0; axis < 4; axis++) {
+        EXPECT_NEAR(0, mean(axis), 0.01);
+        EXPECT_NEAR(0.25, mean_sq(axis), 0.01);
+    }
+}
+
+TEST(Sampler, hemispheresHaveExpectedCosine) {
+    pentatope::Sampler sampler;
+    const Eigen::Vector4f normal =
+        Eigen::Vector4f(1, -2, 0.5, 3).normalized();
+    const int n = 100000;
+    double uniform_cos = 0;
+    double cosine_cos = 0;
+    for(int i = 0; i < n; i++) {
+        const Eigen::Vector4f u = sampler.uniformHemisphere(normal);
+        const Eigen::Vector4f c = sampler.cosineHemisphere(normal);
+        EXPECT_NEAR(1, u.norm(), 1e-5);
+        EXPECT_NEAR(1, c.norm(), 1e-5);
+        EXPECT_LE(0, u.dot(normal));
+        EXPECT_LE(-1e-5, c.dot(normal));
+        uniform_cos += u.dot(normal) / n;
+        cosine_cos += c.dot(normal) / n;
+    }
+    // E[cos] is (1/3 * 4 pi) / pi^2 for uniform, and
+    // (pi / 16 * 4 pi) / (4/3 pi) for cosine-weighted.
+    EXPECT_NEAR(4 / (3 * pentatope::pi), uniform_cos, 0.01);
+    EXPECT_NEAR(3 * pentatope::pi / 16, cosine_cos, 0.01);
+}
+
+TEST(Sampler, isDeterminedBySeedAndPixelSample) {
+    using Sequence = pentatope::Sampler::Sequence;
+    for(const auto sequence : {Sequence::RANDOM, Sequence::HALTON}) {
+        auto draw = [&](uint64_t seed, uint64_t pixel, uint32_t index,
+                int depth) {
+            pentatope::Sampler sampler(sequence, seed);
+            // Some unrelated draws before.
+            sampler.startPixelSample(pixel + 1, index);
+            sampler.uniformSphere();
+            sampler.startPixelSample(pixel, index);
+            sampler.startBounce(depth);
+            return sampler.next1D();
+        };
+        const float v = draw(5, 12, 3, 2);
+        EXPECT_EQ(v, draw(5, 12, 3, 2));
+        EXPECT_NE(v, draw(6, 12, 3, 2));
+        EXPECT_NE(v, draw(5, 13, 3, 2));
+        EXPECT_NE(v, draw(5, 12, 4, 2));
+        EXPECT_NE(v, draw(5, 12, 3, 1));
+    }
+}
+
+TEST(Sampler, seedsDontAliasPixels) {
+    // Consecutive seeds (frames of a movie) must not reuse numbers of
+    // other pixels, as seed ^ pixel would.
+    using Sequence = pentatope::Sampler::Sequence;
+    for(const auto sequence : {Sequence::RANDOM, Sequence::HALTON}) {
+        auto draw = [&](uint64_t seed, uint64_t pixel) {
+            pentatope::Sampler sampler(sequence, seed);
+            sampler.startPixelSample(pixel, 0);
+            return sampler.next1D();
+        };
+        for(const uint64_t seed : boost::irange(1, 8)) {
+            for(const uint64_t pixel : boost::irange(0, 8)) {
+                EXPECT_NE(draw(0, pixel ^ seed), draw(seed, pixel))
+                    << "seed=" << seed << " pixel=" << pixel;
+            }
+        }
+    }
+}
+
+TEST(Sampler, haltonStratifiesEachDimension) {
+    pentatope::Sampler sampler(pentatope::Sampler::Sequence::HALTON);
+    // Dimension 0 and 1 use base 2 and 3. Any base^k consecutive samples
+    // have exactly one sample in each of base^k strata.
+    const int n_strata[] = {64, 81};
+    for(const int pixel : boost::irange(0, 10)) {
+        for(const int dim : boost::irange(0, 2)) {
+            const int n = n_strata[dim];
+            std::vector<int> counts(n, 0);
+            for(const int i : boost::irange(0, n)) {
+                sampler.startPixelSample(pixel, i);
+                float v = sampler.next1D();
+                if(dim == 1) {
+                    v = sampler.next1D();
+                }
+                ASSERT_LE(0, v);
+                ASSERT_GT(1, v);
+                counts[static_cast<int>(v * n)]++;
+            }
+            for(const int count : counts) {
+                EXPECT_EQ(1, count);
+            }
+        }
+    }
+}
+
+TEST(Sampler, haltonCoversHighDimensions) {
+    using Sequence = pentatope::Sampler::Sequence;
+    // Bounce 1, 3 and 6 of 16 samples / px. For each pixel, measure the
+    // largest gap between sorted samples of a dimension, and correlation
+    // with the next dimension. Random numbers give about 0.20 for both.
+    const int n_samples = 16;
+    const int n_pixels = 2000;
+    for(const int depth : {1, 3, 6}) {
+        pentatope::Sampler sampler(Sequence::HALTON);
+        double mean_gap = 0;
+        double mean_abs_corr = 0;
+        for(const int pixel : boost::irange(0, n_pixels)) {
+            std::vector<float> xs;
+            std::vector<float> ys;
+            for(const int i : boost::irange(0, n_samples)) {
+                sampler.startPixelSample(pixel, i);
+                sampler.startBounce(depth);
+                xs.push_back(sampler.next1D());
+                ys.push_back(sampler.next1D());
+            }
+            const float mean_x =
+                std::accumulate(xs.begin(), xs.end(), 0.0f) / n_samples;
+            const float mean_y =
+                std::accumulate(ys.begin(), ys.end(), 0.0f) / n_samples;
+            double cov = 0;
+            double var_x = 0;
+            double var_y = 0;
+            for(const int i : boost::irange(0, n_samples)) {
+                cov += (xs[i] - mean_x) * (ys[i] - mean_y);
+                var_x += std::pow(xs[i] - mean_x, 2);
+                var_y += std::pow(ys[i] - mean_y, 2);
+            }
+            mean_abs_corr += std::abs(cov / std::sqrt(var_x * var_y));
+
+            std::sort(xs.begin(), xs.end());
+            float gap = std::max(xs.front(), 1 - xs.back());
+            for(const int i : boost::irange(1, n_samples)) {
+                gap = std::max(gap, xs[i] - xs[i - 1]);
+            }
+            mean_gap += gap;
+        }
+        EXPECT_GT(0.18, mean_gap / n_pixels) << "depth=" << depth;
+        EXPECT_GT(0.25, mean_abs_corr / n_pixels) << "depth=" << depth;
+    }
+}
+
+TEST(Sampler, distributeSamplesKeepsBudget) {
+    const auto counts = pentatope::distributeSamples({0, 1, 3, 0, 2}, 600);
+    EXPECT_EQ(std::vector<int>({0, 100, 300, 0, 200}), counts);
+
+    const std::vector<float> weights = {0.3, 0.01, 7, 0, 0.5, 1e-6, 2};
+    const auto uneven = pentatope::distributeSamples(weights, 1001);
+    EXPECT_EQ(1001, std::accumulate(uneven.begin(), uneven.end(), 0));
+    for(const int count : uneven) {
+        EXPECT_LE(0, count);
+    }
+    EXPECT_EQ(0, uneven[3]);
+
+    EXPECT_EQ(std::vector<int>({3, 2, 3, 2}),
+        pentatope::distributeSamples({0, 0, 0, 0}, 10));
+}
+
+TEST(Philox, matchesKnownAnswers) {
+    // Test vectors of Random123 (kat_vectors, philox4x32_10).
+    EXPECT_EQ((std::array<uint32_t, 4>{{
+            0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}}),
+        pentatope::philox4x32({{0, 0, 0, 0}}, {{0, 0}}));
+    EXPECT_EQ((std::array<uint32_t, 4>{{
+            0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}}),
+        pentatope::philox4x32(
+            {{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}},
+            {{0xffffffff, 0xffffffff}}));
+    EXPECT_EQ((std::array<uint32_t, 4>{{
+            0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}}),
+        pentatope::philox4x32(
+            {{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}},
+            {{0xa4093822, 0x299f31d0}}));
 }
@@ -1,7 +1,7 @@
 #include "scene.h"
 
 #include <algorithm>
-#include <random>
+#include <cmath>
 
 #include <boost/range/irange.hpp>
 #include <glog/logging.h>
@@ -10,7 +10,8 @@ namespace pentatope {
 
 Scene::Scene(const Spectrum& background_radiance, const boost::optional<float>& scattering_sigma) :
         background_radiance(background_radiance),
-        scattering_sigma(scattering_sigma) {
+        scattering_sigma(scattering_sigma),
+        packet_tracing(false) {
 }
 
 void Scene::addObject(Object object) {
@@ -21,8 +22,40 @@ void Scene::addLight(std::unique_ptr<Light> light) {
     lights.push_back(std::move(light));
 }
 
-void Scene::finalize() {
-    accel.reset(new BVHAccel());
+void Scene::finalize(
+        int n_threads, AccelType accel_type, AccelCache* cache,
+        bool packet_tracing) {
+    assert(n_threads > 0);
+    this->packet_tracing = packet_tracing;
+    if(accel_type == AccelType::AUTO) {
+        accel_type = GridAccel::isSuitableFor(objects) ?
+            AccelType::GRID : AccelType::BVH;
+        LOG(INFO) << "Chose " <<
+            ((accel_type == AccelType::GRID) ? "grid" : "BVH");
+    }
+    // Morton-order build scales with threads, and SAH at the top
+    // recovers most of the quality of full SAH.
+    const BVHBuilder::Method method = (n_threads > 1) ?
+        BVHBuilder::Method::HLBVH : BVHBuilder::Method::SAH;
+    if(accel_type == AccelType::BVH) {
+        std::unique_ptr<BVHAccel> bvh(new BVHAccel(method, n_threads));
+        if(!cache || !bvh->load(*cache, objects)) {
+            bvh->build(objects);
+            if(cache) {
+                bvh->save(*cache);
+            }
+        }
+        accel = std::move(bvh);
+        return;
+    }
+    if(accel_type == AccelType::WIDE_BVH) {
+        accel.reset(new WideBVHAccel(method, n_threads));
+    } else if(accel_type == AccelType::QUANTIZED_BVH) {
+        accel.reset(new QuantizedBVHAccel(method, n_threads));
+    } else {
+        assert(accel_type == AccelType::GRID);
+        accel.reset(new GridAccel());
+    }
     accel->build(objects);
 }
 
@@ -41,78 +74,120 @@ std::pair<std::unique_ptr<BSDF>, MicroGeometry>
     return accel->intersect(ray);
 }
 
+std::vector<std::pair<std::unique_ptr<BSDF>, MicroGeometry>>
+        Scene::intersectPacket(const std::vector<Ray>& rays) const {
+    assert(accel);
+    if(packet_tracing) {
+        return accel->intersectPacket(rays);
+    }
+    // The default one intersects rays one by one.
+    return accel->Accel::intersectPacket(rays);
+}
+
 // Samples radiance L(ray.origin, -ray.direction) by
-// raytracing.
-// Since we separated scattering to in-scattering and out-scattering,
-// they must be balanced very accurately. Otherwise, energy conservation laws will
-// be breached.
-Spectrum Scene::trace(const Ray& ray, Sampler& sampler, int depth) const {
-    if(depth <= 0) {
-        LOG_EVERY_N(INFO, 1000000) << "trace: depth threshold reached";
+// path tracing.
+Spectrum Scene::trace(const Ray& ray, Sampler& sampler, int max_depth) const {
+    if(max_depth <= 0) {
         return Spectrum::Zero();
     }
+    return shade(ray, intersect(ray), sampler, max_depth);
+}
 
-    auto isect = intersect(ray);
-    if(isect.first) {
+// Since we separated scattering to in-scattering and out-scattering,
+// they must be balanced very accurately. Otherwise, energy conservation laws will
+// be breached.
+Spectrum Scene::shade(
+        const Ray& primary_ray,
+        std::pair<std::unique_ptr<BSDF>, MicroGeometry> isect,
+        Sampler& sampler, int max_depth) const {
+    assert(max_depth > 0);
+    Spectrum radiance = Spectrum::Zero();
+    // Product of BSDF weights and attenuations along the path so far.
+    Spectrum throughput = Spectrum::Ones();
+    Ray ray = primary_ray;
+    for(int depth = 0; ; depth++) {
+        if(!isect.first) {
+            // Interestingly, uniform scattering do not affect radiance
+            // even if it's infinitely thick.
+            radiance += throughput.cwiseProduct(background_radiance);
+            break;
+        }
         const std::unique_ptr<BSDF> o_bsdf = std::move(isect.first);
         const MicroGeometry mg = isect.second;
+        // Draw fixed roles first, so that each decision uses the same
+        // dimension in all samples. The rest is for BSDF sampling.
+        sampler.startBounce(depth);
+        const float u_scatter = sampler.next1D();
+        const float u_roulette = sampler.next1D();
 
-        Spectrum radiance_surface;
+        if(scattering_sigma) {
+            // Attenuate by analytic solution of out-scattering, and
+            // add in direct in-scattering components.
+            const float dist = ray.at(mg.pos());
+            radiance += throughput.cwiseProduct(
+                inScattering(ray, dist, u_scatter));
+            throughput *= std::exp(-dist / *scattering_sigma);
+        }
+
+        radiance += throughput.cwiseProduct(
+            o_bsdf->emission(-ray.direction));
         const auto specular = o_bsdf->specular(-ray.direction);
+        if(!specular) {
+            radiance += throughput.cwiseProduct(directLightToSurface(
+                mg.pos(), mg.normal(), -ray.direction, *o_bsdf));
+        }
+        if(depth + 1 >= max_depth) {
+            LOG_EVERY_N(INFO, 1000000) << "shade: depth threshold reached";
+            break;
+        }
+
+        Eigen::Vector4f dir;
         if(specular) {
-            const auto dir = specular->first;
-            // avoid self-intersection by offseting origin.
-            Ray new_ray(mg.pos() + EPSILON_SURFACE_OFFSET * dir, dir);
-            radiance_surface =
-                specular->second.cwiseProduct(
-                    trace(new_ray, sampler, depth - 1)) +
-                o_bsdf->emission(-ray.direction);
+            dir = specular->first;
+            throughput = throughput.cwiseProduct(specular->second);
         } else {
-            const auto dir = sampler.uniformHemisphere(mg.normal());
-            // avoid self-intersection by offseting origin.
-            Ray new_ray(mg.pos() + EPSILON_SURFACE_OFFSET * dir, dir);
-            radiance_surface =
-                o_bsdf->bsdf(dir, -ray.direction).cwiseProduct(
-                    trace(new_ray, sampler, depth - 1)) *
-                (std::abs(mg.normal().dot(dir)) * pi * pi) +
-                o_bsdf->emission(-ray.direction) +
-                directLightToSurface(
-                    mg.pos() + EPSILON_SURFACE_OFFSET * dir,
-                    mg.normal(),
-                    -ray.direction, *o_bsdf);
+            const auto sample = o_bsdf->sample(-ray.direction, sampler);
+            dir = sample.first;
+            throughput = throughput.cwiseProduct(sample.second);
         }
-
-        if(scattering_sigma) {
-            const float dist = ray.at(isect.second.pos());
-
-            // Attenuate by analytic solution of out-scattering.            
-            Spectrum result = std::exp(-dist / *scattering_sigma) * radiance_surface;
-
-            // Add in direct in-scattering components.
-            // In this direct light calculation, no scattering will occur.
-            // This is so-called single-scattering approximation.
-            const int n_steps = std::ceil(dist / SCATTERING_STEP);
-            for(const int i : boost::irange(0, n_steps)) {
-                // Current region = [i * STEP, min((i + 1) * STEP, dist)]
-                const float t0 = i * SCATTERING_STEP;
-                const float t1 = std::min(dist, t0 + SCATTERING_STEP);
-
-                // We do stratified sampling to lower variance.
-                const float t_sample = std::uniform_real_distribution<float>(t0, t1)(sampler.gen);
-
-                const float transmittance = std::exp(-t_sample / *scattering_sigma);
-                result += directLightToParticle(ray.at(t_sample), -ray.direction) * transmittance * ((t1 - t0) / *scattering_sigma);
+        // Terminate paths that can't contribute much with probability
+        // 1 - p, and compensate survivors by 1 / p to stay unbiased.
+        if(depth + 1 >= ROULETTE_DEPTH) {
+            const float p_continue = std::min(1.0f, throughput.maxCoeff());
+            if(!(u_roulette < p_continue)) {
+                break;
             }
-            return result;
-        } else {
-            // Vaccum doesn't affect radiance.
-            return radiance_surface;
+            throughput /= p_continue;
         }
-    } else {
-        // Interestingly, uniform scattering do not affect radiance
-        // even if it's infinitely thick.
-        return background_radiance;
+        // avoid self-intersection by ignoring hits too close.
+        ray = Ray(mg.pos(), dir, EPSILON_SURFACE_OFFSET);
+        isect = intersect(ray);
     }
+    return radiance;
+}
+
+Spectrum Scene::inScattering(
+        const Ray& ray, float dist, float u) const {
+    assert(scattering_sigma);
+    // In this direct light calculation, no scattering will occur.
+    // This is so-called single-scattering approximation.
+    Spectrum result = Spectrum::Zero();
+    const int n_steps = std::ceil(dist / SCATTERING_STEP);
+    for(const int i : boost::irange(0, n_steps)) {
+        // Current region = [i * STEP, min((i + 1) * STEP, dist)]
+        const float t0 = i * SCATTERING_STEP;
+        const float t1 = std::min(dist, t0 + SCATTERING_STEP);
+
+        // We do stratified sampling to lower variance.
+        // Offsets in strata are u rotated by golden ratio, so that
+        // they are spread without drawing a dimension for each.
+        const float u_step = u + i * 0.618034f;
+        const float t_sample = t0 + (t1 - t0) * (u_step - std::floor(u_step));
+
+        const float transmittance = std::exp(-t_sample / *scattering_sigma);
+        result += directLightToParticle(ray.at(t_sample), -ray.direction) * transmittance * ((t1 - t0) / *scattering_sigma);
+    }
+    return result;
 }
 
 // Calculate radiance that comes to pos, and reflected to dir_out.
@@ -165,13 +240,12 @@ Spectrum Scene::directLightToParticle(
 }
 
 bool Scene::isVisibleFrom(const Eigen::Vector4f& from, const Eigen::Vector4f& to) const {
-    const Ray ray(from, (to - from).normalized());
-    const auto isect = intersect(ray);
-    if(!isect.first) {
-        // no obstacle (remember, Light doesn't intersect with rays)
-        return true;
-    }
-    return ray.at(isect.second.pos()) > (to - from).norm();
+    assert(accel);
+    const Eigen::Vector4f delta = to - from;
+    const float dist = delta.norm();
+    // Remember, Light doesn't intersect with rays.
+    return !accel->occluded(
+        Ray(from, delta / dist, EPSILON_SURFACE_OFFSET, dist));
 }
 
 
@@ -2,6 +2,7 @@
 
 #include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <boost/optional.hpp>
@@ -18,6 +19,16 @@
 
 namespace pentatope {
 
+// Acceleration structures that Scene can use.
+enum class AccelType {
+    // Choose by distribution of objects.
+    AUTO,
+    BVH,
+    WIDE_BVH,
+    QUANTIZED_BVH,
+    GRID
+};
+
 // Complete collection of visually relevant things.
 // Provides radiance interface (trace) externally.
 class Scene {
@@ -29,10 +40,16 @@ public:
     // Insert an Light to the Scene.
     void addLight(std::unique_ptr<Light> light);
 
-    // Create acceleration structure.
+    // Create acceleration structure, using up to n_threads threads.
     // This must be called for change in objects or lights
     // to take effect. 
-    void finalize();
+    // When cache is given and BVH is used, the acceleration structure
+    // is loaded from it if possible, and otherwise added to it after
+    // building.
+    // When packet_tracing, intersectPacket traces rays together.
+    void finalize(
+        int n_threads, AccelType accel_type = AccelType::AUTO,
+        AccelCache* cache = nullptr, bool packet_tracing = false);
 
     // std::unique_ptr is not nullptr if valid, otherwise invalid
     // (MicroGeometry will be undefined).
@@ -47,9 +64,23 @@ public:
     std::pair<std::unique_ptr<BSDF>, MicroGeometry>
             intersect(const Ray& ray) const;
 
+    // Same as intersect for each ray. With packet tracing enabled,
+    // faster for coherent rays in most scenes, but slower when they
+    // diverge early (e.g. large scenes of big occluders).
+    std::vector<std::pair<std::unique_ptr<BSDF>, MicroGeometry>>
+            intersectPacket(const std::vector<Ray>& rays) const;
+
     // Samples radiance L(ray.origin, -ray.direction) by
-    // raytracing.
-    Spectrum trace(const Ray& ray, Sampler& sampler, int depth) const;
+    // path tracing. Paths are terminated by Russian roulette, and
+    // always after max_depth surface interactions.
+    Spectrum trace(const Ray& ray, Sampler& sampler, int max_depth) const;
+
+    // Same as trace, but for isect that is already known to be
+    // intersect(ray). max_depth must be positive.
+    Spectrum shade(
+        const Ray& ray,
+        std::pair<std::unique_ptr<BSDF>, MicroGeometry> isect,
+        Sampler& sampler, int max_depth) const;
 
     // Calculate radiance that comes to pos, and reflected to dir_out.
     // You must not call this for specular-only BSDFs.
@@ -66,8 +97,15 @@ public:
     bool isVisibleFrom(
 		const Eigen::Vector4f& from, const Eigen::Vector4f& to) const;
 private:
+    // Radiance scattered into ray from lights, by particles
+    // in [0, dist) of the ray. u in [0, 1) places samples in strata.
+    Spectrum inScattering(
+        const Ray& ray, float dist, float u) const;
+
     const float EPSILON_SURFACE_OFFSET = 1e-6;
     const float SCATTERING_STEP = 2.5;
+    // Russian roulette starts after this many surface interactions.
+    const int ROULETTE_DEPTH = 3;
 
     std::vector<Object> objects;
     std::vector<std::unique_ptr<Light>> lights;
@@ -76,6 +114,7 @@ private:
     boost::optional<float> scattering_sigma;
 
     std::unique_ptr<Accel> accel;
+    bool packet_tracing;
 };
 
 }  // namespace
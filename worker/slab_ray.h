@@ -0,0 +1,105 @@
+// Ray-AABB slab tests shared by BVH traversals.
+// Defined inline, since they're in the innermost loop of traversal.
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <limits>
+
+#include <xmmintrin.h>
+
+#include <boost/range/irange.hpp>
+#include <Eigen/Dense>
+
+#include <space.h>
+
+namespace pentatope {
+
+// A ray prepared for repeated slab tests against AABBs.
+class SlabRay {
+public:
+    SlabRay(const Ray& ray) : origin(ray.origin), t_min(ray.t_min) {
+        for(const int axis : boost::irange(0, 4)) {
+            // Avoid 0 * inf = NaN when origin is on a slab boundary.
+            const float d = ray.direction(axis);
+            inv_direction(axis) = (d != 0) ?
+                1 / d :
+                std::copysign(std::numeric_limits<float>::max(), d);
+        }
+    }
+
+    // Returns true when the ray overlaps [vmin, vmax] within
+    // (ray.t_min, t_max). When true, t_entry will be the entering
+    // distance (ray.t_min if the ray starts inside).
+    bool intersect(
+            const Eigen::Vector4f& vmin, const Eigen::Vector4f& vmax,
+            float t_max, float& t_entry) const {
+        const Eigen::Array4f t0 =
+            (vmin - origin).array() * inv_direction.array();
+        const Eigen::Array4f t1 =
+            (vmax - origin).array() * inv_direction.array();
+        const float t_near = std::max(t_min, t0.min(t1).maxCoeff());
+        const float t_far = std::min(t_max, t0.max(t1).minCoeff());
+        t_entry = t_near;
+        return t_near <= t_far;
+    }
+
+    const Eigen::Vector4f& getOrigin() const {
+        return origin;
+    }
+
+    const Eigen::Vector4f& getInvDirection() const {
+        return inv_direction;
+    }
+
+    float getTMin() const {
+        return t_min;
+    }
+private:
+    Eigen::Vector4f origin;
+    Eigen::Vector4f inv_direction;
+    float t_min;
+};
+
+
+// A ray broadcasted to 4 SSE lanes, to test 4 AABBs at once.
+class SlabRay4 {
+public:
+    SlabRay4(const Ray& ray) {
+        const SlabRay slab_ray(ray);
+        for(const int axis : boost::irange(0, 4)) {
+            origin[axis] = _mm_set1_ps(slab_ray.getOrigin()(axis));
+            inv_direction[axis] =
+                _mm_set1_ps(slab_ray.getInvDirection()(axis));
+        }
+        t_min = _mm_set1_ps(slab_ray.getTMin());
+    }
+
+    // AABBs are given in SoA layout ([axis][lane]), aligned to 16 bytes.
+    // Returns a bitmask of lanes that the ray overlaps within
+    // (ray.t_min, t_max), and stores entering distances to t_entries.
+    int intersect(
+            const float vmin[4][4], const float vmax[4][4],
+            float t_max, float* t_entries) const {
+        __m128 t_near = t_min;
+        __m128 t_far = _mm_set1_ps(t_max);
+        for(const int axis : boost::irange(0, 4)) {
+            const __m128 t0 = _mm_mul_ps(
+                _mm_sub_ps(_mm_load_ps(vmin[axis]), origin[axis]),
+                inv_direction[axis]);
+            const __m128 t1 = _mm_mul_ps(
+                _mm_sub_ps(_mm_load_ps(vmax[axis]), origin[axis]),
+                inv_direction[axis]);
+            t_near = _mm_max_ps(t_near, _mm_min_ps(t0, t1));
+            t_far = _mm_min_ps(t_far, _mm_max_ps(t0, t1));
+        }
+        _mm_storeu_ps(t_entries, t_near);
+        return _mm_movemask_ps(_mm_cmple_ps(t_near, t_far));
+    }
+private:
+    std::array<__m128, 4> origin;
+    std::array<__m128, 4> inv_direction;
+    __m128 t_min;
+};
+
+}  // namespace
@@ -30,8 +30,9 @@ Eigen::Transform<float, 4, Eigen::Affine> Pose::asInverseAffine() const {
     return inv;
 }
 
-Ray::Ray(Eigen::Vector4f origin, Eigen::Vector4f direction) :
-    origin(origin), direction(direction) {
+Ray::Ray(Eigen::Vector4f origin, Eigen::Vector4f direction,
+        float t_min, float t_max) :
+    origin(origin), direction(direction), t_min(t_min), t_max(t_max) {
 }
 
 Eigen::Vector4f Ray::at(float t) const {
@@ -4,6 +4,7 @@
 // Don't put radiometry stuff here.
 #pragma once
 
+#include <limits>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -43,17 +44,24 @@ private:
 };
 
 
-// intersection range: (0, +inf)
+// intersection range: (t_min, t_max)
 class Ray {
 public:
-    Ray(Eigen::Vector4f origin, Eigen::Vector4f direction);
+    Ray(Eigen::Vector4f origin, Eigen::Vector4f direction,
+        float t_min = 0,
+        float t_max = std::numeric_limits<float>::infinity());
 
     // point <-> distance converions.
     Eigen::Vector4f at(float t) const;
     float at(const Eigen::Vector4f& pos) const;
 public:
-    const Eigen::Vector4f origin;
-    const Eigen::Vector4f direction;
+    // non-const to allow reusing a Ray for the next path segment.
+    Eigen::Vector4f origin;
+    Eigen::Vector4f direction;
+    // Intersections outside of this are ignored. Traversals shrink
+    // t_max of their copy as they find nearer hits.
+    float t_min;
+    float t_max;
 };
 
 
@@ -0,0 +1,306 @@
+#include "tetra_mesh.h"
+
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include <boost/range/irange.hpp>
+#include <glog/logging.h>
+
+#include <slab_ray.h>
+
+namespace pentatope {
+
+namespace {
+
+// Bounds of tetra within [lo, hi] along axis. Vertices of the
+// clipped polytope are vertices of tetra within the slab, or
+// intersections of edges with the slab boundaries.
+boost::optional<AABB> clipTetrahedron(
+        const std::array<Eigen::Vector4f, 4>& tetra,
+        int axis, float lo, float hi) {
+    std::vector<Eigen::Vector4f> points;
+    for(const auto& vertex : tetra) {
+        if(lo <= vertex(axis) && vertex(axis) <= hi) {
+            points.push_back(vertex);
+        }
+    }
+    for(const int i : boost::irange(0, 4)) {
+        for(const int j : boost::irange(i + 1, 4)) {
+            const Eigen::Vector4f& v0 = tetra[i];
+            const Eigen::Vector4f& v1 = tetra[j];
+            for(const float plane : {lo, hi}) {
+                if((v0(axis) - plane) * (v1(axis) - plane) >= 0) {
+                    continue;
+                }
+                const float t = (plane - v0(axis)) / (v1(axis) - v0(axis));
+                Eigen::Vector4f point = v0 + t * (v1 - v0);
+                point(axis) = plane;
+                points.push_back(point);
+            }
+        }
+    }
+    if(points.empty()) {
+        return boost::none;
+    }
+    return AABB::fromConvexVertices(points);
+}
+
+}  // namespace
+
+TetraMesh::TetraMesh(
+        const std::vector<Eigen::Vector4f>& vertices,
+        const std::vector<std::array<uint32_t, 4>>& indices,
+        float max_reference_growth, AccelCache* cache) :
+        vertices(vertices), indices(indices) {
+    if(indices.empty()) {
+        throw std::invalid_argument("TetraMesh requires at least 1 tetrahedron");
+    }
+    for(const auto& tetra : indices) {
+        for(const uint32_t index : tetra) {
+            if(index >= vertices.size()) {
+                throw std::invalid_argument("TetraMesh vertex index out of range");
+            }
+        }
+    }
+
+    normals.reserve(indices.size());
+    for(const int i : boost::irange(0, size())) {
+        normals.push_back(TetrahedronBasis(getTetrahedron(i)).normal());
+    }
+
+    if(!cache || !load(*cache)) {
+        build(max_reference_growth);
+        if(cache) {
+            save(*cache);
+        }
+    }
+}
+
+boost::optional<RayHit> TetraMesh::intersectHit(const Ray& ray) const {
+    const SlabRay slab_ray(ray);
+    boost::optional<RayHit> hit_nearest;
+    // Shrinks as nearer hits are found.
+    Ray query(ray);
+
+    // Same as BVHAccel::intersect.
+    std::array<std::pair<uint32_t, float>, BVHBuilder::max_depth + 1> stack;
+    int stack_size = 0;
+    stack[stack_size++] = std::make_pair(0, ray.t_min);
+    while(stack_size > 0) {
+        stack_size--;
+        if(stack[stack_size].second > query.t_max) {
+            continue;
+        }
+        uint32_t current = stack[stack_size].first;
+        float t_entry;
+        if(!slab_ray.intersect(
+                node_array[current].vmin, node_array[current].vmax,
+                query.t_max, t_entry)) {
+            continue;
+        }
+        // Descend to a leaf, visiting nearer child first.
+        while(node_array[current].count == 0) {
+            const uint32_t child0 = current + 1;
+            const uint32_t child1 = node_array[current].offset;
+            float t_entry0;
+            float t_entry1;
+            const bool hit0 = slab_ray.intersect(
+                node_array[child0].vmin, node_array[child0].vmax, query.t_max, t_entry0);
+            const bool hit1 = slab_ray.intersect(
+                node_array[child1].vmin, node_array[child1].vmax, query.t_max, t_entry1);
+            if(hit0 && hit1) {
+                assert(stack_size < static_cast<int>(stack.size()));
+                if(t_entry0 <= t_entry1) {
+                    stack[stack_size++] = std::make_pair(child1, t_entry1);
+                    current = child0;
+                } else {
+                    stack[stack_size++] = std::make_pair(child0, t_entry0);
+                    current = child1;
+                }
+            } else if(hit0) {
+                current = child0;
+            } else if(hit1) {
+                current = child1;
+            } else {
+                break;
+            }
+        }
+        if(node_array[current].count == 0) {
+            continue;
+        }
+        const Block& block = block_array[node_array[current].offset];
+        int lane;
+        auto hit = block.tetrahedra.intersect(
+            query, (1 << node_array[current].count) - 1, lane);
+        if(hit) {
+            hit->element = block.elements[lane];
+            hit_nearest = hit;
+            query.t_max = hit->t;
+        }
+    }
+    return hit_nearest;
+}
+
+MicroGeometry TetraMesh::microGeometry(
+        const Ray& ray, const RayHit& hit) const {
+    // Face the ray.
+    const Eigen::Vector4f normal = normals[hit.element];
+    return MicroGeometry(
+        ray.at(hit.t),
+        (ray.direction.dot(normal) > 0) ?
+            static_cast<Eigen::Vector4f>(-normal) : normal);
+}
+
+AABB TetraMesh::bounds() const {
+    return AABB(node_array[0].vmin, node_array[0].vmax);
+}
+
+int TetraMesh::size() const {
+    return indices.size();
+}
+
+int TetraMesh::numReferences() const {
+    int n_references = 0;
+    for(const uint32_t i : boost::irange(0u, n_nodes)) {
+        n_references += node_array[i].count;
+    }
+    return n_references;
+}
+
+std::array<Eigen::Vector4f, 4> TetraMesh::getTetrahedron(int i) const {
+    return std::array<Eigen::Vector4f, 4>({
+        vertices[indices[i][0]], vertices[indices[i][1]],
+        vertices[indices[i][2]], vertices[indices[i][3]]});
+}
+
+void TetraMesh::build(float max_reference_growth) {
+    std::vector<AABB> aabbs;
+    aabbs.reserve(indices.size());
+    for(const auto& tetra : indices) {
+        aabbs.push_back(AABB::fromConvexVertices({
+            vertices[tetra[0]], vertices[tetra[1]],
+            vertices[tetra[2]], vertices[tetra[3]]}));
+    }
+
+    // Leaves become blocks, so limit their size to the block width.
+    BVHBuilder builder(BVHBuilder::Method::SAH, 1, primitive_block_width);
+    const auto root = (max_reference_growth > 0) ?
+        builder.buildSpatial(aabbs,
+            [this](int index, int axis, float lo, float hi) {
+                return clipTetrahedron(getTetrahedron(index), axis, lo, hi);
+            },
+            max_reference_growth) :
+        builder.build(aabbs);
+    flatten(*root, builder.getOrderedIndices());
+    block_array = blocks.data();
+    node_array = nodes.data();
+    n_nodes = nodes.size();
+}
+
+uint32_t TetraMesh::flatten(
+        const BVHBuildNode& node, const std::vector<int>& ordered_indices) {
+    const uint32_t index = nodes.size();
+    nodes.emplace_back();
+    nodes[index].vmin = node.aabb.min();
+    nodes[index].vmax = node.aabb.max();
+    if(node.isLeaf()) {
+        assert(node.count <= primitive_block_width);
+        Block block = {};
+        for(const int lane : boost::irange(0, node.count)) {
+            const int element = ordered_indices[node.first + lane];
+            block.elements[lane] = element;
+            block.tetrahedra.set(
+                lane, TetrahedronBasis(getTetrahedron(element)));
+        }
+        nodes[index].offset = blocks.size();
+        nodes[index].count = node.count;
+        blocks.push_back(block);
+    } else {
+        flatten(*node.left, ordered_indices);
+        // Don't hold reference to nodes[index] across recursion,
+        // since nodes can be reallocated.
+        const uint32_t index_right = flatten(*node.right, ordered_indices);
+        nodes[index].offset = index_right;
+        nodes[index].count = 0;
+    }
+    return index;
+}
+
+void TetraMesh::save(AccelCache& cache) const {
+    static_assert(sizeof(CacheHeader) % 16 == 0 &&
+        sizeof(LinearNode) % 16 == 0,
+        "nodes and blocks must be aligned");
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.node_size = sizeof(LinearNode);
+    header.block_size = sizeof(Block);
+    header.n_nodes = n_nodes;
+    header.n_blocks = blocks.size();
+    header.n_tetrahedra = size();
+
+    std::string section;
+    section.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    section.append(reinterpret_cast<const char*>(node_array),
+        sizeof(LinearNode) * n_nodes);
+    section.append(reinterpret_cast<const char*>(block_array),
+        sizeof(Block) * header.n_blocks);
+    cache.addSection(std::move(section));
+}
+
+bool TetraMesh::load(AccelCache& cache) {
+    const auto section = cache.nextSection();
+    if(!section) {
+        return false;
+    }
+    CacheHeader header;
+    if(section->size < sizeof(header)) {
+        LOG(WARNING) << "Ignoring incompatible TetraMesh cache";
+        return false;
+    }
+    std::memcpy(&header, section->data, sizeof(header));
+    if(header.node_size != sizeof(LinearNode) ||
+            header.block_size != sizeof(Block) ||
+            header.n_tetrahedra != indices.size() ||
+            header.n_nodes == 0 ||
+            section->size != sizeof(CacheHeader) +
+                sizeof(LinearNode) * static_cast<size_t>(header.n_nodes) +
+                sizeof(Block) * static_cast<size_t>(header.n_blocks)) {
+        LOG(WARNING) << "Ignoring incompatible TetraMesh cache";
+        return false;
+    }
+    const LinearNode* section_nodes = reinterpret_cast<const LinearNode*>(
+        section->data + sizeof(CacheHeader));
+    const Block* section_blocks = reinterpret_cast<const Block*>(
+        section->data + sizeof(CacheHeader) +
+        sizeof(LinearNode) * header.n_nodes);
+
+    // Validate all references, so that a corrupted file can't make
+    // traversal read out of bounds.
+    const bool valid = isValidTree(section_nodes, header.n_nodes,
+        [&header, section_blocks](const LinearNode& leaf) {
+            if(leaf.offset >= header.n_blocks ||
+                    leaf.count > primitive_block_width) {
+                return false;
+            }
+            const Block& block = section_blocks[leaf.offset];
+            for(const int lane : boost::irange<int>(0, leaf.count)) {
+                if(block.elements[lane] >= header.n_tetrahedra) {
+                    return false;
+                }
+            }
+            return true;
+        });
+    if(!valid) {
+        LOG(WARNING) << "Ignoring corrupted TetraMesh cache";
+        return false;
+    }
+    mapping = cache.getMapping();
+    block_array = section_blocks;
+    node_array = section_nodes;
+    n_nodes = header.n_nodes;
+    return true;
+}
+
+}  // namespace
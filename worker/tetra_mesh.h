@@ -0,0 +1,125 @@
+// An indexed mesh of tetrahedra, which is how large surfaces
+// (e.g. terrain) are represented.
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <boost/optional.hpp>
+#include <Eigen/Dense>
+
+#include <accel_cache.h>
+#include <bvh_builder.h>
+#include <geometry.h>
+#include <mapped_file.h>
+#include <primitive_block.h>
+#include <space.h>
+
+namespace pentatope {
+
+// Tetrahedra sharing a vertex buffer. Tetrahedra are organized in
+// an internal BVH, so a mesh of any size can be a single Object.
+// Each leaf is a TetrahedronBlock of up to 4 tetrahedra.
+// RayHit::element is an index of a tetrahedron in the mesh.
+class TetraMesh : public Geometry {
+public:
+    // Each element of indices refers to 4 vertices of a tetrahedron.
+    // Throws std::invalid_argument when indices is empty or
+    // refers to non-existent vertices.
+    //
+    // When max_reference_growth > 0, the BVH uses spatial splits,
+    // which help long and thin tetrahedra (e.g. terrain). A tetrahedron
+    // can then be in multiple leaves, but total references are at most
+    // (1 + max_reference_growth) times the number of tetrahedra.
+    //
+    // When cache is given, the BVH is used from its next section if it
+    // matches this mesh, and otherwise added to it after building.
+    TetraMesh(
+        const std::vector<Eigen::Vector4f>& vertices,
+        const std::vector<std::array<uint32_t, 4>>& indices,
+        float max_reference_growth = 0, AccelCache* cache = nullptr);
+
+    // Nodes and blocks may point into vectors or a mapped file,
+    // so the mesh can be moved but not copied.
+    TetraMesh(TetraMesh&& mesh) = default;
+    TetraMesh(const TetraMesh& mesh) = delete;
+    TetraMesh& operator=(const TetraMesh& mesh) = delete;
+
+    boost::optional<RayHit>
+        intersectHit(const Ray& ray) const override;
+    MicroGeometry microGeometry(
+        const Ray& ray, const RayHit& hit) const override;
+
+    AABB bounds() const override;
+
+    // Number of tetrahedra.
+    int size() const;
+    // Number of tetrahedra referred by BVH leaves. Same as size()
+    // unless spatial splits are used.
+    int numReferences() const;
+
+    // Vertices of the i-th tetrahedron.
+    std::array<Eigen::Vector4f, 4> getTetrahedron(int i) const;
+private:
+    // Tetrahedra of a leaf, tested by a single SSE kernel.
+    struct Block {
+        TetrahedronBlock tetrahedra;
+        // Indices of tetrahedra in lanes.
+        uint32_t elements[primitive_block_width];
+    };
+
+    // Same layout as BVHAccel's. The first child of a branch
+    // immediately follows the branch itself.
+    struct LinearNode {
+        Eigen::Vector4f vmin;
+        Eigen::Vector4f vmax;
+
+        // branch: index of the second child in nodes.
+        // leaf: index of the block in blocks.
+        uint32_t offset;
+        // Number of tetrahedra (lanes of the block) in a leaf.
+        // 0 for a branch.
+        uint32_t count;
+    };
+
+    // Layout of a cached BVH is
+    // [CacheHeader][LinearNode * n_nodes][Block * n_blocks]
+    struct CacheHeader {
+        uint32_t node_size;
+        uint32_t block_size;
+        uint32_t n_nodes;
+        uint32_t n_blocks;
+        uint32_t n_tetrahedra;
+        uint32_t reserved[3];
+    };
+
+    void build(float max_reference_growth);
+
+    // Append node and its descendants to nodes in depth-first order,
+    // and return index of node. ordered_indices is given by BVHBuilder.
+    uint32_t flatten(
+        const BVHBuildNode& node, const std::vector<int>& ordered_indices);
+
+    void save(AccelCache& cache) const;
+
+    // Use the BVH in the next section of cache. Returns false when
+    // there's no section or it doesn't match this mesh.
+    bool load(AccelCache& cache);
+
+    std::vector<Eigen::Vector4f> vertices;
+    std::vector<std::array<uint32_t, 4>> indices;
+    // normals[i] is the unit normal of indices[i], with arbitrary sign.
+    std::vector<Eigen::Vector4f> normals;
+    // Used by traversal. Point to either blocks and nodes (after build)
+    // or inside mapping (after load).
+    const Block* block_array;
+    const LinearNode* node_array;
+    uint32_t n_nodes;
+    std::vector<Block> blocks;
+    std::vector<LinearNode> nodes;
+    std::shared_ptr<const MappedFile> mapping;
+};
+
+}  // namespace
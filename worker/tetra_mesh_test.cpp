@@ -0,0 +1,165 @@
+#include "tetra_mesh.h"
+
+#include <random>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+#include <boost/range/irange.hpp>
+#include <gtest/gtest.h>
+
+#include <arbitrary_test.h>
+
+namespace {
+
+// A bumpy height field on the x-y-z grid, split into tetrahedra.
+pentatope::TetraMesh arbitraryTerrain(
+        std::mt19937& rg, int n, pentatope::AccelCache* cache = nullptr) {
+    std::uniform_real_distribution<float> height(-5, 5);
+    std::vector<Eigen::Vector4f> vertices;
+    for(const int ix : boost::irange(0, n)) {
+        for(const int iy : boost::irange(0, n)) {
+            for(const int iz : boost::irange(0, n)) {
+                vertices.emplace_back(
+                    ix * 10 - 50, iy * 10 - 50, iz * 10 - 50, height(rg));
+            }
+        }
+    }
+    auto at = [n](int ix, int iy, int iz) {
+        return static_cast<uint32_t>((ix * n + iy) * n + iz);
+    };
+    // Split each cube into 6 tetrahedra along the diagonal.
+    std::vector<std::array<uint32_t, 4>> indices;
+    for(const int ix : boost::irange(0, n - 1)) {
+        for(const int iy : boost::irange(0, n - 1)) {
+            for(const int iz : boost::irange(0, n - 1)) {
+                const uint32_t v000 = at(ix, iy, iz);
+                const uint32_t v111 = at(ix + 1, iy + 1, iz + 1);
+                const std::array<uint32_t, 6> path = {
+                    at(ix + 1, iy, iz), at(ix + 1, iy + 1, iz),
+                    at(ix, iy + 1, iz), at(ix, iy + 1, iz + 1),
+                    at(ix, iy, iz + 1), at(ix + 1, iy, iz + 1)};
+                for(const int i : boost::irange(0, 6)) {
+                    indices.push_back({
+                        v000, path[i], path[(i + 1) % 6], v111});
+                }
+            }
+        }
+    }
+    return pentatope::TetraMesh(vertices, indices, 0, cache);
+}
+
+void checkIdenticalToTetrahedra(
+        std::mt19937& rg, const pentatope::TetraMesh& mesh) {
+    std::vector<pentatope::Tetrahedron> tetras;
+    for(const int i : boost::irange(0, mesh.size())) {
+        tetras.emplace_back(mesh.getTetrahedron(i));
+    }
+
+    int n_hits = 0;
+    for(const int i : boost::irange(0, 1000)) {
+        // Rays towards the mesh from above.
+        const auto ray_base = arbitraryRay(rg);
+        Eigen::Vector4f origin = ray_base.origin;
+        Eigen::Vector4f direction = ray_base.direction;
+        origin(3) = 20;
+        direction(3) = -std::abs(direction(3)) - 0.5;
+        const pentatope::Ray ray(origin, direction.normalized());
+
+        boost::optional<float> t_expected;
+        for(const auto& tetra : tetras) {
+            const auto hit = tetra.intersectHit(ray);
+            if(hit && (!t_expected || hit->t < *t_expected)) {
+                t_expected = hit->t;
+            }
+        }
+        const auto hit = mesh.intersectHit(ray);
+        ASSERT_EQ(static_cast<bool>(t_expected), static_cast<bool>(hit));
+        if(!hit) {
+            continue;
+        }
+        n_hits++;
+        EXPECT_NEAR(*t_expected, hit->t, 1e-3);
+        const auto geom = mesh.microGeometry(ray, *hit);
+        EXPECT_NEAR(1, geom.normal().norm(), 1e-3);
+        EXPECT_GE(0, geom.normal().dot(ray.direction));
+    }
+    EXPECT_LT(0, n_hits);
+}
+
+}  // namespace
+
+
+TEST(TetraMesh, BehaveIdenticallyToTetrahedra) {
+    std::mt19937 rg;
+    const auto mesh = arbitraryTerrain(rg, 8);
+    EXPECT_EQ(mesh.size(), mesh.numReferences());
+    checkIdenticalToTetrahedra(rg, mesh);
+}
+
+TEST(TetraMesh, CachedBehaveIdenticallyToTetrahedra) {
+    const std::string path = (boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path()).string();
+    {
+        std::mt19937 rg;
+        pentatope::AccelCache cache(path);
+        arbitraryTerrain(rg, 8, &cache);
+        cache.save();
+    }
+
+    std::mt19937 rg;
+    pentatope::AccelCache cache(path);
+    const auto mesh = arbitraryTerrain(rg, 8, &cache);
+    EXPECT_EQ(mesh.size(), mesh.numReferences());
+    checkIdenticalToTetrahedra(rg, mesh);
+    // The BVH came from the file, so it's kept.
+    cache.save();
+    EXPECT_TRUE(boost::filesystem::exists(path));
+
+    // The BVH of a different mesh must not be used.
+    std::mt19937 rg_other;
+    pentatope::AccelCache cache_other(path);
+    const auto other = arbitraryTerrain(rg_other, 6, &cache_other);
+    checkIdenticalToTetrahedra(rg_other, other);
+    cache_other.save();
+    EXPECT_FALSE(boost::filesystem::exists(path));
+}
+
+TEST(TetraMesh, SpatialSplitsBehaveIdenticallyToTetrahedra) {
+    std::mt19937 rg;
+    // Long and thin tetrahedra along the diagonal.
+    std::uniform_real_distribution<float> coord(-50, 50);
+    std::uniform_real_distribution<float> jitter(-1, 1);
+    std::vector<Eigen::Vector4f> vertices;
+    std::vector<std::array<uint32_t, 4>> indices;
+    for(const int i : boost::irange(0, 500)) {
+        const Eigen::Vector4f base(coord(rg), coord(rg), coord(rg), -20);
+        const uint32_t first = vertices.size();
+        vertices.push_back(base);
+        vertices.push_back(base + Eigen::Vector4f(30, 30, 30, 10));
+        vertices.push_back(base + Eigen::Vector4f(
+            8 + jitter(rg), jitter(rg), jitter(rg), 5));
+        vertices.push_back(base + Eigen::Vector4f(
+            jitter(rg), 8 + jitter(rg), jitter(rg), 5));
+        indices.push_back({first, first + 1, first + 2, first + 3});
+    }
+    const pentatope::TetraMesh mesh(vertices, indices, 0.5);
+    EXPECT_LE(mesh.size(), mesh.numReferences());
+    EXPECT_GE(mesh.size() * 1.5, mesh.numReferences());
+    checkIdenticalToTetrahedra(rg, mesh);
+}
+
+TEST(TetraMesh, RejectsInvalidIndices) {
+    const std::vector<Eigen::Vector4f> vertices = {
+        Eigen::Vector4f(0, 0, 0, 0),
+        Eigen::Vector4f(1, 0, 0, 0),
+        Eigen::Vector4f(0, 1, 0, 0),
+        Eigen::Vector4f(0, 0, 1, 0)};
+    EXPECT_THROW(
+        pentatope::TetraMesh(vertices, {}),
+        std::invalid_argument);
+    EXPECT_THROW(
+        pentatope::TetraMesh(vertices, {{0, 1, 2, 4}}),
+        std::invalid_argument);
+    EXPECT_NO_THROW(
+        pentatope::TetraMesh(vertices, {{0, 1, 2, 3}}));
+}